@@ -0,0 +1,232 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+/* Arena.hpp
+ *
+ * A bump-pointer memory arena and an allocator that draws from it.
+ *
+ * Arena_allocator is meant to be passed as the Allocator argument of
+ * BinarySearchTree or Map:
+ *
+ *   Map<std::string, int, std::less<std::string>, AVL_tree,
+ *       Arena_allocator<std::pair<std::string, int>>> counts;
+ *
+ * Nodes are then carved out of large blocks one after another, so nodes
+ * created together sit next to each other in memory, and there is no
+ * per-node call into the general-purpose heap. A deallocated block of
+ * up to Arena::max_recycled_size bytes goes on a free list and is handed
+ * out again by the next allocation of the same size, so a Map that keeps
+ * erasing and inserting stays within the memory of its largest size.
+ * Larger blocks are only reclaimed, like everything else, when the last
+ * allocator sharing the arena is destroyed.
+ */
+
+#include <cassert>  //assert
+#include <cstddef>  //size_t, max_align_t
+#include <memory>   //shared_ptr
+#include <new>      //operator new, placement new
+#include <type_traits> //true_type
+
+class Arena {
+  // OVERVIEW: Hands out memory by bumping a pointer through a chain of
+  //           blocks. Each new block is twice the size of the previous
+  //           one (up to a limit), so the number of blocks grows only
+  //           logarithmically with the total memory used. Small pieces
+  //           that are given back are kept on one free list per size,
+  //           in steps of a pointer's size, and reused first.
+
+public:
+  // EFFECTS: Creates an empty arena whose first block will hold
+  //          first_block_size bytes.
+  explicit Arena(size_t first_block_size = 4096)
+    : head(nullptr), next(nullptr), remaining(0),
+      next_block_size(first_block_size), reserved(0), allocations(0),
+      free_lists() { }
+
+  // Arenas own their blocks and are not copyable
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // EFFECTS: Frees every block. Objects allocated from the arena are not
+  //          destroyed; their destructors must already have run.
+  ~Arena() {
+    while (head) {
+      Block *prev = head->prev;
+      ::operator delete(head);
+      head = prev;
+    }
+  }
+
+  // Deallocated pieces up to this size are reused
+  static const size_t max_recycled_size = 256;
+
+  // REQUIRES: align is a power of two no greater than alignof(max_align_t)
+  // EFFECTS : Returns a pointer to bytes bytes of uninitialized memory
+  //           aligned to align, reusing a deallocated piece of the same
+  //           size if there is a suitably aligned one.
+  void *allocate(size_t bytes, size_t align) {
+    assert(align <= alignof(std::max_align_t) && (align & (align - 1)) == 0);
+    size_t size_class = size_class_of(bytes);
+    if (size_class < free_list_count) {
+      Free_piece *piece = free_lists[size_class];
+      if (piece != nullptr &&
+          reinterpret_cast<size_t>(piece) % align == 0) {
+        free_lists[size_class] = piece->next;
+        ++allocations;
+        return piece;
+      }
+      // Round up, so the piece can hold a Free_piece once deallocated
+      bytes = size_class * sizeof(Free_piece);
+    }
+    size_t padding = (align - reinterpret_cast<size_t>(next) % align) % align;
+    if (padding + bytes > remaining) {
+      add_block(bytes);
+      padding = 0; // block payloads are max-aligned
+    }
+    char *result = next + padding;
+    next = result + bytes;
+    remaining -= padding + bytes;
+    ++allocations;
+    return result;
+  }
+
+  // REQUIRES: p was returned by allocate(bytes, align) on this arena and
+  //           has not been deallocated since
+  // EFFECTS : Puts p on the free list for its size, if it is small
+  //           enough to be reused; otherwise does nothing.
+  void deallocate(void *p, size_t bytes) {
+    size_t size_class = size_class_of(bytes);
+    if (size_class < free_list_count) {
+      free_lists[size_class] = ::new (p) Free_piece{ free_lists[size_class] };
+    }
+  }
+
+  // EFFECTS: Returns the total number of bytes obtained from the heap.
+  size_t bytes_reserved() const {
+    return reserved;
+  }
+
+  // EFFECTS: Returns the number of calls to allocate().
+  size_t allocation_count() const {
+    return allocations;
+  }
+
+private:
+  // A Block header precedes the usable memory of each block.
+  struct alignas(std::max_align_t) Block {
+    Block *prev;
+  };
+
+  // A deallocated piece, linked into the free list for its size
+  struct Free_piece {
+    Free_piece *next;
+  };
+
+  static const size_t max_block_size = size_t(1) << 20;
+
+  // free_lists[c] holds pieces of c * sizeof(Free_piece) bytes
+  static const size_t free_list_count =
+    max_recycled_size / sizeof(Free_piece) + 1;
+
+  Block *head;            // most recent block
+  char *next;             // first free byte in head
+  size_t remaining;       // free bytes left in head
+  size_t next_block_size; // payload size of the next block
+  size_t reserved;
+  size_t allocations;
+  Free_piece *free_lists[free_list_count];
+
+  // EFFECTS: Returns the free list that holds pieces of the given size,
+  //          which is at least 1 so that every piece fits a Free_piece.
+  static size_t size_class_of(size_t bytes) {
+    return bytes == 0 ? 1 : (bytes + sizeof(Free_piece) - 1) /
+                            sizeof(Free_piece);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Starts a new block with room for at least min_bytes bytes.
+  void add_block(size_t min_bytes) {
+    size_t size = next_block_size < min_bytes ? min_bytes : next_block_size;
+    Block *block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+    block->prev = head;
+    head = block;
+    next = reinterpret_cast<char *>(block + 1);
+    remaining = size;
+    reserved += sizeof(Block) + size;
+    if (next_block_size < max_block_size) {
+      next_block_size *= 2;
+    }
+  }
+};
+
+template <typename T>
+class Arena_allocator {
+  // OVERVIEW: A standard allocator backed by a shared Arena. Copies of
+  //           an Arena_allocator (including rebound copies) share the
+  //           same Arena, which is freed when the last copy goes away.
+  //           A default-constructed Arena_allocator creates a fresh Arena.
+
+public:
+  using value_type = T;
+
+  // Tells BinarySearchTree that memory need not be deallocated, since it
+  // all goes back to the heap with the arena, so a tree of trivially
+  // destructible elements can be discarded without visiting its nodes.
+  // Its nodes are then not recycled: clearing such a tree and filling it
+  // again takes fresh memory from the arena.
+  using is_bulk_releasing = void;
+
+  // Containers copied from one using an Arena_allocator get their own
+  // arena, so each tree's memory is released when that tree is destroyed.
+  Arena_allocator select_on_container_copy_construction() const {
+    return Arena_allocator();
+  }
+
+  // Moving or swapping containers hands over the arena along with the
+  // elements, so no element needs to be copied between arenas.
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  Arena_allocator()
+    : arena(std::make_shared<Arena>()) { }
+
+  explicit Arena_allocator(std::shared_ptr<Arena> arena_in)
+    : arena(arena_in) { }
+
+  template <typename U>
+  Arena_allocator(const Arena_allocator<U> &other)
+    : arena(other.arena) { }
+
+  // EFFECTS: Returns uninitialized memory for n objects of type T.
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  // EFFECTS: Lets the arena reuse the memory of n objects of type T for
+  //          a later allocation of the same size (see Arena::deallocate).
+  void deallocate(T *p, size_t n) {
+    arena->deallocate(p, n * sizeof(T));
+  }
+
+  // EFFECTS: Returns the arena this allocator draws from.
+  const Arena &get_arena() const {
+    return *arena;
+  }
+
+  template <typename U>
+  bool operator==(const Arena_allocator<U> &rhs) const {
+    return arena == rhs.arena;
+  }
+
+  template <typename U>
+  bool operator!=(const Arena_allocator<U> &rhs) const {
+    return arena != rhs.arena;
+  }
+
+private:
+  template <typename U>
+  friend class Arena_allocator;
+
+  std::shared_ptr<Arena> arena;
+};
+
+#endif // ARENA_HPP
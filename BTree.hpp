@@ -0,0 +1,1474 @@
+#ifndef BTREE_HPP
+#define BTREE_HPP
+/* BTree.hpp
+ *
+ * A B+ tree: an ordered set of unique elements stored many to a node,
+ * with nodes a few cache lines wide. Compared with a binary tree, a
+ * lookup touches far fewer nodes, and the keys it compares against in
+ * each node sit next to each other in memory.
+ *
+ * A BTree can be used on its own, or as the storage of a Map by passing
+ * a BTree_layout as the Map's Storage argument:
+ *
+ *   Map<std::string, int, std::less<std::string>, BTree_layout<>> counts;
+ */
+
+#include <algorithm>   //adjacent_find
+#include <cassert>     //assert
+#include <cstddef>     //size_t, ptrdiff_t
+#include <cstdint>     //int32_t
+#include <functional>  //less
+#include <iterator>    //bidirectional_iterator_tag, reverse_iterator
+#include <memory>      //allocator, allocator_traits
+#include <new>         //launder
+#include <type_traits> //is_same, is_arithmetic
+#include <utility>     //pair, move, forward
+#include <vector>
+#include "IteratorRange.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// BTree_layout<Node_bytes> selects a BTree whose nodes each take up
+// about Node_bytes bytes, as the Storage argument of a Map. The default
+// is four 64-byte cache lines.
+template <size_t Node_bytes = 256>
+struct BTree_layout {};
+
+// KEY EXTRACTORS
+// A BTree orders its elements by a key extracted from each element:
+// Select_self uses the whole element (a set), and Select_first uses the
+// first member of a pair (a map).
+struct Select_self {
+  template <typename T>
+  const T &operator()(const T &element) const {
+    return element;
+  }
+};
+
+struct Select_first {
+  template <typename Pair>
+  const typename Pair::first_type &operator()(const Pair &element) const {
+    return element.first;
+  }
+};
+
+template <typename Key,
+          typename T = Key,
+          typename Key_of = Select_self,
+          typename Compare = std::less<Key>,
+          typename Allocator = std::allocator<T>,
+          size_t Node_bytes = 256
+         >
+class BTree {
+  // OVERVIEW: Stores elements of type T in ascending order of their keys,
+  //           Key_of()(element), as determined by Compare. Every element
+  //           is stored in a leaf. Internal nodes store only copies of
+  //           keys, used to choose which child to descend into, and the
+  //           leaves are linked in order so that iteration never goes
+  //           back up the tree.
+  //
+  //           Inserting an element may move other elements of the same
+  //           leaf, so it invalidates iterators and references into the
+  //           tree (unlike BinarySearchTree).
+
+  // INVARIANT: NO DUPLICATES
+  // No two elements have equivalent keys.
+  //
+  // INVARIANT: SORTING
+  // The elements of each node, and the keys of each internal node, are in
+  // strictly ascending order. Every key in the subtree of child i of an
+  // internal node is less than the node's i-th key, and every key in the
+  // subtree of child i + 1 is not less than it.
+  //
+  // INVARIANT: BALANCE
+  // Every leaf is at the same depth. No node is empty, and every internal
+  // node has at least two children. Removing an element leaves every
+  // node it touches, other than the root, at least half full.
+  //
+  // INVARIANT: LEAF LINKS
+  // Each leaf's next and prev pointers point to the leaves immediately
+  // after and before it in order, or are null at the ends.
+
+private:
+  struct Node {
+    explicit Node(bool is_leaf_in)
+      : is_leaf(is_leaf_in), count(0) { }
+
+    bool is_leaf;
+    size_t count; // elements in a leaf, keys in an internal node
+  };
+
+  // Uninitialized room for up to N objects of type U. The node that owns
+  // a Slots constructs and destroys its first count objects.
+  template <typename U, size_t N>
+  struct Slots {
+    alignas(U) unsigned char bytes[N * sizeof(U)];
+
+    U *data() {
+      return std::launder(reinterpret_cast<U *>(bytes));
+    }
+
+    const U *data() const {
+      return std::launder(reinterpret_cast<const U *>(bytes));
+    }
+
+    U &operator[](size_t i) {
+      return data()[i];
+    }
+
+    const U &operator[](size_t i) const {
+      return data()[i];
+    }
+  };
+
+  // EFFECTS: Returns how many objects of size object_bytes fit in the
+  //          room left after a node header of header_bytes, but at least
+  //          four, so that splits always leave two non-empty halves.
+  static constexpr size_t fit(size_t header_bytes, size_t object_bytes) {
+    return Node_bytes < header_bytes + 4 * object_bytes
+      ? 4 : (Node_bytes - header_bytes) / object_bytes;
+  }
+
+public:
+  // Most elements a leaf holds, and most keys an internal node holds
+  static constexpr size_t leaf_capacity =
+    fit(sizeof(Node) + 2 * sizeof(void *), sizeof(T));
+  static constexpr size_t internal_capacity =
+    fit(sizeof(Node) + sizeof(void *), sizeof(Key) + sizeof(void *));
+
+private:
+  struct Leaf : Node {
+    Leaf()
+      : Node(true), prev(nullptr), next(nullptr) { }
+
+    Leaf *prev;
+    Leaf *next;
+    Slots<T, leaf_capacity> elements;
+  };
+
+  struct Internal : Node {
+    Internal()
+      : Node(false) { }
+
+    Slots<Key, internal_capacity> keys;
+    Node *children[internal_capacity + 1];
+  };
+
+  // Allocators for nodes, rebound from the Allocator template argument
+  using Leaf_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<Leaf>;
+  using Leaf_traits = std::allocator_traits<Leaf_allocator>;
+  using Internal_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<Internal>;
+  using Internal_traits = std::allocator_traits<Internal_allocator>;
+
+  // The internal nodes on the way from the root to a leaf, and the index
+  // of the child taken in each. A tree of height 64 would hold more
+  // than 2^63 elements.
+  struct Path {
+    Path()
+      : depth(0) { }
+
+    Internal *nodes[64];
+    size_t slots[64];
+    size_t depth;
+  };
+
+public:
+
+  // Default constructor
+  BTree()
+    : root(nullptr), count(0) { }
+
+  // Constructs an empty tree whose nodes are allocated with alloc_in
+  explicit BTree(const Allocator &alloc_in)
+    : root(nullptr), count(0), alloc(alloc_in) { }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order of key
+  // EFFECTS : Constructs a tree holding the elements of [first, last) in
+  //           linear time. The precondition is checked when assertions
+  //           are enabled.
+  template <typename Iter>
+  BTree(Iter first, Iter last, const Allocator &alloc_in = Allocator())
+    : root(nullptr), count(0), alloc(alloc_in) {
+    assign(first, last);
+  }
+
+  // Copy constructor
+  BTree(const BTree &other)
+    : root(nullptr), count(0),
+      alloc(Leaf_traits::select_on_container_copy_construction(other.alloc)) {
+    root = copy_nodes_impl(other.root, alloc);
+    count = other.count;
+  }
+
+  // Move constructor
+  // Takes over the nodes of other in constant time, leaving other empty.
+  BTree(BTree &&other) noexcept
+    : root(other.root), count(other.count), less(other.less),
+      alloc(other.alloc) {
+    other.root = nullptr;
+    other.count = 0;
+  }
+
+  // Assignment operator
+  BTree &operator=(const BTree &rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    release_nodes();
+    root = copy_nodes_impl(rhs.root, alloc);
+    count = rhs.count;
+    return *this;
+  }
+
+  // Move assignment operator
+  // Takes over the nodes of rhs in constant time when the allocators
+  // allow it, and otherwise copies the elements. Either way, rhs is left
+  // empty.
+  BTree &operator=(BTree &&rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    release_nodes();
+    if (Leaf_traits::propagate_on_container_move_assignment::value) {
+      alloc = rhs.alloc;
+    }
+    if (alloc == rhs.alloc) {
+      root = rhs.root;
+      count = rhs.count;
+      rhs.root = nullptr;
+      rhs.count = 0;
+    } else {
+      root = copy_nodes_impl(rhs.root, alloc);
+      count = rhs.count;
+      rhs.release_nodes();
+    }
+    return *this;
+  }
+
+  // REQUIRES: the allocators of this tree and other compare equal, or
+  //           the allocator propagates on swap
+  // MODIFIES: this BTree, other
+  // EFFECTS : Exchanges the contents of this tree and other in constant
+  //           time.
+  void swap(BTree &other) noexcept {
+    std::swap(root, other.root);
+    std::swap(count, other.count);
+    if (Leaf_traits::propagate_on_container_swap::value) {
+      std::swap(alloc, other.alloc);
+    }
+  }
+
+  // Destructor
+  ~BTree() {
+    release_nodes();
+  }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order of key
+  // MODIFIES: this BTree
+  // EFFECTS : Replaces the contents of this tree with the elements of
+  //           [first, last), in linear time. Every node but the last of
+  //           each level is filled. The precondition is checked when
+  //           assertions are enabled.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    assert(is_strictly_sorted(first, last));
+    release_nodes();
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    if (n > 0) {
+      root = build_impl(first, n, alloc);
+      count = n;
+    }
+  }
+
+  // EFFECTS: Returns a copy of the allocator used for this tree's elements.
+  Allocator get_allocator() const {
+    return Allocator(alloc);
+  }
+
+  // EFFECTS: Returns whether this BTree is empty.
+  bool empty() const {
+    return count == 0;
+  }
+
+  // EFFECTS: Returns the number of elements in this BTree.
+  size_t size() const {
+    return count;
+  }
+
+  // EFFECTS: Returns the number of levels of nodes in this BTree, which
+  //          is 0 if it is empty and 1 if all its elements fit in a leaf.
+  size_t height() const {
+    size_t levels = 0;
+    for (const Node *node = root; node; ++levels) {
+      node = node->is_leaf
+        ? nullptr : static_cast<const Internal *>(node)->children[0];
+    }
+    return levels;
+  }
+
+  // EFFECTS: Returns whether every invariant of the tree holds.
+  bool check_invariants() const {
+    if (root == nullptr) {
+      return count == 0;
+    }
+    size_t leaf_depth = 0;
+    size_t elements = 0;
+    const Leaf *prev = nullptr;
+    return check_invariants_impl(root, nullptr, nullptr, 1, leaf_depth,
+                                 elements, prev)
+      && prev->next == nullptr && elements == count;
+  }
+
+  class Iterator {
+    // OVERVIEW: Iterates over the elements of a BTree in ascending order.
+    //           An Iterator is a leaf and a position in it; increment
+    //           and decrement move along the leaf and then to the next or
+    //           previous linked leaf.
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T *;
+    using reference = T &;
+
+    Iterator()
+      : leaf(nullptr), index(0), tree(nullptr) { }
+
+    // EFFECTS:  Returns the current element by reference.
+    // WARNING:  Modifying the element must not change its key.
+    T &operator*() const {
+      return leaf->elements[index];
+    }
+
+    // EFFECTS:  Returns the current element by pointer.
+    // WARNING:  Modifying the element must not change its key.
+    T *operator->() const {
+      return &leaf->elements[index];
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      if (++index == leaf->count) {
+        leaf = leaf->next;
+        index = 0;
+      }
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    // REQUIRES: this Iterator is not at the smallest element
+    // Prefix --
+    Iterator &operator--() {
+      if (leaf == nullptr) {
+        // Stepping back from the end reaches the largest element
+        leaf = rightmost_leaf_impl(tree->root);
+        index = leaf->count;
+      } else if (index == 0) {
+        leaf = leaf->prev;
+        index = leaf->count;
+      }
+      --index;
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Iterator operator--(int) {
+      Iterator result(*this);
+      --(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return leaf == rhs.leaf && index == rhs.index;
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return !(*this == rhs);
+    }
+
+  private:
+    friend class BTree;
+
+    Leaf *leaf;
+    size_t index;
+
+    // The tree iterated over, used only to step back from the end
+    const BTree *tree;
+
+    Iterator(Leaf *leaf_in, size_t index_in, const BTree *tree_in)
+      : leaf(leaf_in), index(index_in), tree(tree_in) { }
+  }; // BTree::Iterator
+
+  // Iterates over the elements in descending order
+  using Reverse_iterator = std::reverse_iterator<Iterator>;
+
+  // EFFECTS: Returns an iterator to the first element.
+  Iterator begin() const {
+    if (root == nullptr) {
+      return end();
+    }
+    return Iterator(leftmost_leaf_impl(root), 0, this);
+  }
+
+  // EFFECTS: Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator(nullptr, 0, this);
+  }
+
+  // EFFECTS: Returns a reverse iterator to the largest element.
+  Reverse_iterator rbegin() const {
+    return Reverse_iterator(end());
+  }
+
+  // EFFECTS: Returns a reverse iterator past the smallest element.
+  Reverse_iterator rend() const {
+    return Reverse_iterator(begin());
+  }
+
+  // EFFECTS: Searches this tree for an element whose key is equivalent to
+  //          key. Returns an iterator to it if found, and an end iterator
+  //          otherwise.
+  Iterator find(const Key &key) const {
+    return find_impl(key);
+  }
+
+  // EFFECTS: Same as find(const Key &), but compares key directly against
+  //          the stored keys without converting it to Key. Only available
+  //          when Compare declares an is_transparent member type.
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K &key) const {
+    return find_impl(key);
+  }
+
+  // EFFECTS: Same as find(key). The hint is accepted for compatibility
+  //          with BinarySearchTree::find(hint, query) and not used, since
+  //          a search from the root already takes only a few node visits.
+  Iterator find(Iterator, const Key &key) const {
+    return find_impl(key);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element whose key is not
+  //          less than key, or an end Iterator if there is none.
+  Iterator lower_bound(const Key &key) const {
+    return bound_impl(key, false);
+  }
+
+  // Same as above, for any type a transparent Compare accepts (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K &key) const {
+    return bound_impl(key, false);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element whose key is
+  //          greater than key, or an end Iterator if there is none.
+  Iterator upper_bound(const Key &key) const {
+    return bound_impl(key, true);
+  }
+
+  // Same as above, for any type a transparent Compare accepts (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K &key) const {
+    return bound_impl(key, true);
+  }
+
+  // EFFECTS: Returns the pair (lower_bound(key), upper_bound(key)).
+  std::pair<Iterator, Iterator> equal_range(const Key &key) const {
+    return equal_range_impl(key);
+  }
+
+  // Same as above, for any type a transparent Compare accepts (see find).
+  template <typename K, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const K &key) const {
+    return equal_range_impl(key);
+  }
+
+  // REQUIRES: low is not greater than high
+  // EFFECTS:  Returns a view of the elements whose keys are not less than
+  //           low and less than high, in ascending order.
+  Iterator_range<Iterator> range(const Key &low, const Key &high) const {
+    return Iterator_range<Iterator>(lower_bound(low), lower_bound(high));
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : If an element with a key equivalent to that of element is
+  //           already contained in this tree, returns an Iterator to it
+  //           along with false. Otherwise, inserts element and returns an
+  //           Iterator to it along with true.
+  std::pair<Iterator, bool> insert_unique(const T &element) {
+    return try_emplace(key_of(element), element);
+  }
+
+  // Same as above, but moves element into the tree if it is inserted.
+  std::pair<Iterator, bool> insert_unique(T &&element) {
+    return try_emplace(key_of(element), std::move(element));
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Constructs an element from args and inserts it if no element
+  //           with an equivalent key is already contained in this tree.
+  //           Returns the same as insert_unique().
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args&&... args) {
+    T element(std::forward<Args>(args)...);
+    return try_emplace(key_of(element), std::move(element));
+  }
+
+  // REQUIRES: An element constructed from args has a key equivalent to
+  //           key.
+  // MODIFIES: this BTree
+  // EFFECTS : If an element whose key is equivalent to key is already
+  //           contained in this tree, returns an Iterator to it along
+  //           with false, without constructing anything. Otherwise,
+  //           inserts an element constructed from args, and returns an
+  //           Iterator to it along with true.
+  // NOTE:    Performs a single descent from the root.
+  template <typename K, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const K &key, Args&&... args) {
+    if (root == nullptr) {
+      T element(std::forward<Args>(args)...);
+      Leaf *leaf = new_leaf_impl(alloc);
+      new (leaf->elements.data()) T(std::move(element));
+      leaf->count = 1;
+      root = leaf;
+      count = 1;
+      return std::pair<Iterator, bool>(Iterator(leaf, 0, this), true);
+    }
+    Path path;
+    Leaf *leaf = descend(key, path);
+    size_t i = leaf_lower_bound(leaf, key);
+    if (i < leaf->count && !less(key, key_of(leaf->elements[i]))) {
+      return std::pair<Iterator, bool>(Iterator(leaf, i, this), false);
+    }
+    T element(std::forward<Args>(args)...);
+    Iterator inserted = insert_into_leaf(path, leaf, i, std::move(element));
+    ++count;
+    return std::pair<Iterator, bool>(inserted, true);
+  }
+
+  // EFFECTS : Same as try_emplace(key, args...); the hint is not used
+  //           (see find(hint, key)).
+  template <typename K, typename... Args>
+  std::pair<Iterator, bool> try_emplace_hint(Iterator, const K &key,
+                                             Args&&... args) {
+    return try_emplace(key, std::forward<Args>(args)...);
+  }
+
+  // REQUIRES: pos is a dereferenceable Iterator into this tree
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the element at pos and returns an Iterator to the
+  //           element that followed it (or an end Iterator). A node left
+  //           less than half full takes an element from a sibling or is
+  //           merged into one, and emptied nodes are freed at once.
+  //           Invalidates other Iterators into the tree.
+  Iterator erase(Iterator pos) {
+    Path path;
+    Leaf *leaf = descend(key_of(*pos), path);
+    assert(leaf == pos.leaf);
+    erase_slot_impl(leaf->elements.data(), leaf->count, pos.index);
+    --leaf->count;
+    --count;
+    Iterator next = pos.index < leaf->count
+      ? Iterator(leaf, pos.index, this) : Iterator(leaf->next, 0, this);
+    rebalance_leaf(path, leaf, next);
+    return next;
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Removes the element whose key is equivalent to key, if
+  //           there is one. Returns the number of elements removed (0 or
+  //           1).
+  size_t erase(const Key &key) {
+    Iterator pos = find(key);
+    if (pos == end()) {
+      return 0;
+    }
+    erase(pos);
+    return 1;
+  }
+
+  // REQUIRES: combine(T &existing, T &&incoming) leaves in existing an
+  //           element with the same key
+  // MODIFIES: this BTree, other
+  // EFFECTS : Adds every element of other to this tree, leaving other
+  //           empty. When both trees hold elements with equivalent keys,
+  //           combine folds the one from other into the one in this tree.
+  //           The two sorted sequences are merged and the result is
+  //           rebuilt with full nodes, in O(n + m) total. Elements are
+  //           moved, never copied.
+  template <typename Combine>
+  void merge(BTree &&other, Combine combine) {
+    if (this == &other) {
+      return;
+    }
+    merge_impl(other,
+      [](T &element) -> T && { return std::move(element); },
+      [&](T &existing, T &incoming) {
+        combine(existing, std::move(incoming));
+      });
+    other.release_nodes();
+  }
+
+  // REQUIRES: combine(T &existing, const T &incoming) leaves in existing
+  //           an element with the same key
+  // MODIFIES: this BTree
+  // EFFECTS : Same as above, but copies the elements of other, which is
+  //           left unchanged.
+  template <typename Combine>
+  void merge(const BTree &other, Combine combine) {
+    if (this == &other) {
+      BTree copy(other);
+      merge(std::move(copy), combine);
+      return;
+    }
+    merge_impl(other,
+      [](const T &element) -> const T & { return element; },
+      [&](T &existing, const T &incoming) {
+        combine(existing, incoming);
+      });
+  }
+
+private:
+
+  // Fewest elements a leaf, and fewest keys an internal node, other than
+  // the root, is left with by a removal
+  static constexpr size_t leaf_minimum = leaf_capacity / 2;
+  static constexpr size_t internal_minimum = internal_capacity / 2;
+
+  // DATA REPRESENTATION
+  // The root node, a leaf or an internal node, or null if empty.
+  Node *root;
+
+  // The number of elements.
+  size_t count;
+
+  // Compares keys.
+  Compare less;
+
+  // Extracts the key of an element.
+  Key_of key_of;
+
+  // Allocates and frees this tree's nodes.
+  Leaf_allocator alloc;
+
+  // MODIFIES: this BTree
+  // EFFECTS : Destroys every element and frees every node, leaving the
+  //           tree empty.
+  void release_nodes() {
+    destroy_nodes_impl(root, alloc);
+    root = nullptr;
+    count = 0;
+  }
+
+  // EFFECTS: Returns whether the keys of [first, last) are in strictly
+  //          ascending order.
+  template <typename Iter>
+  bool is_strictly_sorted(Iter first, Iter last) const {
+    auto out_of_order = [this](const T &lhs, const T &rhs) {
+      return !less(key_of(lhs), key_of(rhs));
+    };
+    return std::adjacent_find(first, last, out_of_order) == last;
+  }
+
+  // EFFECTS: Shared implementation of both find overloads.
+  template <typename K>
+  Iterator find_impl(const K &key) const {
+    if (root == nullptr) {
+      return end();
+    }
+    Path path;
+    Leaf *leaf = descend(key, path);
+    size_t i = leaf_lower_bound(leaf, key);
+    if (i == leaf->count || less(key, key_of(leaf->elements[i]))) {
+      return end();
+    }
+    return Iterator(leaf, i, this);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element whose key is
+  //          greater than key if upper is true, or not less than key
+  //          otherwise, or an end Iterator if there is none.
+  template <typename K>
+  Iterator bound_impl(const K &key, bool upper) const {
+    if (root == nullptr) {
+      return end();
+    }
+    Path path;
+    Leaf *leaf = descend(key, path);
+    size_t i = upper ? leaf_upper_bound(leaf, key)
+                     : leaf_lower_bound(leaf, key);
+    // Every later leaf holds only larger keys
+    if (i == leaf->count) {
+      return Iterator(leaf->next, 0, this);
+    }
+    return Iterator(leaf, i, this);
+  }
+
+  // EFFECTS: Returns the pair (lower_bound(key), upper_bound(key)),
+  //          which holds at most the one element with an equivalent key.
+  template <typename K>
+  std::pair<Iterator, Iterator> equal_range_impl(const K &key) const {
+    Iterator first = bound_impl(key, false);
+    Iterator last = first;
+    if (last != end() && !less(key, key_of(*last))) {
+      ++last;
+    }
+    return std::pair<Iterator, Iterator>(first, last);
+  }
+
+  // MODIFIES: this BTree
+  // EFFECTS : Merges the elements of this tree with those of other, and
+  //           rebuilds this tree from the result. take(element) returns
+  //           an element of other to be moved or copied into this tree,
+  //           and join(existing, incoming) folds an element of other into
+  //           the element of this tree with an equivalent key.
+  template <typename Source, typename Take, typename Join>
+  void merge_impl(Source &other, Take take, Join join) {
+    std::vector<T> merged;
+    merged.reserve(count + other.count);
+    Iterator mine = begin();
+    Iterator theirs = other.begin();
+    while (mine != end() && theirs != other.end()) {
+      if (less(key_of(*mine), key_of(*theirs))) {
+        merged.push_back(std::move(*mine++));
+      } else if (less(key_of(*theirs), key_of(*mine))) {
+        merged.push_back(take(*theirs++));
+      } else {
+        join(*mine, *theirs++);
+        merged.push_back(std::move(*mine++));
+      }
+    }
+    for (; mine != end(); ++mine) {
+      merged.push_back(std::move(*mine));
+    }
+    for (; theirs != other.end(); ++theirs) {
+      merged.push_back(take(*theirs));
+    }
+    release_nodes();
+    if (!merged.empty()) {
+      auto first = std::make_move_iterator(merged.begin());
+      root = build_impl(first, merged.size(), alloc);
+      count = merged.size();
+    }
+  }
+
+  // REQUIRES: this tree is not empty
+  // MODIFIES: path
+  // EFFECTS : Returns the leaf whose range of keys covers key, recording
+  //           in path the internal nodes passed on the way.
+  template <typename K>
+  Leaf *descend(const K &key, Path &path) const {
+    Node *node = root;
+    while (!node->is_leaf) {
+      Internal *internal = static_cast<Internal *>(node);
+      size_t i = child_index(internal, key);
+      path.nodes[path.depth] = internal;
+      path.slots[path.depth] = i;
+      ++path.depth;
+      node = internal->children[i];
+    }
+    return static_cast<Leaf *>(node);
+  }
+
+  // Whether keys of type K can be compared against Key by the SSE2 search
+  // in child_index(): 32-bit signed integers ordered by <.
+  template <typename K>
+  static constexpr bool simd_searchable() {
+    return std::is_same<Key, std::int32_t>::value
+      && std::is_same<K, std::int32_t>::value
+      && (std::is_same<Compare, std::less<Key>>::value
+          || std::is_same<Compare, std::less<>>::value);
+  }
+
+  // Whether keys of type K are plain numbers ordered by <, so that a
+  // branch-free scan of a node beats a binary search.
+  template <typename K>
+  static constexpr bool scan_searchable() {
+    return std::is_arithmetic<Key>::value && std::is_same<K, Key>::value
+      && (std::is_same<Compare, std::less<Key>>::value
+          || std::is_same<Compare, std::less<>>::value);
+  }
+
+  // EFFECTS: Returns the index of the child of node whose subtree covers
+  //          key: the number of keys in node that are not greater than
+  //          key.
+  template <typename K>
+  size_t child_index(const Internal *node, const K &key) const {
+    const Key *keys = node->keys.data();
+    size_t n = node->count;
+    size_t i = 0;
+    size_t result = 0;
+#if defined(__SSE2__)
+    if constexpr (simd_searchable<K>()) {
+      // Compare four keys at a time; every key not greater than key is
+      // counted.
+      __m128i query = _mm_set1_epi32(key);
+      for (; i + 4 <= n; i += 4) {
+        __m128i block =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        int greater =
+          _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, query)));
+        result += 4 - static_cast<size_t>(__builtin_popcount(greater));
+      }
+    }
+#endif
+    if constexpr (simd_searchable<K>() || scan_searchable<K>()) {
+      for (; i < n; ++i) {
+        result += static_cast<size_t>(!(key < keys[i]));
+      }
+      return result;
+    } else {
+      // Binary search for the first key greater than key
+      size_t low = 0;
+      size_t high = n;
+      while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (less(key, keys[mid])) {
+          high = mid;
+        } else {
+          low = mid + 1;
+        }
+      }
+      return low;
+    }
+  }
+
+  // EFFECTS: Returns the index of the first element of leaf whose key is
+  //          not less than key, or leaf->count if there is none.
+  template <typename K>
+  size_t leaf_lower_bound(const Leaf *leaf, const K &key) const {
+    size_t low = 0;
+    size_t high = leaf->count;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (less(key_of(leaf->elements[mid]), key)) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+
+  // EFFECTS: Returns the index of the first element of leaf whose key is
+  //          greater than key, or leaf->count if there is none.
+  template <typename K>
+  size_t leaf_upper_bound(const Leaf *leaf, const K &key) const {
+    size_t low = 0;
+    size_t high = leaf->count;
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (less(key, key_of(leaf->elements[mid]))) {
+        high = mid;
+      } else {
+        low = mid + 1;
+      }
+    }
+    return low;
+  }
+
+  // REQUIRES: path leads from the root to leaf; element belongs at
+  //           position i of leaf
+  // MODIFIES: this BTree
+  // EFFECTS : Inserts element at position i of leaf, splitting the leaf
+  //           (and then its ancestors) if it is full, and returns an
+  //           Iterator to the element.
+  Iterator insert_into_leaf(Path &path, Leaf *leaf, size_t i, T &&element) {
+    if (leaf->count < leaf_capacity) {
+      insert_slot_impl(leaf->elements.data(), leaf->count, i,
+                       std::move(element));
+      ++leaf->count;
+      return Iterator(leaf, i, this);
+    }
+    Leaf *right = new_leaf_impl(alloc);
+    // Appending past the end of a leaf (as in sorted insertion) moves
+    // nothing and leaves the full leaf full. Otherwise, split in half.
+    bool append = i == leaf->count;
+    size_t split = append ? leaf->count : leaf->count / 2;
+    move_slots_impl(leaf->elements.data() + split, leaf->count - split,
+                    right->elements.data());
+    right->count = leaf->count - split;
+    leaf->count = split;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) {
+      leaf->next->prev = right;
+    }
+    leaf->next = right;
+
+    Iterator result;
+    if (!append && i <= split) {
+      insert_slot_impl(leaf->elements.data(), leaf->count, i,
+                       std::move(element));
+      ++leaf->count;
+      result = Iterator(leaf, i, this);
+    } else {
+      insert_slot_impl(right->elements.data(), right->count, i - split,
+                       std::move(element));
+      ++right->count;
+      result = Iterator(right, i - split, this);
+    }
+    insert_into_parent(path, Key(key_of(right->elements[0])), right);
+    return result;
+  }
+
+  // REQUIRES: path leads from the root to the parent of a node that has
+  //           just been split; right is the new node holding its upper
+  //           half, and separator is the smallest key under right
+  // MODIFIES: this BTree
+  // EFFECTS : Adds separator and right to the parent, splitting it (and
+  //           then its ancestors) if it is full, or adds a new root.
+  void insert_into_parent(Path &path, Key &&separator, Node *right) {
+    while (path.depth > 0) {
+      --path.depth;
+      Internal *parent = path.nodes[path.depth];
+      size_t i = path.slots[path.depth];
+      if (parent->count < internal_capacity) {
+        insert_slot_impl(parent->keys.data(), parent->count, i,
+                         std::move(separator));
+        insert_child_impl(parent, i + 1, right);
+        ++parent->count;
+        return;
+      }
+      right = split_internal(parent, i, separator, right);
+    }
+    Internal *new_root = new_internal_impl(alloc);
+    new (new_root->keys.data()) Key(std::move(separator));
+    new_root->count = 1;
+    new_root->children[0] = root;
+    new_root->children[1] = right;
+    root = new_root;
+  }
+
+  // REQUIRES: node is full; separator and right belong after child i
+  // MODIFIES: node, separator
+  // EFFECTS : Splits node, with separator and right added, into node and
+  //           a new right sibling, which is returned. The middle key moves
+  //           out into separator, to be added to the parent.
+  Internal *split_internal(Internal *node, size_t i, Key &separator,
+                           Node *right) {
+    Internal *sibling = new_internal_impl(alloc);
+    std::vector<Key> keys;
+    keys.reserve(node->count + 1);
+    for (size_t k = 0; k < node->count; ++k) {
+      keys.push_back(std::move(node->keys[k]));
+      node->keys[k].~Key();
+    }
+    keys.insert(keys.begin() + i, std::move(separator));
+    std::vector<Node *> children(node->children,
+                                 node->children + node->count + 1);
+    children.insert(children.begin() + i + 1, right);
+
+    size_t mid = keys.size() / 2;
+    node->count = 0;
+    for (size_t k = 0; k < mid; ++k) {
+      new (node->keys.data() + k) Key(std::move(keys[k]));
+      node->children[k] = children[k];
+      ++node->count;
+    }
+    node->children[mid] = children[mid];
+    separator = std::move(keys[mid]);
+    for (size_t k = mid + 1; k < keys.size(); ++k) {
+      new (sibling->keys.data() + sibling->count) Key(std::move(keys[k]));
+      sibling->children[sibling->count] = children[k];
+      ++sibling->count;
+    }
+    sibling->children[sibling->count] = children.back();
+    return sibling;
+  }
+
+  // REQUIRES: path leads from the root to leaf, which has just lost an
+  //           element; next is an Iterator into leaf or its successor
+  // MODIFIES: this BTree, next
+  // EFFECTS : Refills or merges leaf if it is less than half full (and
+  //           then its ancestors), frees it if the tree is now empty, and
+  //           updates next to point to the same element as before.
+  void rebalance_leaf(Path &path, Leaf *leaf, Iterator &next) {
+    if (path.depth == 0) {
+      if (leaf->count == 0) {
+        delete_node_impl(alloc, leaf);
+        root = nullptr;
+      }
+      return;
+    }
+    if (leaf->count >= leaf_minimum) {
+      return;
+    }
+    Internal *parent = path.nodes[path.depth - 1];
+    size_t i = path.slots[path.depth - 1];
+    Leaf *left = i > 0 ? static_cast<Leaf *>(parent->children[i - 1]) : nullptr;
+    Leaf *right = i < parent->count
+      ? static_cast<Leaf *>(parent->children[i + 1]) : nullptr;
+
+    if (left && left->count > leaf_minimum) {
+      // Take the largest element of the left sibling
+      insert_slot_impl(leaf->elements.data(), leaf->count, 0,
+                       std::move(left->elements[left->count - 1]));
+      left->elements[left->count - 1].~T();
+      --left->count;
+      ++leaf->count;
+      parent->keys[i - 1] = key_of(leaf->elements[0]);
+      if (next.leaf == leaf) {
+        ++next.index;
+      }
+      return;
+    }
+    if (right && right->count > leaf_minimum) {
+      // Take the smallest element of the right sibling
+      new (leaf->elements.data() + leaf->count)
+        T(std::move(right->elements[0]));
+      erase_slot_impl(right->elements.data(), right->count, 0);
+      --right->count;
+      ++leaf->count;
+      parent->keys[i] = key_of(right->elements[0]);
+      if (next.leaf == right) {
+        next = next.index == 0 ? Iterator(leaf, leaf->count - 1, this)
+                               : Iterator(right, next.index - 1, this);
+      }
+      return;
+    }
+    // Neither sibling can spare an element: merge with one of them
+    if (left) {
+      merge_leaves(left, leaf, next);
+      remove_child_impl(parent, i - 1);
+    } else {
+      merge_leaves(leaf, right, next);
+      remove_child_impl(parent, i);
+    }
+    --path.depth;
+    rebalance_internal(path, parent);
+  }
+
+  // REQUIRES: right follows left; together their elements fit in a leaf
+  // MODIFIES: this BTree, next
+  // EFFECTS : Moves the elements of right to the end of left, unlinks and
+  //           frees right, and updates next if it pointed into right.
+  void merge_leaves(Leaf *left, Leaf *right, Iterator &next) {
+    if (next.leaf == right) {
+      next = Iterator(left, left->count + next.index, this);
+    }
+    move_slots_impl(right->elements.data(), right->count,
+                    left->elements.data() + left->count);
+    left->count += right->count;
+    right->count = 0;
+    left->next = right->next;
+    if (right->next) {
+      right->next->prev = left;
+    }
+    delete_node_impl(alloc, right);
+  }
+
+  // REQUIRES: path leads from the root to node, which has just lost a key
+  // MODIFIES: this BTree
+  // EFFECTS : Refills or merges node if it is less than half full, and
+  //           then its ancestors in turn. Replaces a root left with a
+  //           single child by that child.
+  void rebalance_internal(Path &path, Internal *node) {
+    while (path.depth > 0 && node->count < internal_minimum) {
+      Internal *parent = path.nodes[path.depth - 1];
+      size_t i = path.slots[path.depth - 1];
+      Internal *left = i > 0
+        ? static_cast<Internal *>(parent->children[i - 1]) : nullptr;
+      Internal *right = i < parent->count
+        ? static_cast<Internal *>(parent->children[i + 1]) : nullptr;
+
+      if (left && left->count > internal_minimum) {
+        // Rotate a child from the left sibling through the parent
+        insert_slot_impl(node->keys.data(), node->count, 0,
+                         std::move(parent->keys[i - 1]));
+        insert_child_impl(node, 0, left->children[left->count]);
+        ++node->count;
+        parent->keys[i - 1] = std::move(left->keys[left->count - 1]);
+        left->keys[left->count - 1].~Key();
+        --left->count;
+        return;
+      }
+      if (right && right->count > internal_minimum) {
+        // Rotate a child from the right sibling through the parent
+        new (node->keys.data() + node->count)
+          Key(std::move(parent->keys[i]));
+        node->children[node->count + 1] = right->children[0];
+        ++node->count;
+        parent->keys[i] = std::move(right->keys[0]);
+        erase_slot_impl(right->keys.data(), right->count, 0);
+        remove_first_child_impl(right);
+        --right->count;
+        return;
+      }
+      if (left) {
+        merge_internals(left, std::move(parent->keys[i - 1]), node);
+        remove_child_impl(parent, i - 1);
+      } else {
+        merge_internals(node, std::move(parent->keys[i]), right);
+        remove_child_impl(parent, i);
+      }
+      node = parent;
+      --path.depth;
+    }
+    if (path.depth == 0 && node->count == 0) {
+      root = node->children[0];
+      delete_node_impl(alloc, node);
+    }
+  }
+
+  // REQUIRES: right follows left, and separator lies between them;
+  //           together their keys and separator fit in a node
+  // MODIFIES: this BTree
+  // EFFECTS : Moves separator and the keys and children of right to the
+  //           end of left, and frees right.
+  void merge_internals(Internal *left, Key &&separator, Internal *right) {
+    new (left->keys.data() + left->count) Key(std::move(separator));
+    ++left->count;
+    move_slots_impl(right->keys.data(), right->count,
+                    left->keys.data() + left->count);
+    for (size_t k = 0; k <= right->count; ++k) {
+      left->children[left->count + k] = right->children[k];
+    }
+    left->count += right->count;
+    right->count = 0;
+    delete_node_impl(alloc, right);
+  }
+
+  // REQUIRES: child i + 1 of node has been merged into child i
+  // MODIFIES: node
+  // EFFECTS : Removes key i and child i + 1 from node.
+  static void remove_child_impl(Internal *node, size_t i) {
+    erase_slot_impl(node->keys.data(), node->count, i);
+    for (size_t k = i + 1; k < node->count; ++k) {
+      node->children[k] = node->children[k + 1];
+    }
+    --node->count;
+  }
+
+  // MODIFIES: node
+  // EFFECTS : Removes child 0 from node, moving the others down one place.
+  //           The keys are not changed.
+  static void remove_first_child_impl(Internal *node) {
+    for (size_t k = 0; k < node->count; ++k) {
+      node->children[k] = node->children[k + 1];
+    }
+  }
+
+  // REQUIRES: node has room for another child
+  // MODIFIES: node
+  // EFFECTS : Inserts child at index i of node's children.
+  static void insert_child_impl(Internal *node, size_t i, Node *child) {
+    for (size_t k = node->count + 1; k > i; --k) {
+      node->children[k] = node->children[k - 1];
+    }
+    node->children[i] = child;
+  }
+
+  // REQUIRES: data holds n constructed objects and has room for one more
+  // MODIFIES: data
+  // EFFECTS : Moves the objects at i and after up one place, and moves
+  //           value into the gap at i.
+  template <typename U>
+  static void insert_slot_impl(U *data, size_t n, size_t i, U &&value) {
+    for (size_t k = n; k > i; --k) {
+      new (data + k) U(std::move(data[k - 1]));
+      data[k - 1].~U();
+    }
+    new (data + i) U(std::move(value));
+  }
+
+  // REQUIRES: data holds n > i constructed objects
+  // MODIFIES: data
+  // EFFECTS : Destroys the object at i and moves the objects after it
+  //           down one place.
+  template <typename U>
+  static void erase_slot_impl(U *data, size_t n, size_t i) {
+    data[i].~U();
+    for (size_t k = i + 1; k < n; ++k) {
+      new (data + k - 1) U(std::move(data[k]));
+      data[k].~U();
+    }
+  }
+
+  // REQUIRES: from holds n constructed objects; to holds none
+  // MODIFIES: from, to
+  // EFFECTS : Moves the n objects of from into to, leaving from with none.
+  template <typename U>
+  static void move_slots_impl(U *from, size_t n, U *to) {
+    for (size_t k = 0; k < n; ++k) {
+      new (to + k) U(std::move(from[k]));
+      from[k].~U();
+    }
+  }
+
+  // EFFECTS: Returns the leftmost leaf of the subtree rooted at node.
+  static Leaf *leftmost_leaf_impl(Node *node) {
+    while (!node->is_leaf) {
+      node = static_cast<Internal *>(node)->children[0];
+    }
+    return static_cast<Leaf *>(node);
+  }
+
+  // EFFECTS: Returns the rightmost leaf of the subtree rooted at node.
+  static Leaf *rightmost_leaf_impl(Node *node) {
+    while (!node->is_leaf) {
+      Internal *internal = static_cast<Internal *>(node);
+      node = internal->children[internal->count];
+    }
+    return static_cast<Leaf *>(node);
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Allocates an empty leaf.
+  static Leaf *new_leaf_impl(Leaf_allocator &alloc) {
+    Leaf *leaf = Leaf_traits::allocate(alloc, 1);
+    Leaf_traits::construct(alloc, leaf);
+    return leaf;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Allocates an empty internal node.
+  static Internal *new_internal_impl(Leaf_allocator &alloc) {
+    Internal_allocator internal_alloc(alloc);
+    Internal *node = Internal_traits::allocate(internal_alloc, 1);
+    Internal_traits::construct(internal_alloc, node);
+    return node;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Destroys the elements or keys of node and frees it, but not
+  //           its children.
+  static void delete_node_impl(Leaf_allocator &alloc, Node *node) {
+    if (node->is_leaf) {
+      Leaf *leaf = static_cast<Leaf *>(node);
+      for (size_t k = 0; k < leaf->count; ++k) {
+        leaf->elements[k].~T();
+      }
+      Leaf_traits::destroy(alloc, leaf);
+      Leaf_traits::deallocate(alloc, leaf, 1);
+    } else {
+      Internal *internal = static_cast<Internal *>(node);
+      for (size_t k = 0; k < internal->count; ++k) {
+        internal->keys[k].~Key();
+      }
+      Internal_allocator internal_alloc(alloc);
+      Internal_traits::destroy(internal_alloc, internal);
+      Internal_traits::deallocate(internal_alloc, internal, 1);
+    }
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Destroys and frees every node of the subtree rooted at node.
+  // NOTE:    This function is tree recursive.
+  static void destroy_nodes_impl(Node *node, Leaf_allocator &alloc) {
+    if (node == nullptr) {
+      return;
+    }
+    if (!node->is_leaf) {
+      Internal *internal = static_cast<Internal *>(node);
+      for (size_t k = 0; k <= internal->count; ++k) {
+        destroy_nodes_impl(internal->children[k], alloc);
+      }
+    }
+    delete_node_impl(alloc, node);
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Returns the root of a deep copy of the subtree rooted at
+  //           node, with its leaves linked in order.
+  static Node *copy_nodes_impl(const Node *node, Leaf_allocator &alloc) {
+    Leaf *last = nullptr;
+    return copy_nodes_impl(node, alloc, last);
+  }
+
+  // MODIFIES: alloc, last
+  // EFFECTS : Copies the subtree rooted at node, linking each copied leaf
+  //           after last and then making it the new last. If copying an
+  //           element or key throws, the nodes of this subtree already
+  //           copied are freed (the leaves before it stay linked to last).
+  // NOTE:    This function is tree recursive.
+  static Node *copy_nodes_impl(const Node *node, Leaf_allocator &alloc,
+                               Leaf *&last) {
+    if (node == nullptr) {
+      return nullptr;
+    }
+    if (node->is_leaf) {
+      const Leaf *leaf = static_cast<const Leaf *>(node);
+      Leaf *copy = new_leaf_impl(alloc);
+      try {
+        for (size_t k = 0; k < leaf->count; ++k, ++copy->count) {
+          new (copy->elements.data() + k) T(leaf->elements[k]);
+        }
+      } catch (...) {
+        delete_node_impl(alloc, copy);
+        throw;
+      }
+      copy->prev = last;
+      if (last) {
+        last->next = copy;
+      }
+      last = copy;
+      return copy;
+    }
+    const Internal *internal = static_cast<const Internal *>(node);
+    Internal *copy = new_internal_impl(alloc);
+    size_t copied = 0; // children copied so far
+    try {
+      for (size_t k = 0; k < internal->count; ++k, ++copy->count) {
+        new (copy->keys.data() + k) Key(internal->keys[k]);
+      }
+      for (; copied <= internal->count; ++copied) {
+        copy->children[copied] =
+          copy_nodes_impl(internal->children[copied], alloc, last);
+      }
+    } catch (...) {
+      for (size_t k = 0; k < copied; ++k) {
+        destroy_nodes_impl(copy->children[k], alloc);
+      }
+      delete_node_impl(alloc, copy);
+      throw;
+    }
+    return copy;
+  }
+
+  // REQUIRES: n > 0 elements remain from first, in ascending order
+  // MODIFIES: first, alloc
+  // EFFECTS : Builds a tree from the next n elements of first, level by
+  //           level from the leaves up, and returns its root. If copying
+  //           an element throws, the nodes already built are freed.
+  template <typename Iter>
+  Node *build_impl(Iter &first, size_t n, Leaf_allocator &alloc) {
+    // The nodes of the level being built, and the smallest key under each
+    std::vector<Node *> level;
+    std::vector<Key> lowest;
+    // The nodes of the level above it, and how many of level they own
+    std::vector<Node *> parents;
+    size_t next = 0;
+    try {
+      size_t leaves = (n + leaf_capacity - 1) / leaf_capacity;
+      level.reserve(leaves);
+      Leaf *last = nullptr;
+      for (size_t j = 0; j < leaves; ++j) {
+        // Spread the elements evenly, so that no leaf is nearly empty
+        size_t take = n / leaves + (j < n % leaves);
+        Leaf *leaf = new_leaf_impl(alloc);
+        level.push_back(leaf);
+        for (; leaf->count < take; ++leaf->count, ++first) {
+          new (leaf->elements.data() + leaf->count) T(*first);
+        }
+        leaf->prev = last;
+        if (last) {
+          last->next = leaf;
+        }
+        last = leaf;
+        lowest.push_back(Key(key_of(leaf->elements[0])));
+      }
+      while (level.size() > 1) {
+        std::vector<Key> parent_lowest;
+        size_t fanout = internal_capacity + 1;
+        size_t groups = (level.size() + fanout - 1) / fanout;
+        parents.reserve(groups);
+        parent_lowest.reserve(groups);
+        for (size_t j = 0; j < groups; ++j) {
+          size_t take = level.size() / groups + (j < level.size() % groups);
+          Internal *parent = new_internal_impl(alloc);
+          parents.push_back(parent);
+          parent->children[0] = level[next++];
+          parent_lowest.push_back(std::move(lowest[next - 1]));
+          for (size_t k = 1; k < take; ++k, ++next, ++parent->count) {
+            new (parent->keys.data() + k - 1) Key(std::move(lowest[next]));
+            parent->children[k] = level[next];
+          }
+        }
+        level.swap(parents);
+        parents.clear();
+        next = 0;
+        lowest.swap(parent_lowest);
+      }
+    } catch (...) {
+      // Every node is owned by one of parents or by level from next on
+      for (Node *parent : parents) {
+        destroy_nodes_impl(parent, alloc);
+      }
+      for (size_t k = next; k < level.size(); ++k) {
+        destroy_nodes_impl(level[k], alloc);
+      }
+      throw;
+    }
+    return level[0];
+  }
+
+  // MODIFIES: leaf_depth, elements, prev
+  // EFFECTS : Returns whether the subtree rooted at node, at the given
+  //           depth, satisfies the invariants, with every key not less
+  //           than *low (if not null) and less than *high (if not null).
+  //           Records in leaf_depth the depth of the first leaf, counts
+  //           the elements seen, and tracks the previous leaf in prev.
+  // NOTE:    This function is tree recursive.
+  bool check_invariants_impl(const Node *node, const Key *low,
+                             const Key *high, size_t depth,
+                             size_t &leaf_depth, size_t &elements,
+                             const Leaf *&prev) const {
+    if (node->count == 0) {
+      return false;
+    }
+    if (node->is_leaf) {
+      const Leaf *leaf = static_cast<const Leaf *>(node);
+      if (leaf_depth == 0) {
+        leaf_depth = depth;
+      }
+      if (depth != leaf_depth || leaf->prev != prev
+          || (prev && prev->next != leaf)) {
+        return false;
+      }
+      prev = leaf;
+      elements += leaf->count;
+      return keys_in_order_impl(leaf->elements.data(), leaf->count, low,
+                                high, [this](const T &e) -> const Key & {
+                                  return key_of(e);
+                                });
+    }
+    const Internal *internal = static_cast<const Internal *>(node);
+    const Key *keys = internal->keys.data();
+    if (!keys_in_order_impl(keys, internal->count, low, high,
+                            [](const Key &k) -> const Key & { return k; })) {
+      return false;
+    }
+    for (size_t k = 0; k <= internal->count; ++k) {
+      const Key *child_low = k == 0 ? low : &keys[k - 1];
+      const Key *child_high = k == internal->count ? high : &keys[k];
+      if (!check_invariants_impl(internal->children[k], child_low,
+                                 child_high, depth + 1, leaf_depth,
+                                 elements, prev)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // EFFECTS: Returns whether the keys get(data[0]) .. get(data[n - 1])
+  //          are strictly ascending and within [*low, *high).
+  template <typename U, typename Get>
+  bool keys_in_order_impl(const U *data, size_t n, const Key *low,
+                          const Key *high, Get get) const {
+    for (size_t k = 0; k < n; ++k) {
+      if ((k > 0 && !less(get(data[k - 1]), get(data[k])))
+          || (low && less(get(data[k]), *low))
+          || (high && !less(get(data[k]), *high))) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif // BTREE_HPP
@@ -10,20 +10,105 @@
  * Updated
  *   2017-05-01
  *
- * DO NOT CHANGE any of the implementations in this file that are
- * provided with the starter code. Only fill in implementations
- * for the private static member functions as directed.
+ * The public member functions are thin wrappers around private static
+ * *_impl functions, which work on the nodes and are gathered at the end
+ * of the class.
  */
 
 #include <cassert>  //assert
 #include <iostream> //ostream
 #include <functional> //less
-
-// You may add aditional libraries here if needed. You may use any
-// part of the STL except for containers.
+#include <algorithm> //max, adjacent_find
+#include <iterator> //distance, bidirectional_iterator_tag, reverse_iterator
+#include <cstddef>  //ptrdiff_t
+#include <utility>  //pair
+#include <memory>   //allocator, allocator_traits
+#include <type_traits> //true_type, void_t
+#include <vector>
+#include "FrozenTree.hpp"
+#include "Instrument.hpp"
+#include "IteratorRange.hpp"
+#include "ThreadPool.hpp"
+
+// BALANCING POLICIES
+// These tag types select how BinarySearchTree restructures itself on
+// insertion. They carry no data; they are only used to pick an
+// implementation at compile time.
+//
+// Unbalanced_tree: plain leaf insertion. The shape of the tree depends
+//   entirely on the order of insertion, so sorted input produces a tree
+//   of height n.
+struct Unbalanced_tree {};
+
+// AVL_tree: after every insertion or removal, the heights of the two
+//   subtrees of any node differ by at most one. This bounds the height
+//   of the tree by about 1.44 log2(n + 2), regardless of insertion order.
+struct AVL_tree {};
+
+// Splay_tree: every successful find or insertion moves the element it
+//   reaches to the root by splaying (a series of rotations along the
+//   path), and an unsuccessful find splays the last node it visited.
+//   Frequently used elements therefore stay near the root, and any
+//   sequence of m operations takes O(m log n) time in total, though a
+//   single one may take time proportional to n. Suits skewed lookups,
+//   such as the words of a text. Since find() restructures the tree, a
+//   Splay_tree must not be searched by several threads at once, even
+//   through const member functions.
+struct Splay_tree {};
+
+// ALLOCATORS
+// BinarySearchTree allocates its nodes through a standard allocator
+// (rebound from Allocator to the node type). An allocator whose memory
+// is all returned at once when its resource is destroyed, so that
+// deallocate() may be skipped (see Arena_allocator in Arena.hpp), may
+// declare a member type named is_bulk_releasing. A tree of trivially
+// destructible elements using such an allocator is then discarded
+// without visiting its nodes.
+template <typename Alloc, typename = void>
+struct is_bulk_releasing_allocator : std::false_type {};
+
+template <typename Alloc>
+struct is_bulk_releasing_allocator<Alloc,
+                                   std::void_t<typename Alloc::is_bulk_releasing>>
+  : std::true_type {};
+
+// STATISTICS
+// A summary of the shape of a tree, returned by stats(), for judging
+// how well balanced a tree is in production and what it costs. Depths
+// count the nodes on the path from the root, so the root is at depth 1
+// and the deepest node is at the height of the tree.
+struct Tree_stats {
+  size_t nodes = 0;              // one per element
+  size_t bytes = 0;              // memory taken by the nodes
+  size_t max_depth = 0;          // the height of the tree
+  size_t min_height = 0;         // the height of a perfectly balanced
+                                 // tree of as many nodes
+  double average_depth = 0;      // over all nodes
+  double expected_comparisons = 0; // made by find() for an element chosen
+                                   // uniformly at random
+  std::vector<size_t> depth_histogram; // [d] is the number of nodes at
+                                       // depth d + 1
+};
+
+// EFFECTS: Prints stats to os, one figure per line, ending with the
+//          depth histogram as "depth count" lines.
+inline std::ostream &operator<<(std::ostream &os, const Tree_stats &stats) {
+  os << "nodes " << stats.nodes << "\n"
+     << "bytes " << stats.bytes << "\n"
+     << "height " << stats.max_depth
+     << " (minimum " << stats.min_height << ")\n"
+     << "average depth " << stats.average_depth << "\n"
+     << "expected comparisons " << stats.expected_comparisons << "\n";
+  for (size_t d = 0; d < stats.depth_histogram.size(); ++d) {
+    os << "depth " << d + 1 << " " << stats.depth_histogram[d] << "\n";
+  }
+  return os;
+}
 
 template <typename T,
-          typename Compare=std::less<T> // default if argument isn't provided
+          typename Compare=std::less<T>, // default if argument isn't provided
+          typename Balance=Unbalanced_tree,
+          typename Allocator=std::allocator<T>
          >
 class BinarySearchTree {
 
@@ -60,14 +145,32 @@ class BinarySearchTree {
   // Compare functor. Note that "greater than or equal to" and
   // "greater than" end up meaning the same thing when duplicates are
   // not allowed.
+  //
+  // INVARIANT: HEIGHT AND SIZE
+  // Every node stores the height of the subtree rooted at it and the
+  // number of nodes in that subtree.
+  //
+  // INVARIANT: PARENT LINKS
+  // Every node's parent pointer points to the node whose left or right
+  // child it is. The root's parent pointer is null.
+  //
+  // INVARIANT: BALANCE (AVL_tree only)
+  // For every node, the heights of its left and right subtrees differ
+  // by at most one.
+  //
+  // A Splay_tree has no balance invariant. Its shape changes on every
+  // find, which is why root is mutable.
 
-  // NOTE: Any operation you define must use RECURSION rather than iteration.
-  //       You may NOT use any looping constructs.
+  // NOTE: A helper that recurses down the tree uses stack space in
+  //       proportion to the height, which for Unbalanced_tree and
+  //       Splay_tree can be the number of elements. Helpers that may
+  //       run on such trees loop instead.
 
 private:
 
-  // A Node stores an element and pointers to its left and right children
-  // DO NOT change this struct definition.
+  // A Node stores an element, pointers to its left and right children
+  // and to its parent, and the height and size of the subtree rooted
+  // at it.
   struct Node {
 
     // Default constructor - does nothing
@@ -75,13 +178,28 @@ private:
 
     // Custom constructor provided for convenience
     Node(const T &datum_in, Node *left_in, Node *right_in)
-            : datum(datum_in), left(left_in), right(right_in) { }
+            : datum(datum_in), left(left_in), right(right_in),
+              parent(nullptr), height(1), size(1) { }
+
+    // Constructs a leaf whose datum is built in place from args
+    template <typename... Args>
+    explicit Node(std::in_place_t, Args&&... args)
+            : datum(std::forward<Args>(args)...), left(nullptr),
+              right(nullptr), parent(nullptr), height(1), size(1) { }
 
     T datum;
     Node *left;
     Node *right;
+    Node *parent;
+    int height;
+    size_t size;
   };
 
+  // Allocator for Nodes, rebound from the Allocator template argument
+  using Node_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+  using Node_traits = std::allocator_traits<Node_allocator>;
+
 public:
 
   // Default constructor
@@ -89,23 +207,142 @@ public:
   BinarySearchTree()
     : root(nullptr) { }
 
+  // Constructs an empty tree whose nodes are allocated with alloc_in
+  explicit BinarySearchTree(const Allocator &alloc_in)
+    : root(nullptr), alloc(alloc_in) { }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order
+  //           according to Compare (and so has no duplicates)
+  // EFFECTS : Constructs a tree holding the elements of [first, last),
+  //           shaped as a minimum-height tree, in linear time.
+  //           The precondition is checked when assertions are enabled.
+  template <typename Iter>
+  BinarySearchTree(Iter first, Iter last,
+                   const Allocator &alloc_in = Allocator())
+    : root(nullptr), alloc(alloc_in) {
+    assign(first, last);
+  }
+
   // Copy constructor
   BinarySearchTree(const BinarySearchTree &other)
-    : root(copy_nodes_impl(other.root)) { }
+    : root(nullptr),
+      alloc(Node_traits::select_on_container_copy_construction(other.alloc)) {
+    root = copy_nodes_impl(other.root, nullptr, alloc);
+  }
+
+  // EFFECTS: Same as the copy constructor, but copies in parallel on
+  //          pool: above cutoff nodes, the two subtrees of a node are
+  //          copied at once, one by a task of the pool. The copy has
+  //          exactly the same shape as other.
+  // NOTE:    Only trees using std::allocator are copied in parallel;
+  //          other allocators are not assumed to be safe to call from
+  //          several threads, so those trees are copied on this thread.
+  BinarySearchTree(const BinarySearchTree &other, ThreadPool &pool,
+                   size_t cutoff = min_parallel_size)
+    : root(nullptr), less(other.less),
+      alloc(Node_traits::select_on_container_copy_construction(other.alloc)) {
+    if (parallel_allocator) {
+      root = copy_nodes_parallel_impl(other.root, nullptr, alloc, pool,
+                                      cutoff);
+    } else {
+      root = copy_nodes_impl(other.root, nullptr, alloc);
+    }
+  }
+
+  // Move constructor
+  // Takes over the nodes of other in constant time, leaving other empty.
+  BinarySearchTree(BinarySearchTree &&other) noexcept
+    : root(other.root), less(other.less), alloc(other.alloc) {
+    other.root = nullptr;
+  }
 
   // Assignment operator
   BinarySearchTree &operator=(const BinarySearchTree &rhs) {
     if (this == &rhs) {
       return *this;
     }
-    destroy_nodes_impl(root);
-    root = copy_nodes_impl(rhs.root);
+    release_nodes();
+    root = copy_nodes_impl(rhs.root, nullptr, alloc);
+    return *this;
+  }
+
+  // Move assignment operator
+  // Takes over the nodes of rhs in constant time when the allocators
+  // allow it (they compare equal, or the allocator propagates on move
+  // assignment). Otherwise the elements are copied into this tree's
+  // allocator. Either way, rhs is left empty.
+  BinarySearchTree &operator=(BinarySearchTree &&rhs) {
+    if (this == &rhs) {
+      return *this;
+    }
+    release_nodes();
+    if (Node_traits::propagate_on_container_move_assignment::value) {
+      alloc = rhs.alloc;
+    }
+    if (alloc == rhs.alloc) {
+      root = rhs.root;
+      rhs.root = nullptr;
+    } else {
+      root = copy_nodes_impl(rhs.root, nullptr, alloc);
+      rhs.release_nodes();
+    }
     return *this;
   }
 
+  // REQUIRES: the allocators of this tree and other compare equal, or
+  //           the allocator propagates on swap
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS : Exchanges the contents of this tree and other in constant
+  //           time.
+  void swap(BinarySearchTree &other) noexcept {
+    std::swap(root, other.root);
+    if (Node_traits::propagate_on_container_swap::value) {
+      std::swap(alloc, other.alloc);
+    }
+  }
+
   // Destructor
   ~BinarySearchTree() {
-    destroy_nodes_impl(root);
+    release_nodes();
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Destroys every element and frees every node, leaving the
+  //           tree empty, in parallel on pool like the parallel copy
+  //           constructor (and with the same restriction on allocators).
+  // NOTE:     Freeing is bound by the allocator, and nodes freed on the
+  //           pool threads miss the caches of the thread that allocated
+  //           them. So this pays off only when several cores are idle,
+  //           as when dropping a multi-million-node model between runs;
+  //           on one core the destructor is faster. bench parallel
+  //           prints both for 1 to N threads.
+  void clear(ThreadPool &pool, size_t cutoff = min_parallel_size) {
+    if (parallel_allocator) {
+      destroy_nodes_parallel_impl(root, alloc, pool, cutoff);
+      root = nullptr;
+    } else {
+      release_nodes();
+    }
+  }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order
+  //           according to Compare (and so has no duplicates)
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Replaces the contents of this tree with the elements of
+  //           [first, last), building a minimum-height tree in linear
+  //           time. The precondition is checked when assertions are
+  //           enabled.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    assert(is_strictly_sorted(first, last));
+    release_nodes();
+    size_t count = static_cast<size_t>(std::distance(first, last));
+    root = build_impl(first, count, nullptr, alloc);
+  }
+
+  // EFFECTS: Returns a copy of the allocator used for this tree's elements.
+  Allocator get_allocator() const {
+    return Allocator(alloc);
   }
 
   // EFFECTS: Returns whether this BinarySearchTree is empty.
@@ -114,13 +351,45 @@ public:
   }
 
   // EFFECTS: Returns the height of the tree.
+  // NOTE:    Runs in constant time, using the height cached in the root.
   size_t height() const {
-    return static_cast<size_t>(height_impl(root));
+    return static_cast<size_t>(node_height(root));
   }
 
   // EFFECTS: Returns the number of elements in this BinarySearchTree.
+  // NOTE:    Runs in constant time, using the size cached in the root.
   size_t size() const {
-    return static_cast<size_t>(size_impl(root));
+    return node_size(root);
+  }
+
+  // EFFECTS: Returns statistics on the shape of the tree: see Tree_stats.
+  //          bytes counts sizeof(Node) per node, which does not include
+  //          the allocator's own overhead or memory an element owns (the
+  //          characters of a long string, say). expected_comparisons is
+  //          exact for find(): it costs one comparison for each ancestor
+  //          whose left subtree holds the element, and two for each other
+  //          ancestor and for the element's own node.
+  // NOTE:    Visits every node once, without changing the tree (even a
+  //          Splay_tree), so it takes linear time.
+  Tree_stats stats() const {
+    Tree_stats stats;
+    size_t total_comparisons = 0;
+    stats_impl(root, stats, total_comparisons);
+    stats.nodes = size();
+    stats.bytes = stats.nodes * sizeof(Node);
+    stats.max_depth = stats.depth_histogram.size();
+    for (size_t n = stats.nodes; n != 0; n /= 2) {
+      ++stats.min_height;
+    }
+    if (stats.nodes != 0) {
+      size_t total_depth = 0;
+      for (size_t d = 0; d < stats.depth_histogram.size(); ++d) {
+        total_depth += (d + 1) * stats.depth_histogram[d];
+      }
+      stats.average_depth = double(total_depth) / stats.nodes;
+      stats.expected_comparisons = double(total_comparisons) / stats.nodes;
+    }
+    return stats;
   }
 
   // EFFECTS: Traverses the tree using an in-order traversal,
@@ -139,24 +408,117 @@ public:
     traverse_preorder_impl(root, os);
   }
 
+  // EFFECTS: Calls visit(element) on each element in turn, in ascending
+  //          order. visit may modify the elements, but not in a way that
+  //          changes their order.
+  // NOTE:    The call to visit is made directly on each node, so a lambda
+  //          is inlined into the traversal; this is faster than iterating,
+  //          which also compares against end() at every step.
+  template <typename Visit>
+  void for_each_inorder(Visit visit) const {
+    for_each_inorder_impl(root, visit);
+  }
+
+  // EFFECTS: Calls visit(element) on each element in turn, in the
+  //          pre-order of the tree: each node before its left subtree,
+  //          and that before its right subtree.
+  template <typename Visit>
+  void for_each_preorder(Visit visit) const {
+    for_each_preorder_impl(root, visit);
+  }
+
+  // REQUIRES: visit may be called concurrently from several threads, each
+  //           time on a different element
+  // EFFECTS : Calls visit(element) once for each element, in no
+  //           particular order, spreading the calls over the threads of
+  //           pool. The tree is cut into subtrees of about
+  //           size() / (8 * threads) elements each, and every subtree is
+  //           traversed by one task; the few nodes above the cuts form one
+  //           more task. Returns once every call has finished, rethrowing
+  //           the first exception one of them threw.
+  // NOTE:    Trees smaller than min_parallel_size are traversed on the
+  //          calling thread, as splitting them costs more than it saves.
+  //          Nothing is splayed, which is what makes it safe to walk a
+  //          Splay_tree from several threads at once.
+  template <typename Visit>
+  void parallel_for_each(Visit visit, ThreadPool &pool) const {
+    size_t n = size();
+    if (n < min_parallel_size || pool.size() == 0) {
+      for_each_inorder_impl(root, visit);
+      return;
+    }
+    size_t grain = std::max<size_t>(n / (8 * pool.size()), 1);
+    std::vector<Node *> pieces;
+    std::vector<Node *> joints;
+    split_impl(root, grain, pieces, joints);
+
+    ThreadPool::Group group(pool);
+    for (Node *piece : pieces) {
+      group.run([piece, &visit]() { for_each_inorder_impl(piece, visit); });
+    }
+    group.run([&joints, &visit]() {
+      for (Node *joint : joints) {
+        visit(joint->datum);
+      }
+    });
+    group.wait();
+  }
+
+  // Trees with fewer elements than this are not split by
+  // parallel_for_each, and it is the default cutoff of the other
+  // parallel operations: subtrees no larger than the cutoff are handled
+  // by a single task.
+  static constexpr size_t min_parallel_size = 4096;
+
   // EFFECTS: Returns whether or not the sorting invariant holds on
   //          the root of this BinarySearchTree.
-  //
-  // NOTE: This function must be recursive.
   bool check_sorting_invariant() const {
     return check_sorting_invariant_impl(root, less);
   }
 
+  // EFFECTS: Same as above, but checks subtrees of more than cutoff
+  //          nodes in parallel on pool.
+  bool check_sorting_invariant(ThreadPool &pool,
+                               size_t cutoff = min_parallel_size) const {
+    return check_sorting_parallel_impl(root, less, pool, cutoff);
+  }
+
+  // EFFECTS: Returns whether the cached heights and sizes are correct
+  //          and, for AVL_tree, whether every node is balanced.
+  bool check_balance_invariant() const {
+    return check_balance_invariant_impl(root, Balance());
+  }
+
+  // EFFECTS: Same as above, but checks subtrees of more than cutoff
+  //          nodes in parallel on pool.
+  bool check_balance_invariant(ThreadPool &pool,
+                               size_t cutoff = min_parallel_size) const {
+    return check_balance_parallel_impl(root, Balance(), pool, cutoff);
+  }
+
   class Iterator {
     // OVERVIEW: Iterator interface for BinarySearchTree.
     //           Iterates over the elements in ascending order as defined
     //           by the sorted ordering of the BinarySearchTree.
+    //           Increment and decrement follow child and parent links,
+    //           so a full traversal in either direction visits each edge
+    //           at most twice and runs in O(n) total. An Iterator is a
+    //           node pointer plus a pointer to the tree, which is used
+    //           only to step back from the end to the largest element.
 
     // Big Three for Iterator not needed
 
   public:
+    // Standard iterator member types, so that Iterators can be passed
+    // to STL algorithms and to BinarySearchTree::assign
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T *;
+    using reference = T &;
+
     Iterator()
-      : root(nullptr), current_node(nullptr) {}
+      : current_node(nullptr), tree(nullptr) {}
 
     // EFFECTS:  Returns the current element by reference.
     // WARNING:  Dereferencing an iterator returns an element from the tree
@@ -188,13 +550,15 @@ public:
 
     // Prefix ++
     Iterator &operator++() {
+      INSTRUMENT_OP(increment);
       if (current_node->right) {
         // If has right child, next element is minimum of right subtree
         current_node = min_element_impl(current_node->right);
       }
       else {
-        // Otherwise, look in the whole tree for the next biggest element
-        current_node = min_greater_than_impl(root, current_node->datum, less);
+        // Otherwise, the next element is the nearest ancestor whose left
+        // subtree contains this node (null if there is none)
+        current_node = next_ancestor_impl(current_node);
       }
       return *this;
     }
@@ -206,6 +570,32 @@ public:
       return result;
     }
 
+    // REQUIRES: this Iterator is not at the smallest element
+    // Prefix --
+    Iterator &operator--() {
+      if (current_node == nullptr) {
+        // Stepping back from the end reaches the largest element
+        current_node = max_element_impl(tree->root);
+      }
+      else if (current_node->left) {
+        // If has left child, previous element is maximum of left subtree
+        current_node = max_element_impl(current_node->left);
+      }
+      else {
+        // Otherwise, the previous element is the nearest ancestor whose
+        // right subtree contains this node
+        current_node = prev_ancestor_impl(current_node);
+      }
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Iterator operator--(int) {
+      Iterator result(*this);
+      --(*this);
+      return result;
+    }
+
     bool operator==(const Iterator &rhs) const {
       return current_node == rhs.current_node;
     }
@@ -217,51 +607,120 @@ public:
   private:
     friend class BinarySearchTree;
 
-    Node *root;
     Node *current_node;
-    Compare less;
 
-    Iterator(Node *root_in, Node* current_node_in, Compare less_in)
-      : root(root_in), current_node(current_node_in), less(less_in) { }
+    // The tree iterated over, used only to step back from the end
+    const BinarySearchTree *tree;
+
+    Iterator(Node* current_node_in, const BinarySearchTree *tree_in)
+      : current_node(current_node_in), tree(tree_in) { }
 
   }; // BinarySearchTree::Iterator
+
+  // Iterators are passed and returned by value on every lookup, insert
+  // and hint, so they hold only a node and the tree, never a copy of the
+  // comparator or other per-tree state.
+  static_assert(sizeof(Iterator) == 2 * sizeof(void *),
+                "Iterator should stay two pointers");
   ////////////////////////////////////////
 
 
+  // Iterates over the elements in descending order
+  using Reverse_iterator = std::reverse_iterator<Iterator>;
+
   // EFFECTS : Returns an iterator to the first element
   //           in this BinarySearchTree.
   Iterator begin() const {
-    if (root == nullptr) {
-      return Iterator();
-    }
-    return Iterator(root, min_element_impl(root), less);
+    return Iterator(min_element_impl(root), this);
   }
 
   // EFFECTS: Returns an iterator to past-the-end.
   Iterator end() const {
-    return Iterator();
+    return Iterator(nullptr, this);
+  }
+
+  // EFFECTS: Returns a reverse iterator to the largest element, which
+  //          iterates over the elements in descending order.
+  Reverse_iterator rbegin() const {
+    return Reverse_iterator(end());
+  }
+
+  // EFFECTS: Returns a reverse iterator past the smallest element.
+  Reverse_iterator rend() const {
+    return Reverse_iterator(begin());
   }
 
 
   // EFFECTS: Returns an Iterator to the minimum element in this
   //          BinarySearchTree or an end Iterator if the tree is empty.
   Iterator min_element() const {
-    return Iterator(root, min_element_impl(root), less);
+    return Iterator(min_element_impl(root), this);
   }
 
   // EFFECTS: Returns an Iterator to the maximum element in this
   //          BinarySearchTree or an end Iterator if the tree is empty.
   Iterator max_element() const {
-    return Iterator(root, max_element_impl(root), less);
+    return Iterator(max_element_impl(root), this);
   }
 
   // EFFECTS: Returns an Iterator to the minimum element in this
   //          BinarySearchTree greater than the given value.
   //          If the tree is empty, returns an end Iterator.
   Iterator min_greater_than(const T &value) const {
-    return Iterator(root, min_greater_than_impl(root, value, less), less);
+    return Iterator(min_greater_than_impl(root, value, less), this);
+  }
+
+
+  // EFFECTS: Returns an Iterator to the smallest element that is not
+  //          less than query, or an end Iterator if there is none.
+  // NOTE:    Runs in time proportional to the height of the tree, like
+  //          upper_bound, equal_range and range below.
+  Iterator lower_bound(const T &query) const {
+    return Iterator(lower_bound_impl(root, query, less, nullptr), this);
+  }
+
+  // Same as above, for any type a transparent Compare accepts (see find).
+  template <typename Key, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const Key &query) const {
+    return Iterator(lower_bound_impl(root, query, less, nullptr), this);
+  }
+
+  // EFFECTS: Returns an Iterator to the smallest element that is greater
+  //          than query, or an end Iterator if there is none.
+  Iterator upper_bound(const T &query) const {
+    return Iterator(upper_bound_impl(root, query, less, nullptr), this);
+  }
+
+  // Same as above, for any type a transparent Compare accepts (see find).
+  template <typename Key, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const Key &query) const {
+    return Iterator(upper_bound_impl(root, query, less, nullptr), this);
+  }
+
+  // EFFECTS: Returns the pair (lower_bound(query), upper_bound(query)),
+  //          which delimits the element equivalent to query if there is
+  //          one and is empty otherwise.
+  std::pair<Iterator, Iterator> equal_range(const T &query) const {
+    return equal_range_impl(query);
   }
 
+  // Same as above, for any type a transparent Compare accepts (see find).
+  template <typename Key, typename C = Compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const Key &query) const {
+    return equal_range_impl(query);
+  }
+
+  // REQUIRES: low is not greater than high
+  // EFFECTS:  Returns a view of the elements not less than low and less
+  //           than high, in ascending order. Finding the ends takes time
+  //           proportional to the height of the tree, and iterating takes
+  //           time proportional to the number of elements in the range.
+  Iterator_range<Iterator> range(const T &low, const T &high) const {
+    return Iterator_range<Iterator>(lower_bound(low), lower_bound(high));
+  }
 
   // EFFECTS: Searches this tree for an element equivalent to query.
   //          Returns an iterator to the existing element if found,
@@ -272,18 +731,296 @@ public:
   //          modifications result in a new value that compares equal
   //          to the existing value. Otherwise, the sorting invariant
   //          will no longer hold.
+  // NOTE:    With Splay_tree, also splays the tree (see Splay_tree), so
+  //          it modifies the tree's shape despite being const.
   Iterator find(const T &query) const {
-    return Iterator(root, find_impl(root, query, less), less);
+    INSTRUMENT_OP(find);
+    return Iterator(search(query, Balance()), this);
+  }
+
+  // EFFECTS: Same as find(const T &), but compares query directly against
+  //          the elements without converting it to T. Only available when
+  //          Compare declares an is_transparent member type, which
+  //          promises that it can compare T against other types (e.g.
+  //          std::less<> comparing std::string with const char *).
+  template <typename Key, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(const Key &query) const {
+    INSTRUMENT_OP(find);
+    return Iterator(search(query, Balance()), this);
+  }
+
+  // REQUIRES: hint is an Iterator into this tree
+  // EFFECTS : Same as find(query), but searches outward from hint rather
+  //           than down from the root, so it is fastest when the element
+  //           sought is at or near hint, as when looking up keys in
+  //           ascending order, each time starting from the previous
+  //           result. An end Iterator stands for the maximum element.
+  // NOTE:    First compares query with hint and with its in-order
+  //          neighbour on query's side, which settles a query at or just
+  //          past hint in at most three comparisons. Otherwise walks up
+  //          from hint only as far as the nearest ancestor that bounds
+  //          query, comparing only at the ancestors on query's side of
+  //          hint, then searches down from there. Never splays.
+  Iterator find(Iterator hint, const T &query) const {
+    INSTRUMENT_OP(find);
+    return Iterator(search_near(hint, query), this);
+  }
+
+  // Same as above, for any type a transparent Compare accepts (see find).
+  template <typename Key, typename C = Compare,
+            typename = typename C::is_transparent>
+  Iterator find(Iterator hint, const Key &query) const {
+    INSTRUMENT_OP(find);
+    return Iterator(search_near(hint, query), this);
+  }
+
+  // EFFECTS: Returns the number of elements in this BinarySearchTree that
+  //          are less than value. If value is in the tree, this is its
+  //          zero-based position in sorted order.
+  // NOTE:    Runs in time proportional to the height of the tree.
+  size_t rank(const T &value) const {
+    return rank_impl(root, value, less, 0);
+  }
+
+  // EFFECTS: Returns an Iterator to the element at zero-based position k
+  //          in sorted order, or an end Iterator if k >= size().
+  // NOTE:    Runs in time proportional to the height of the tree.
+  Iterator select(size_t k) const {
+    return Iterator(select_impl(root, k), this);
   }
 
   // REQUIRES: The given item is not already contained in this BinarySearchTree
   // MODIFIES: this BinarySearchTree
   // EFFECTS : Inserts the element k into this BinarySearchTree, maintaining
-  //           the sorting invariant.
+  //           the sorting invariant (and, for AVL_tree, the balance
+  //           invariant).
   Iterator insert(const T &item) {
-    assert(find(item) == end());
-    root = insert_impl(root, item, less);
-    return find(item);
+    std::pair<Iterator, bool> result = insert_unique(item);
+    assert(result.second);
+    return result.first;
+  }
+
+  // Same as above, but moves item into the tree.
+  Iterator insert(T &&item) {
+    std::pair<Iterator, bool> result = insert_unique(std::move(item));
+    assert(result.second);
+    return result.first;
+  }
+
+  // REQUIRES: hint is an Iterator into this tree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Inserts item unless an equivalent element is already
+  //           contained in this tree, and returns an Iterator to the
+  //           element equivalent to item either way. The search for its
+  //           place starts at hint, as in find(hint, query): when item
+  //           falls between hint and its in-order neighbour (or past the
+  //           maximum, for an end hint), the new node is linked in after
+  //           at most three comparisons.
+  // NOTE:    Only comparisons are saved. Finding the neighbour may follow
+  //          O(log n) pointers, and linking the node still updates every
+  //          cached size up to the root, so the insertion is O(log n)
+  //          either way. The hint pays off when comparing is dear, as
+  //          with string keys; for ints, searching from the root is as
+  //          fast or faster.
+  Iterator insert(Iterator hint, const T &item) {
+    return try_emplace_hint(hint, item, item).first;
+  }
+
+  // Same as above, but moves item into the tree if it is inserted.
+  Iterator insert(Iterator hint, T &&item) {
+    return try_emplace_hint(hint, item, std::move(item)).first;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : If an element equivalent to item is already contained in
+  //           this BinarySearchTree, returns an Iterator to it along with
+  //           false. Otherwise, inserts item and returns an Iterator to
+  //           the new element along with true.
+  // NOTE:    Performs a single descent from the root.
+  std::pair<Iterator, bool> insert_unique(const T &item) {
+    return try_emplace(item, item);
+  }
+
+  // Same as above, but moves item into the tree if it is inserted.
+  std::pair<Iterator, bool> insert_unique(T &&item) {
+    return try_emplace(item, std::move(item));
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Constructs an element from args directly inside a new node.
+  //           If an equivalent element is already contained in this
+  //           tree, the new element is destroyed and an Iterator to the
+  //           existing one is returned along with false. Otherwise, the
+  //           new element is linked in and an Iterator to it is returned
+  //           along with true.
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args&&... args) {
+    INSTRUMENT_OP(insert);
+    Node *node = new_node_impl(alloc, std::forward<Args>(args)...);
+    Node *parent = nullptr;
+    bool go_left = false;
+    Node *existing = find_slot_impl(root, node->datum, less, parent, go_left);
+    if (existing) {
+      delete_node_impl(alloc, node);
+      accessed(existing, Balance());
+      return std::pair<Iterator, bool>(Iterator(existing, this), false);
+    }
+    link_node(node, parent, go_left);
+    accessed(node, Balance());
+    return std::pair<Iterator, bool>(Iterator(node, this), true);
+  }
+
+  // REQUIRES: An element constructed from args is equivalent to key.
+  //           key is of type T, or of a type Compare can compare against
+  //           T (see find).
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : If an element equivalent to key is already contained in
+  //           this tree, returns an Iterator to it along with false,
+  //           without constructing anything. Otherwise, constructs an
+  //           element from args directly inside a new node, links it in,
+  //           and returns an Iterator to it along with true.
+  // NOTE:    Performs a single descent from the root.
+  template <typename Key, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const Key &key, Args&&... args) {
+    INSTRUMENT_OP(insert);
+    Node *parent = nullptr;
+    bool go_left = false;
+    Node *existing = find_slot_impl(root, key, less, parent, go_left);
+    if (existing) {
+      accessed(existing, Balance());
+      return std::pair<Iterator, bool>(Iterator(existing, this), false);
+    }
+    Node *node = new_node_impl(alloc, std::forward<Args>(args)...);
+    link_node(node, parent, go_left);
+    accessed(node, Balance());
+    return std::pair<Iterator, bool>(Iterator(node, this), true);
+  }
+
+  // REQUIRES: hint is an Iterator into this tree, and an element
+  //           constructed from args is equivalent to key
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as try_emplace(key, args...), but searches for the
+  //           place of key outward from hint (see insert(hint, item)).
+  template <typename Key, typename... Args>
+  std::pair<Iterator, bool> try_emplace_hint(Iterator hint, const Key &key,
+                                             Args&&... args) {
+    INSTRUMENT_OP(insert);
+    Node *parent = nullptr;
+    bool go_left = false;
+    Node *existing = find_slot_near(hint, key, parent, go_left);
+    if (existing) {
+      accessed(existing, Balance());
+      return std::pair<Iterator, bool>(Iterator(existing, this), false);
+    }
+    Node *node = new_node_impl(alloc, std::forward<Args>(args)...);
+    link_node(node, parent, go_left);
+    accessed(node, Balance());
+    return std::pair<Iterator, bool>(Iterator(node, this), true);
+  }
+
+  // REQUIRES: pos is a dereferenceable Iterator into this tree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the element at pos, frees its node, and returns an
+  //           Iterator to the element that followed it (or an end
+  //           Iterator). Iterators to other elements remain valid.
+  // NOTE:    Nodes are relinked rather than elements moved between
+  //          them, and the invariants are restored on the way back up to
+  //          the root, so this takes time proportional to the height.
+  Iterator erase(Iterator pos) {
+    Node *node = pos.current_node;
+    ++pos;
+    unlink_node(node);
+    delete_node_impl(alloc, node);
+    return pos;
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Removes the element equivalent to item, if there is one.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const T &item) {
+    Iterator pos = find(item);
+    if (pos == end()) {
+      return 0;
+    }
+    erase(pos);
+    return 1;
+  }
+
+  // REQUIRES: combine(T &existing, T &&incoming) leaves in existing an
+  //           element equivalent to both
+  // MODIFIES: this BinarySearchTree, other
+  // EFFECTS : Adds every element of other to this tree, leaving other
+  //           empty. When both trees hold equivalent elements, combine
+  //           folds the one from other into the one in this tree. The two
+  //           sorted sequences are merged and the result is rebuilt as a
+  //           minimum-height tree, in O(n + m) total. The nodes of other
+  //           are relinked into this tree, without copying or moving any
+  //           element, unless the allocators compare unequal.
+  //           If a comparison, combine or an allocation throws, nothing
+  //           is lost or leaked: this tree keeps its own elements and
+  //           those of other merged before the throw, other keeps the
+  //           rest, and both are valid (minimum-height) trees again.
+  template <typename Combine>
+  void merge(BinarySearchTree &&other, Combine combine) {
+    if (this == &other) {
+      return;
+    }
+    std::vector<Node *> theirs;
+    collect_nodes_impl(other.root, theirs);
+    bool same_alloc = alloc == other.alloc;
+    size_t taken = 0;
+    try {
+      merge_nodes(theirs, taken,
+        [&](Node *node) {
+          if (same_alloc) {
+            return node;
+          }
+          Node *moved = new_node_impl(alloc, std::move(node->datum));
+          delete_node_impl(other.alloc, node);
+          return moved;
+        },
+        [&](Node *existing, Node *incoming) {
+          combine(existing->datum, std::move(incoming->datum));
+          delete_node_impl(other.alloc, incoming);
+        });
+    } catch (...) {
+      // The nodes of other not yet taken go back to it
+      Node *const *rest = theirs.data() + taken;
+      other.root = link_nodes_impl(rest, theirs.size() - taken, nullptr);
+      throw;
+    }
+    other.root = nullptr;
+  }
+
+  // REQUIRES: combine(T &existing, const T &incoming) leaves in existing
+  //           an element equivalent to both
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Same as above, but copies the elements of other, which is
+  //           left unchanged (even if something throws).
+  template <typename Combine>
+  void merge(const BinarySearchTree &other, Combine combine) {
+    if (this == &other) {
+      BinarySearchTree copy(other);
+      merge(std::move(copy), combine);
+      return;
+    }
+    std::vector<Node *> theirs;
+    collect_nodes_impl(other.root, theirs);
+    size_t taken = 0;
+    merge_nodes(theirs, taken,
+      [&](Node *node) {
+        return new_node_impl(alloc, static_cast<const T &>(node->datum));
+      },
+      [&](Node *existing, Node *incoming) {
+        combine(existing->datum, static_cast<const T &>(incoming->datum));
+      });
+  }
+
+  // EFFECTS: Returns a read-only copy of this tree's elements laid out for
+  //          fast lookups. See FrozenTree.hpp. Takes linear time.
+  FrozenTree<T, Compare> freeze() const {
+    return FrozenTree<T, Compare>(begin(), end());
   }
 
   // EFFECTS: Returns a human-readable string representation of this
@@ -298,11 +1035,297 @@ private:
 
   // DATA REPRESENTATION
   // The root node of this BinarySearchTree.
-  Node *root;
+  mutable Node *root;
 
   // An instance of the Compare type. Use this to compare elements.
   Compare less;
 
+  // Allocates and frees this tree's nodes.
+  Node_allocator alloc;
+
+  // Whether alloc may be called from several threads at once
+  static constexpr bool parallel_allocator =
+    std::is_same<Node_allocator, std::allocator<Node>>::value;
+
+  // The parallel operations split at most this many levels of the tree
+  // and finish each part below on one thread. A balanced tree never gets
+  // this deep above its cutoff; an unbalanced one would otherwise recurse
+  // once per level.
+  static constexpr int max_parallel_depth = 64;
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Destroys every element and frees every node, leaving the
+  //           tree empty. Skips the traversal entirely when there are no
+  //           destructors to run and the allocator frees in bulk.
+  void release_nodes() {
+    if (!std::is_trivially_destructible<T>::value ||
+        !is_bulk_releasing_allocator<Node_allocator>::value) {
+      destroy_nodes_impl(root, alloc);
+    }
+    root = nullptr;
+  }
+
+  // EFFECTS: Returns whether [first, last) is sorted in strictly ascending
+  //          order according to less.
+  template <typename Iter>
+  bool is_strictly_sorted(Iter first, Iter last) const {
+    auto out_of_order = [this](const T &lhs, const T &rhs) {
+      return !less(lhs, rhs);
+    };
+    return std::adjacent_find(first, last, out_of_order) == last;
+  }
+
+  // REQUIRES: parent is null and this tree is empty, or parent has no
+  //           child on the given side and node belongs there
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Links the leaf node under parent (as the left child if
+  //           go_left is true) and restores the invariants on the path
+  //           back up to the root.
+  // NOTE:    Once a subtree on the path is as tall as it was before the
+  //          insertion (possibly after a rotation), no ancestor's height
+  //          or balance changes, so the rest of the walk only counts the
+  //          new node in each cached size, without reading siblings.
+  void link_node(Node *node, Node *parent, bool go_left) {
+    node->parent = parent;
+    if (parent == nullptr) {
+      root = node;
+    } else if (go_left) {
+      parent->left = node;
+    } else {
+      parent->right = node;
+    }
+    node = parent;
+    while (node != nullptr) {
+      Node *up = node->parent;
+      int old_height = node->height;
+      Node *top = rebalance_impl(node, Balance());
+      replace_child(up, node, top);
+      node = up;
+      if (top->height == old_height) {
+        break;
+      }
+    }
+    for (; node != nullptr; node = node->parent) {
+      ++node->size;
+    }
+  }
+
+  // REQUIRES: node is in this tree
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Detaches node from the tree, moving its in-order successor
+  //           into its place if it has two children, and restores the
+  //           invariants on the path back up to the root.
+  void unlink_node(Node *node) {
+    Node *changed = node->parent;
+    if (node->left == nullptr || node->right == nullptr) {
+      replace_child(node->parent, node,
+                    node->left ? node->left : node->right);
+    } else {
+      Node *successor = min_element_impl(node->right);
+      if (successor->parent == node) {
+        changed = successor;
+      } else {
+        // Detach the successor, which has no left child, and give it
+        // node's right subtree
+        changed = successor->parent;
+        replace_child(successor->parent, successor, successor->right);
+        successor->right = node->right;
+        successor->right->parent = successor;
+      }
+      successor->left = node->left;
+      successor->left->parent = successor;
+      replace_child(node->parent, node, successor);
+    }
+    rebalance_path(changed);
+  }
+
+  // REQUIRES: theirs holds the nodes of another tree in ascending order
+  // MODIFIES: this BinarySearchTree, taken
+  // EFFECTS : Merges the nodes of this tree with theirs, and relinks the
+  //           result as a minimum-height tree. adopt(node) returns a node
+  //           of this tree holding the element of node, which is from
+  //           theirs. join(existing, incoming) folds incoming into the
+  //           equivalent node existing of this tree, and disposes of
+  //           incoming. taken counts the nodes of theirs adopted or
+  //           joined so far. If anything throws, adopt and join having
+  //           left their arguments as they were, this tree is relinked
+  //           from its own nodes and those adopted so far before the
+  //           exception is rethrown; theirs from taken on are untouched.
+  template <typename Adopt, typename Join>
+  void merge_nodes(const std::vector<Node *> &theirs, size_t &taken,
+                   Adopt adopt, Join join) {
+    std::vector<Node *> mine;
+    collect_nodes_impl(root, mine);
+    std::vector<Node *> merged;
+    merged.reserve(mine.size() + theirs.size());
+    size_t i = 0;
+    size_t &j = taken;
+    try {
+      while (i < mine.size() && j < theirs.size()) {
+        if (less(mine[i]->datum, theirs[j]->datum)) {
+          merged.push_back(mine[i++]);
+        } else if (less(theirs[j]->datum, mine[i]->datum)) {
+          merged.push_back(adopt(theirs[j]));
+          ++j;
+        } else {
+          join(mine[i], theirs[j]);
+          ++j;
+          merged.push_back(mine[i++]);
+        }
+      }
+      for (; j < theirs.size(); ++j) {
+        merged.push_back(adopt(theirs[j]));
+      }
+    } catch (...) {
+      // Everything merged so far precedes mine[i], so appending the rest
+      // of mine keeps the order; merged has room, so this cannot throw
+      merged.insert(merged.end(), mine.begin() + i, mine.end());
+      Node *const *next = merged.data();
+      root = link_nodes_impl(next, merged.size(), nullptr);
+      throw;
+    }
+    merged.insert(merged.end(), mine.begin() + i, mine.end());
+    Node *const *next = merged.data();
+    root = link_nodes_impl(next, merged.size(), nullptr);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Walks from node up to the root, recomputing each cached
+  //           height and size and applying the Balance policy's
+  //           rotations. Used after the subtree below node has changed.
+  void rebalance_path(Node *node) {
+    while (node != nullptr) {
+      Node *parent = node->parent;
+      replace_child(parent, node, rebalance_impl(node, Balance()));
+      node = parent;
+    }
+  }
+
+  // EFFECTS : Returns lower_bound(query) and the Iterator after it if it
+  //           holds an element equivalent to query, or else the same.
+  template <typename Key>
+  std::pair<Iterator, Iterator> equal_range_impl(const Key &query) const {
+    Iterator first(lower_bound_impl(root, query, less, nullptr), this);
+    Iterator last = first;
+    if (last != end() && !less(query, *last)) {
+      ++last;
+    }
+    return std::pair<Iterator, Iterator>(first, last);
+  }
+
+  // EFFECTS : Returns the node holding an element equivalent to query,
+  //           or null if there is none.
+  template <typename Key, typename Policy>
+  Node *search(const Key &query, Policy) const {
+    return find_impl(root, query, less);
+  }
+
+  // MODIFIES: root
+  // EFFECTS : Same as above, and splays the node found, or else the last
+  //           node visited, to the root.
+  template <typename Key>
+  Node *search(const Key &query, Splay_tree) const {
+    Node *node = root;
+    Node *last = nullptr;
+    while (node != nullptr) {
+      last = node;
+      INSTRUMENT_NODE();
+      if (INSTRUMENT_COMPARE(less(query, node->datum))) {
+        node = node->left;
+      } else if (INSTRUMENT_COMPARE(less(node->datum, query))) {
+        node = node->right;
+      } else {
+        break;
+      }
+    }
+    if (last != nullptr) {
+      root = splay_impl(last);
+    }
+    return node;
+  }
+
+  // REQUIRES: hint is an Iterator into this tree
+  // MODIFIES: parent, go_left
+  // EFFECTS : Same as find_slot_impl, but searches outward from hint
+  //           with find_slot_near_impl. An end Iterator stands for the
+  //           maximum node; since nothing is greater, a key past it
+  //           belongs right below it without climbing.
+  template <typename Key>
+  Node *find_slot_near(Iterator hint, const Key &key, Node *&parent,
+                       bool &go_left) const {
+    assert(hint.current_node == nullptr || hint.tree == this);
+    if (root == nullptr) {
+      return nullptr;
+    }
+    Node *node = hint.current_node;
+    if (node == nullptr) {
+      node = max_element_impl(root);
+      if (INSTRUMENT_COMPARE(less(node->datum, key))) {
+        parent = node;
+        go_left = false;
+        return nullptr;
+      }
+    }
+    return find_slot_near_impl(node, key, less, parent, go_left);
+  }
+
+  // EFFECTS : Returns the node holding an element equivalent to query,
+  //           searching outward from hint, or null if there is none.
+  template <typename Key>
+  Node *search_near(Iterator hint, const Key &query) const {
+    Node *parent = nullptr;
+    bool go_left = false;
+    return find_slot_near(hint, query, parent, go_left);
+  }
+
+  // EFFECTS : Called with the node an insertion reached. Only a
+  //           Splay_tree acts on it, by splaying it to the root.
+  template <typename Policy>
+  void accessed(Node *, Policy) const { }
+
+  void accessed(Node *node, Splay_tree) const {
+    root = splay_impl(node);
+  }
+
+  // MODIFIES: this BinarySearchTree
+  // EFFECTS : Makes new_child take the place of old_child under parent,
+  //           or as the root if parent is null.
+  void replace_child(Node *parent, Node *old_child, Node *new_child) {
+    if (parent == nullptr) {
+      root = new_child;
+    } else if (parent->left == old_child) {
+      parent->left = new_child;
+    } else {
+      parent->right = new_child;
+    }
+    if (new_child) {
+      new_child->parent = parent;
+    }
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Allocates a new leaf Node and constructs its datum in place
+  //           from args.
+  template <typename... Args>
+  static Node *new_node_impl(Node_allocator &alloc, Args&&... args) {
+    Node *node = Node_traits::allocate(alloc, 1);
+    try {
+      Node_traits::construct(alloc, node, std::in_place,
+                             std::forward<Args>(args)...);
+    } catch (...) {
+      Node_traits::deallocate(alloc, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Destroys and frees a Node created by new_node_impl.
+  static void delete_node_impl(Node_allocator &alloc, Node *node) {
+    Node_traits::destroy(alloc, node);
+    Node_traits::deallocate(alloc, node, 1);
+  }
+
     
   // NOTE: These member types are implemented for you in TreePrint.hpp.
   //       They support the to_string function. You do not have to do
@@ -315,13 +1338,10 @@ private:
   //       anything with it. DO NOT CHANGE.
   int get_max_elt_width() const;
 
-// ---------- DO NOT CHANGE ANYTHING IN THIS FILE ABOVE THIS LINE ----------
-
 
   // TREE IMPLEMENTATION FUNCTIONS
-  // You must write an implementation for each of these static member
-  // functions, which are called from the regular member functions that
-  // are included in the starter code for the BinarySearchTree class.
+  // These static member functions work on the nodes of a tree; the
+  // public member functions above are implemented in terms of them.
 
 
   // EFFECTS: Returns whether the tree rooted at 'node' is empty.
@@ -331,273 +1351,908 @@ private:
     return (node == nullptr);
 }
 
-  // EFFECTS: Returns the size of the tree rooted at 'node', which is the
-  //          total number of nodes in that tree. The size of an empty
-  //          tree is 0.
-  // NOTE:    This function must be tree recursive.
-static int size_impl(const Node *node) {
+  // EFFECTS: Creates and returns a pointer to the root of a new node structure
+  //          with the same elements and EXACTLY the same structure as the
+  //          tree rooted at 'node'. The new root's parent is 'parent'.
+  //          New nodes are allocated from 'alloc'. If a copy throws,
+  //          the nodes already copied are freed.
+  // NOTE:    This function walks both trees together through the parent
+  //          links rather than recursing, so it needs constant stack
+  //          space however tall the tree is.
+static Node *copy_nodes_impl(const Node *node, Node *parent,
+                             Node_allocator &alloc) {
     if (node == nullptr) {
-        return 0;
+        return nullptr; // Return nullptr for an empty tree
     }
-    return 1 + size_impl(node->left) + size_impl(node->right);
+    const Node *top = node;
+    Node *new_top = copy_node_impl(node, parent, alloc);
+    Node *new_node = new_top;
+    try {
+        while (true) {
+            if (node->left != nullptr && new_node->left == nullptr) {
+                // Copy the left subtree first
+                new_node->left = copy_node_impl(node->left, new_node, alloc);
+                node = node->left;
+                new_node = new_node->left;
+            } else if (node->right != nullptr && new_node->right == nullptr) {
+                // Then the right subtree
+                new_node->right = copy_node_impl(node->right, new_node, alloc);
+                node = node->right;
+                new_node = new_node->right;
+            } else if (node == top) {
+                break;
+            } else {
+                // Both subtrees are copied; go back up
+                node = node->parent;
+                new_node = new_node->parent;
+            }
+        }
+    } catch (...) {
+        destroy_nodes_impl(new_top, alloc);
+        throw;
+    }
+    return new_top;
 }
 
-  // EFFECTS: Returns the height of the tree rooted at 'node', which is the
-  //          number of nodes in the longest path from the 'node' to a leaf.
-  //          The height of an empty tree is 0.
-  // NOTE:    This function must be tree recursive.
- static int height_impl(const Node *node) {
-    if (node == nullptr) {
-        return 0; // Height of an empty tree is 0
-    } else {
-        // Recursively calculate the height of the left and right subtrees
-        int left_height = height_impl(node->left);
-        int right_height = height_impl(node->right);
+  // EFFECTS: Creates a node holding a copy of the datum of 'node', with
+  //          the same cached height and size, no children and the given
+  //          parent, and returns a pointer to it.
+static Node *copy_node_impl(const Node *node, Node *parent,
+                            Node_allocator &alloc) {
+    Node *new_node = new_node_impl(alloc, node->datum);
+    new_node->parent = parent;
+    new_node->height = node->height;
+    new_node->size = node->size;
+    return new_node;
+}
 
-        // Height of the tree rooted at this node is the maximum height of its subtrees plus 1
-        return 1 + std::max(left_height, right_height);
+  // MODIFIES: nodes
+  // EFFECTS : Appends the nodes of the tree rooted at 'node' to 'nodes',
+  //           in order.
+static void collect_nodes_impl(Node *node, std::vector<Node *> &nodes) {
+    const Node *top = node;
+    for (node = min_element_impl(node); node != nullptr;
+         node = next_inorder_impl(node, top)) {
+        nodes.push_back(node);
     }
 }
 
-  // EFFECTS: Creates and returns a pointer to the root of a new node structure
-  //          with the same elements and EXACTLY the same structure as the
-  //          tree rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
- static Node *copy_nodes_impl(Node *node) {
-    if (node == nullptr) {
-        return nullptr; // Return nullptr for an empty tree
-    } else {
-        // Create a new node with the same datum as 'node'
-        Node *new_node = new Node(node->datum, nullptr, nullptr);
-        // Recursively copy the left and right subtrees
-        new_node->left = copy_nodes_impl(node->left);
-        new_node->right = copy_nodes_impl(node->right);
-        // Return the newly created node
-        return new_node;
+  // REQUIRES: 'node' is in the tree rooted at 'top'
+  // EFFECTS : Returns a pointer to the in-order successor of 'node' within
+  //           the tree rooted at 'top', or a null pointer if 'node' is its
+  //           last node. Never looks above 'top', so the subtrees of a
+  //           tree can be walked at once.
+static Node *next_inorder_impl(Node *node, const Node *top) {
+    if (node->right != nullptr) {
+        return min_element_impl(node->right);
+    }
+    while (node != top && node->parent->right == node) {
+        node = node->parent;
     }
+    return node == top ? nullptr : node->parent;
 }
 
-  // EFFECTS: Frees the memory for all nodes used in the tree rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
- static void destroy_nodes_impl(Node *node) {
-    if (node == nullptr) {
-        return; // Base case: Nothing to delete for an empty tree
-    } else {
-        // Recursively delete left and right subtrees
-        destroy_nodes_impl(node->left);
-        destroy_nodes_impl(node->right);
-        // Delete the current node
-        delete node;
+  // MODIFIES: it, and the nodes it points to
+  // EFFECTS : Same as build_impl, but links the next 'count' existing
+  //           nodes of 'it' instead of creating new ones.
+  // NOTE:    Each call takes half of the remaining nodes, so this
+  //          recurses only about log2(count) levels deep.
+static Node *link_nodes_impl(Node *const *&it, size_t count, Node *parent) {
+    if (count == 0) {
+        return nullptr;
     }
+    size_t left_count = count / 2;
+    Node *left = link_nodes_impl(it, left_count, nullptr);
+    Node *node = *it;
+    ++it;
+    node->parent = parent;
+    node->left = left;
+    if (left) {
+        left->parent = node;
+    }
+    node->right = link_nodes_impl(it, count - left_count - 1, node);
+    update_impl(node);
+    return node;
+}
+
+  // MODIFIES: it, alloc
+  // EFFECTS : Creates a minimum-height tree holding the next 'count'
+  //           elements of 'it', advancing 'it' past them, and returns
+  //           its root, whose parent is 'parent'. Every element is
+  //           visited once, so this runs in linear time. The result
+  //           satisfies the AVL balance invariant. If creating an
+  //           element throws, the nodes already built are freed.
+  // NOTE:    Each call takes half of the remaining elements, so this
+  //          recurses only about log2(count) levels deep.
+template <typename Iter>
+static Node *build_impl(Iter &it, size_t count, Node *parent,
+                        Node_allocator &alloc) {
+    if (count == 0) {
+        return nullptr;
+    }
+    size_t left_count = count / 2;
+    Node *left = build_impl(it, left_count, nullptr, alloc);
+    Node *node = nullptr;
+    try {
+        node = new_node_impl(alloc, *it);
+        ++it;
+    } catch (...) {
+        destroy_nodes_impl(left, alloc);
+        throw;
+    }
+    node->parent = parent;
+    node->left = left;
+    if (left) {
+        left->parent = node;
+    }
+    try {
+        node->right = build_impl(it, count - left_count - 1, node, alloc);
+    } catch (...) {
+        destroy_nodes_impl(node, alloc);
+        throw;
+    }
+    update_impl(node);
+    return node;
+}
+
+  // EFFECTS: Frees the memory for all nodes used in the tree rooted at 'node',
+  //          returning it to 'alloc'.
+  // NOTE:    Rather than recursing, this rotates each left child above
+  //          its parent until the top node has no left child, then frees
+  //          it and carries on with its right subtree. Every rotation
+  //          moves one node off the left path for good, so this takes
+  //          linear time and constant stack space. Only the left and
+  //          right links are kept up to date on the way.
+static void destroy_nodes_impl(Node *node, Node_allocator &alloc) {
+    while (node != nullptr) {
+        Node *left = node->left;
+        if (left != nullptr) {
+            node->left = left->right;
+            left->right = node;
+            node = left;
+        } else {
+            Node *right = node->right;
+            delete_node_impl(alloc, node);
+            node = right;
+        }
+    }
+}
+
+  // EFFECTS: Same as copy_nodes_impl, but while the tree has more than
+  //          'cutoff' nodes and fewer than 'depth' levels have been split,
+  //          copies the left subtree on 'pool' while this thread copies
+  //          the right one. If a copy throws, the part of the new tree
+  //          hanging from its root is freed.
+static Node *copy_nodes_parallel_impl(const Node *node, Node *parent,
+                                      Node_allocator &alloc, ThreadPool &pool,
+                                      size_t cutoff,
+                                      int depth = max_parallel_depth) {
+    if (node == nullptr || node->size <= cutoff || depth == 0) {
+        return copy_nodes_impl(node, parent, alloc);
+    }
+    Node *new_node = copy_node_impl(node, parent, alloc);
+    try {
+        pool.parallel_invoke(
+            [&]() {
+                new_node->left = copy_nodes_parallel_impl(
+                    node->left, new_node, alloc, pool, cutoff, depth - 1);
+            },
+            [&]() {
+                new_node->right = copy_nodes_parallel_impl(
+                    node->right, new_node, alloc, pool, cutoff, depth - 1);
+            });
+    } catch (...) {
+        destroy_nodes_impl(new_node, alloc);
+        throw;
+    }
+    return new_node;
+}
+
+  // EFFECTS: Same as destroy_nodes_impl, but while the tree has more
+  //          than 'cutoff' nodes and fewer than 'depth' levels have been
+  //          split, frees the two subtrees at once.
+static void destroy_nodes_parallel_impl(Node *node, Node_allocator &alloc,
+                                        ThreadPool &pool, size_t cutoff,
+                                        int depth = max_parallel_depth) {
+    if (node == nullptr || node->size <= cutoff || depth == 0) {
+        destroy_nodes_impl(node, alloc);
+        return;
+    }
+    pool.parallel_invoke(
+        [&]() {
+            destroy_nodes_parallel_impl(node->left, alloc, pool, cutoff,
+                                        depth - 1);
+        },
+        [&]() {
+            destroy_nodes_parallel_impl(node->right, alloc, pool, cutoff,
+                                        depth - 1);
+        });
+    delete_node_impl(alloc, node);
 }
 
   // EFFECTS : Searches the tree rooted at 'node' for an element equivalent
   //           to 'query'. If one is found, returns a pointer to the node
   //           containing it. If the tree is empty or the element is not
   //           found, returns a null pointer.
-  //
-  // NOTE: This function must be tail recursive.
-  // HINT: Equivalence is defined according to the Compare functor
-  //       associated with this instantiation of the BinarySearchTree
-  //       template, NOT according to the == operator. Use the "less"
-  //       parameter to compare elements.
-  //       Two elements A and B are equivalent if and only if A is
-  //       not less than B and B is not less than A.
-static Node * find_impl(Node *node, const T &query, Compare less) {
+  // NOTE: Equivalence is defined by 'less', not by the == operator: two
+  //       elements A and B are equivalent if and only if A is not less
+  //       than B and B is not less than A. 'query' may be of any type
+  //       that 'less' can compare against T. Each level costs at most
+  //       two comparisons.
+template <typename Key>
+static Node * find_impl(Node *node, const Key &query, const Compare &less) {
     while (node != nullptr) {
-        if (!less(node->datum, query) && !less(query, node->datum)) {
-            // Found an element equivalent to query
-            return node;
-        } else if (less(node->datum, query)) {
+        INSTRUMENT_NODE();
+        if (INSTRUMENT_COMPARE(less(query, node->datum))) {
+            // If node->datum > query, search in the left subtree
+            node = node->left;
+        } else if (INSTRUMENT_COMPARE(less(node->datum, query))) {
             // If node->datum < query, search in the right subtree
             node = node->right;
         } else {
-            // If node->datum > query, search in the left subtree
-            node = node->left;
+            // Found an element equivalent to query
+            return node;
         }
     }
     // Element equivalent to query not found
     return nullptr;
 }
 
-  // REQUIRES: item is not already contained in the tree rooted at 'node'
-  // MODIFIES: the tree rooted at 'node'
-  // EFFECTS : If 'node' represents an empty tree, allocates a new
-  //           Node to represent a single-element tree with 'item' as
-  //           its only element and returns a pointer to the new Node.
-  //           If the tree rooted at 'node' is not empty, inserts
-  //           'item' into the proper location as a leaf in the
-  //           existing tree structure according to the sorting
-  //           invariant and returns the original parameter 'node'.
-  // NOTE: This function must be linear recursive, but does not
-  //       need to be tail recursive.
-  // HINT: Element ordering is defined according to the Compare functor
-  //       associated with this instantiation of the BinarySearchTree
-  //       template, NOT according to the < operator. Use the "less"
-  //       parameter to compare elements.
-static Node * insert_impl(Node *node, const T &item, Compare less) {
-    if (node == nullptr) {
-        // If 'node' represents an empty tree, create a new node with 'item' and return it
-        return new Node(item, nullptr, nullptr);
+  // MODIFIES: parent, go_left
+  // EFFECTS : Searches the tree rooted at 'node' for an element
+  //           equivalent to 'key'. If one is found, returns a pointer to
+  //           the node containing it. Otherwise returns a null pointer
+  //           and sets 'parent' and 'go_left' to the position where an
+  //           element equivalent to 'key' would be linked in as a leaf
+  //           according to the sorting invariant ('parent' stays null
+  //           for an empty tree).
+  // NOTE: This is the single descent shared by every insertion.
+template <typename Key>
+static Node * find_slot_impl(Node *node, const Key &key, const Compare &less,
+                             Node *&parent, bool &go_left) {
+    while (node != nullptr) {
+        parent = node;
+        INSTRUMENT_NODE();
+        if (INSTRUMENT_COMPARE(less(key, node->datum))) {
+            // If 'key' is less than the datum of the current node, continue into the left subtree
+            go_left = true;
+            node = node->left;
+        } else if (INSTRUMENT_COMPARE(less(node->datum, key))) {
+            // If 'key' is greater than the datum of the current node, continue into the right subtree
+            go_left = false;
+            node = node->right;
+        } else {
+            // An equivalent element is already here
+            return node;
+        }
     }
+    return nullptr;
+}
 
-    if (less(item, node->datum)) {
-        // If 'item' is less than the datum of the current node, insert it into the left subtree
-        node->left = insert_impl(node->left, item, less);
+  // REQUIRES: 'hint' is a node of the tree
+  // MODIFIES: parent, go_left
+  // EFFECTS : Same as find_slot_impl on the whole tree, but starts from
+  //           'hint'. Say 'key' is greater than the datum of 'hint'. If
+  //           it is also less than the successor of 'hint' (or there is
+  //           none), its place is the free slot between the two: the
+  //           right child of 'hint', or else the left child of the
+  //           successor. If it is equivalent to the successor, that node
+  //           is returned. Otherwise its place is in the right subtree
+  //           of the greatest element known to be less than 'key'
+  //           ('bound', at first 'hint'), unless an ancestor of 'bound'
+  //           that is greater than 'bound' is not greater than 'key'.
+  //           Those ancestors are the ones whose left subtree holds
+  //           'bound'; this climbs through them until one is greater
+  //           than 'key', then descends from 'bound'. The other case is
+  //           the mirror image.
+  // NOTE: A 'key' between 'hint' and its neighbour, or equivalent to
+  //       the neighbour, takes at most three comparisons. Reaching the
+  //       neighbour still follows up to O(log n) pointers, as the
+  //       Iterator operators do.
+template <typename Key>
+static Node * find_slot_near_impl(Node *hint, const Key &key,
+                                  const Compare &less, Node *&parent,
+                                  bool &go_left) {
+    INSTRUMENT_NODE();
+    bool after = INSTRUMENT_COMPARE(less(hint->datum, key));
+    if (!after && !INSTRUMENT_COMPARE(less(key, hint->datum))) {
+        return hint;
+    }
+    Node *inner = after ? hint->right : hint->left;
+    Node *neighbour;
+    if (inner) {
+        neighbour = after ? min_element_impl(inner) : max_element_impl(inner);
     } else {
-        // If 'item' is greater than or equal to the datum of the current node, insert it into the right subtree
-        node->right = insert_impl(node->right, item, less);
+        neighbour = after ? next_ancestor_impl(hint) : prev_ancestor_impl(hint);
     }
+    if (neighbour == nullptr
+        || INSTRUMENT_COMPARE(after ? less(key, neighbour->datum)
+                                    : less(neighbour->datum, key))) {
+        // 'hint' and 'neighbour' are adjacent, so one of them has a free
+        // child slot facing the other
+        parent = inner ? neighbour : hint;
+        go_left = inner ? after : !after;
+        return nullptr;
+    }
+    if (!INSTRUMENT_COMPARE(after ? less(neighbour->datum, key)
+                                  : less(key, neighbour->datum))) {
+        return neighbour; // equivalent to 'key'
+    }
+    Node *bound = hint;
+    for (Node *node = hint; node->parent != nullptr; node = node->parent) {
+        Node *up = node->parent;
+        INSTRUMENT_NODE();
+        if ((up->left == node) != after) {
+            continue; // 'up' is on the near side of 'bound' already
+        }
+        if (INSTRUMENT_COMPARE(after ? less(key, up->datum)
+                                     : less(up->datum, key))) {
+            break; // 'up' is beyond 'key'
+        }
+        if (!INSTRUMENT_COMPARE(after ? less(up->datum, key)
+                                      : less(key, up->datum))) {
+            return up; // equivalent to 'key'
+        }
+        bound = up;
+    }
+    parent = bound;
+    go_left = !after;
+    return find_slot_impl(after ? bound->right : bound->left, key, less,
+                          parent, go_left);
+}
+
+  // EFFECTS: Returns the cached height of 'node', or 0 for an empty tree.
+static int node_height(const Node *node) {
+    return node == nullptr ? 0 : node->height;
+}
 
-    // Return the modified node
+  // EFFECTS: Returns the cached size of 'node', or 0 for an empty tree.
+static size_t node_size(const Node *node) {
+    return node == nullptr ? 0 : node->size;
+}
+
+  // MODIFIES: node
+  // EFFECTS : Recomputes the cached height and size of 'node' from its
+  //           children.
+static void update_impl(Node *node) {
+    node->height = 1 + std::max(node_height(node->left),
+                                node_height(node->right));
+    node->size = 1 + node_size(node->left) + node_size(node->right);
+}
+
+  // REQUIRES: node->right is not null
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Rotates the tree rooted at 'node' to the left and returns
+  //           its new root (the former right child). In-order sequence
+  //           is unchanged. The new root inherits the parent of 'node'.
+static Node * rotate_left_impl(Node *node) {
+    Node *pivot = node->right;
+    node->right = pivot->left;
+    if (node->right) {
+        node->right->parent = node;
+    }
+    pivot->left = node;
+    pivot->parent = node->parent;
+    node->parent = pivot;
+    update_impl(node);
+    update_impl(pivot);
+    return pivot;
+}
+
+  // REQUIRES: node->left is not null
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Mirror image of rotate_left_impl.
+static Node * rotate_right_impl(Node *node) {
+    Node *pivot = node->left;
+    node->left = pivot->right;
+    if (node->left) {
+        node->left->parent = node;
+    }
+    pivot->right = node;
+    pivot->parent = node->parent;
+    node->parent = pivot;
+    update_impl(node);
+    update_impl(pivot);
+    return pivot;
+}
+
+  // REQUIRES: the subtrees of 'node' satisfy the invariants
+  // MODIFIES: node
+  // EFFECTS : Unbalanced_tree only updates the cached height and size of
+  //           'node'.
+static Node * rebalance_impl(Node *node, Unbalanced_tree) {
+    update_impl(node);
+    return node;
+}
+
+  // MODIFIES: node
+  // EFFECTS : Splay_tree restructures on access instead (see
+  //           splay_impl), so it too only updates 'node'.
+static Node * rebalance_impl(Node *node, Splay_tree) {
+    update_impl(node);
+    return node;
+}
+
+  // REQUIRES: node->parent is not null
+  // MODIFIES: the tree containing 'node'
+  // EFFECTS : Rotates 'node' above its parent, keeping the link from its
+  //           former grandparent (if any) pointing to it.
+static void rotate_up_impl(Node *node) {
+    Node *parent = node->parent;
+    Node *grandparent = parent->parent;
+    Node *top = parent->left == node ? rotate_right_impl(parent)
+                                     : rotate_left_impl(parent);
+    if (grandparent != nullptr) {
+        if (grandparent->left == parent) {
+            grandparent->left = top;
+        } else {
+            grandparent->right = top;
+        }
+    }
+}
+
+  // MODIFIES: the tree containing 'node'
+  // EFFECTS : Moves 'node' to the root of its tree by splaying, and
+  //           returns it. Each step rotates 'node' up two levels: when
+  //           'node' and its parent are both left (or both right)
+  //           children, the parent is rotated first (zig-zig), which
+  //           roughly halves the depth of every node on the path;
+  //           otherwise 'node' is rotated twice (zig-zag). A single
+  //           rotation finishes when the parent is the root. Every node
+  //           on the path is rotated, so the cached heights and sizes
+  //           stay correct.
+static Node * splay_impl(Node *node) {
+    while (node->parent != nullptr) {
+        Node *parent = node->parent;
+        Node *grandparent = parent->parent;
+        if (grandparent == nullptr) {
+            rotate_up_impl(node);
+        } else if ((grandparent->left == parent) == (parent->left == node)) {
+            rotate_up_impl(parent);
+            rotate_up_impl(node);
+        } else {
+            rotate_up_impl(node);
+            rotate_up_impl(node);
+        }
+    }
     return node;
 }
 
+  // REQUIRES: the subtrees of 'node' are AVL trees whose heights differ
+  //           by at most two
+  // MODIFIES: the tree rooted at 'node'
+  // EFFECTS : Performs at most two rotations so that the tree rooted at
+  //           'node' is an AVL tree, and returns its new root.
+static Node * rebalance_impl(Node *node, AVL_tree) {
+    update_impl(node);
+    int balance = node_height(node->left) - node_height(node->right);
+    if (balance > 1) {
+        // Left-heavy; a left-right shape needs a double rotation
+        if (node_height(node->left->left) < node_height(node->left->right)) {
+            node->left = rotate_left_impl(node->left);
+            node->left->parent = node;
+        }
+        return rotate_right_impl(node);
+    }
+    if (balance < -1) {
+        // Right-heavy; a right-left shape needs a double rotation
+        if (node_height(node->right->right) < node_height(node->right->left)) {
+            node->right = rotate_right_impl(node->right);
+            node->right->parent = node;
+        }
+        return rotate_left_impl(node);
+    }
+    return node;
+}
+
+  // EFFECTS: Returns whether every cached height and size in the tree
+  //          rooted at 'node' is correct and, for AVL_tree, whether every
+  //          node is balanced.
+  // NOTE:    This checks each node once, against the values cached in
+  //          its children. If every node passes, then by induction from
+  //          the leaves up every cached value is correct, so this gives
+  //          the same answer as recomputing heights and sizes bottom-up,
+  //          in linear time.
+template <typename Policy>
+static bool check_balance_invariant_impl(const Node *node, Policy policy) {
+    return all_nodes_impl(node, [policy](const Node *n) {
+        return node_balanced_impl(n, policy);
+    });
+}
+
+  // EFFECTS: Same as check_balance_invariant_impl, but while the tree has
+  //          more than 'cutoff' nodes and fewer than 'depth' levels have
+  //          been split, checks 'node' itself and then its two subtrees
+  //          at once. Every node gets the same check either way.
+template <typename Policy>
+static bool check_balance_parallel_impl(const Node *node, Policy policy,
+                                        ThreadPool &pool, size_t cutoff,
+                                        int depth = max_parallel_depth) {
+    if (node == nullptr || node->size <= cutoff || depth == 0) {
+        return check_balance_invariant_impl(node, policy);
+    }
+    if (!node_balanced_impl(node, policy)) {
+        return false;
+    }
+    bool left_ok = false;
+    bool right_ok = false;
+    pool.parallel_invoke(
+        [&]() {
+            left_ok = check_balance_parallel_impl(node->left, policy, pool,
+                                                  cutoff, depth - 1);
+        },
+        [&]() {
+            right_ok = check_balance_parallel_impl(node->right, policy, pool,
+                                                   cutoff, depth - 1);
+        });
+    return left_ok && right_ok;
+}
+
+  // EFFECTS: Returns whether the cached height and size of 'node' are one
+  //          more than the larger height and the sum of the sizes cached
+  //          in its children, and whether 'node' is balanced under the
+  //          given policy.
+template <typename Policy>
+static bool node_balanced_impl(const Node *node, Policy policy) {
+    int left_height = node_height(node->left);
+    int right_height = node_height(node->right);
+    return node->height == 1 + std::max(left_height, right_height) &&
+           node->size == 1 + node_size(node->left) + node_size(node->right) &&
+           balanced_impl(left_height - right_height, policy);
+}
+
+  // EFFECTS: Returns whether a node whose subtrees differ in height by
+  //          'balance' is balanced under the given policy; only an
+  //          AVL_tree restricts it.
+template <typename Policy>
+static bool balanced_impl(int, Policy) {
+    return true;
+}
+
+static bool balanced_impl(int balance, AVL_tree) {
+    return balance >= -1 && balance <= 1;
+}
+
+  // EFFECTS: Returns whether check(n) is true for every node n of the
+  //          tree rooted at 'node', stopping at the first for which it
+  //          is false.
+  // NOTE:    The subtrees still to be checked are kept on an explicit
+  //          stack, so this neither recurses nor trusts the parent links
+  //          of a tree that may be broken.
+template <typename Check>
+static bool all_nodes_impl(const Node *node, Check check) {
+    std::vector<const Node *> pending;
+    if (node != nullptr) {
+        pending.push_back(node);
+    }
+    while (!pending.empty()) {
+        node = pending.back();
+        pending.pop_back();
+        if (!check(node)) {
+            return false;
+        }
+        if (node->right != nullptr) {
+            pending.push_back(node->right);
+        }
+        if (node->left != nullptr) {
+            pending.push_back(node->left);
+        }
+    }
+    return true;
+}
+
   // EFFECTS : Returns a pointer to the Node containing the minimum element
   //           in the tree rooted at 'node' or a null pointer if the tree is empty.
-  // NOTE: This function must be tail recursive.
-  // NOTE: This function is used in the implementation of the ++ operator for
-  //       the iterator code that is provided for you.
-  // HINT: You don't need to compare any elements! Think about the
-  //       structure, and where the smallest element lives.
+  // NOTE: This function loops rather than recursing, as the leftmost
+  //       path can hold every node of the tree.
+  // NOTE: Iterator::operator++ uses this to step into a right subtree.
 static Node * min_element_impl(Node *node) {
     if (node == nullptr) {
         // If the tree is empty, return nullptr
         return nullptr;
     }
-
-    if (node->left == nullptr) {
-        // If the left subtree is empty, 'node' itself contains the minimum element
-        return node;
+    INSTRUMENT_NODE();
+    // The minimum is at the end of the leftmost path
+    while (node->left != nullptr) {
+        node = node->left;
+        INSTRUMENT_NODE();
     }
-
-    // Recursively search for the minimum element in the left subtree
-    return min_element_impl(node->left);
+    return node;
 }
 
   // EFFECTS : Returns a pointer to the Node containing the maximum element
   //           in the tree rooted at 'node' or a null pointer if the tree is empty.
-  // NOTE: This function must be tail recursive.
-  // HINT: You don't need to compare any elements! Think about the
-  //       structure, and where the largest element lives.
+  // NOTE: This function loops rather than recursing, as the rightmost
+  //       path can hold every node of the tree.
 static Node * max_element_impl(Node *node) {
     if (node == nullptr) {
         // If the tree is empty, return nullptr
         return nullptr;
     }
+    // The maximum is at the end of the rightmost path
+    while (node->right != nullptr) {
+        node = node->right;
+    }
+    return node;
+}
 
-    if (node->right == nullptr) {
-        // If the right subtree is empty, 'node' itself contains the maximum element
-        return node;
+  // EFFECTS : Returns a pointer to the nearest ancestor of 'node' whose
+  //           left subtree contains 'node', or a null pointer if 'node' is
+  //           on the rightmost path of the tree. When 'node' has no right
+  //           child, this is its in-order successor.
+  // NOTE: This function loops rather than recursing.
+static Node * next_ancestor_impl(const Node *node) {
+    INSTRUMENT_NODE();
+    Node *parent = node->parent;
+    while (parent != nullptr && parent->right == node) {
+        node = parent;
+        parent = node->parent;
+        INSTRUMENT_NODE();
     }
+    return parent;
+}
 
-    // Recursively search for the maximum element in the right subtree
-    return max_element_impl(node->right);
+  // EFFECTS : Returns a pointer to the nearest ancestor of 'node' whose
+  //           right subtree contains 'node', or a null pointer if 'node' is
+  //           on the leftmost path of the tree. When 'node' has no left
+  //           child, this is its in-order predecessor.
+  // NOTE: This function loops rather than recursing.
+static Node * prev_ancestor_impl(const Node *node) {
+    Node *parent = node->parent;
+    while (parent != nullptr && parent->left == node) {
+        node = parent;
+        parent = node->parent;
+    }
+    return parent;
 }
 
   // EFFECTS: Returns whether the sorting invariant holds on the tree
   //          rooted at 'node'.
-  // NOTE:    This function must be tree recursive.
- static bool check_sorting_invariant_impl(const Node *node, Compare less) {
-    if (node == nullptr) {
-        // An empty subtree trivially satisfies the sorting invariant
-        return true;
-    }
-    // Check the sorting invariant for the left subtree
-    if (node->left != nullptr && less(node->datum, node->left->datum)) {
-        return false;
+static bool check_sorting_invariant_impl(const Node *node, Compare less) {
+    return all_nodes_impl(node, [&less](const Node *n) {
+        return node_sorted_impl(n, less);
+    });
+}
+
+  // EFFECTS: Returns whether neither child of 'node' is out of order
+  //          with it.
+static bool node_sorted_impl(const Node *node, const Compare &less) {
+    return (node->left == nullptr || !less(node->datum, node->left->datum)) &&
+           (node->right == nullptr || !less(node->right->datum, node->datum));
+}
+
+  // EFFECTS: Same as check_sorting_invariant_impl, but while the tree
+  //          has more than 'cutoff' nodes and fewer than 'depth' levels
+  //          have been split, checks the two subtrees at once.
+static bool check_sorting_parallel_impl(const Node *node, Compare less,
+                                        ThreadPool &pool, size_t cutoff,
+                                        int depth = max_parallel_depth) {
+    if (node == nullptr || node->size <= cutoff || depth == 0) {
+        return check_sorting_invariant_impl(node, less);
     }
-    // Check the sorting invariant for the right subtree
-    if (node->right != nullptr && less(node->right->datum, node->datum)) {
+    if (!node_sorted_impl(node, less)) {
         return false;
     }
-    // Recursively check the sorting invariant for the left and right subtrees
-    return check_sorting_invariant_impl(node->left, less) &&
-           check_sorting_invariant_impl(node->right, less);
+    bool left_ok = false;
+    bool right_ok = false;
+    pool.parallel_invoke(
+        [&]() {
+            left_ok = check_sorting_parallel_impl(node->left, less, pool,
+                                                  cutoff, depth - 1);
+        },
+        [&]() {
+            right_ok = check_sorting_parallel_impl(node->right, less, pool,
+                                                   cutoff, depth - 1);
+        });
+    return left_ok && right_ok;
 }
 
   // EFFECTS : Traverses the tree rooted at 'node' using an in-order traversal,
   //           printing each element to os in turn. Each element is followed
   //           by a space (there will be an "extra" space at the end).
   //           If the tree is empty, nothing is printed.
-  // NOTE: This function must be tree recursive.
-  //       See https://en.wikipedia.org/wiki/Tree_traversal#In-order
+  // NOTE: See https://en.wikipedia.org/wiki/Tree_traversal#In-order
   //       for the definition of a in-order traversal.
-static void traverse_inorder_impl(const Node *node, std::ostream &os) {
-    if (node == nullptr) {
-        // Base case: if the node is null, return without printing anything
-        return;
-    }
-    // Recursively traverse the left subtree
-    traverse_inorder_impl(node->left, os);
-
-    // Print the current node's datum followed by a space
-    os << node->datum << " ";
-
-    // Recursively traverse the right subtree
-    traverse_inorder_impl(node->right, os);
+static void traverse_inorder_impl(Node *node, std::ostream &os) {
+    auto print = [&os](const T &datum) { os << datum << " "; };
+    for_each_inorder_impl(node, print);
 }
 
   // EFFECTS : Traverses the tree rooted at 'node' using a pre-order traversal,
   //           printing each element to os in turn. Each element is followed
   //           by a space (there will be an "extra" space at the end).
   //           If the tree is empty, nothing is printed.
-  // NOTE: This function must be tree recursive.
-  //       See https://en.wikipedia.org/wiki/Tree_traversal#Pre-order
+  // NOTE: See https://en.wikipedia.org/wiki/Tree_traversal#Pre-order
   //       for the definition of a pre-order traversal.
- static void traverse_preorder_impl(const Node *node, std::ostream &os) {
-    if (node == nullptr) {
-        // Base case: if the node is null, return without printing anything
-        return;
+static void traverse_preorder_impl(Node *node, std::ostream &os) {
+    auto print = [&os](const T &datum) { os << datum << " "; };
+    for_each_preorder_impl(node, print);
+}
+
+  // EFFECTS : Calls visit on the element of every node in the tree
+  //           rooted at 'node', in order.
+  // NOTE:     This walks the parent links rather than recursing, so it
+  //           needs constant stack space however tall the tree is.
+  template <typename Visit>
+  static void for_each_inorder_impl(Node *node, Visit &visit) {
+    const Node *top = node;
+    for (node = min_element_impl(node); node != nullptr;
+         node = next_inorder_impl(node, top)) {
+      visit(node->datum);
     }
+  }
 
-    // Print the current node's datum followed by a space
-    os << node->datum << " ";
+  // MODIFIES: stats, total_comparisons
+  // EFFECTS : Counts every node in the tree rooted at 'node' in the depth
+  //           histogram, and adds the comparisons find() makes to reach
+  //           each to total_comparisons.
+  // NOTE:     The subtrees still to be counted are kept on an explicit
+  //           stack of frames rather than the call stack, since a tree
+  //           can be as tall as it is large.
+  static void stats_impl(const Node *node, Tree_stats &stats,
+                         size_t &total_comparisons) {
+    struct Frame {
+      const Node *node;
+      size_t depth;       // of node, counting the root as 1
+      size_t comparisons; // made by find() at the ancestors of node
+    };
+    std::vector<Frame> pending;
+    if (node != nullptr) {
+      pending.push_back({ node, 1, 0 });
+    }
+    while (!pending.empty()) {
+      Frame frame = pending.back();
+      pending.pop_back();
+      if (stats.depth_histogram.size() < frame.depth) {
+        stats.depth_histogram.resize(frame.depth);
+      }
+      ++stats.depth_histogram[frame.depth - 1];
+      total_comparisons += frame.comparisons + 2;
+      if (frame.node->right != nullptr) {
+        pending.push_back({ frame.node->right, frame.depth + 1,
+                            frame.comparisons + 2 });
+      }
+      if (frame.node->left != nullptr) {
+        pending.push_back({ frame.node->left, frame.depth + 1,
+                            frame.comparisons + 1 });
+      }
+    }
+  }
 
-    // Recursively traverse the left subtree
-    traverse_preorder_impl(node->left, os);
+  // EFFECTS : Calls visit on the element of every node in the tree
+  //           rooted at 'node', in pre-order.
+  // NOTE:     Like for_each_inorder_impl, this walks the parent links:
+  //           after a node with no children, it climbs to the nearest
+  //           ancestor reached from the left that has a right child.
+  template <typename Visit>
+  static void for_each_preorder_impl(Node *node, Visit &visit) {
+    const Node *top = node;
+    while (node != nullptr) {
+      visit(node->datum);
+      if (node->left != nullptr) {
+        node = node->left;
+      } else if (node->right != nullptr) {
+        node = node->right;
+      } else {
+        while (node != top && (node->parent->right == node ||
+                               node->parent->right == nullptr)) {
+          node = node->parent;
+        }
+        node = node == top ? nullptr : node->parent->right;
+      }
+    }
+  }
 
-    // Recursively traverse the right subtree
-    traverse_preorder_impl(node->right, os);
-}
+  // MODIFIES: pieces, joints
+  // EFFECTS : Cuts the tree rooted at 'node' into subtrees of at most
+  //           grain nodes, appending their roots to pieces, and appends
+  //           the nodes above the cuts to joints.
+  // NOTE:     The subtrees still to be cut are kept on an explicit stack
+  //           rather than the call stack.
+  static void split_impl(Node *node, size_t grain, std::vector<Node *> &pieces,
+                         std::vector<Node *> &joints) {
+    std::vector<Node *> pending{node};
+    while (!pending.empty()) {
+      node = pending.back();
+      pending.pop_back();
+      if (node == nullptr) {
+        continue;
+      }
+      if (node->size <= grain) {
+        pieces.push_back(node);
+        continue;
+      }
+      joints.push_back(node);
+      pending.push_back(node->right);
+      pending.push_back(node->left);
+    }
+  }
 
   // EFFECTS : Returns a pointer to the Node containing the smallest element
   //           in the tree rooted at 'node' that is greater than 'val'.
   //           Returns a null pointer if the tree is empty or if it does not
   //           contain any elements that are greater than 'val'.
   //
-  // NOTE: This function must be linear recursive.
-  // NOTE: This function is used in the implementation of the ++ operator for
-  //       the iterator code that is provided for you.
-  // HINT: At each step, compare 'val' the the current node (using the
-  //       'less' parameter). Based on the result, you gain some information
-  //       about where the element you're looking for could be.
-
+  // NOTE: This is upper_bound_impl starting with no candidate.
 static Node *min_greater_than_impl(Node *node, const T &val, Compare less) {
-    if (node == nullptr) {
-        // Base case: if the tree is empty or we reach a leaf node,
-        // return nullptr since there are no elements greater than 'val'
-        return nullptr;
+    return upper_bound_impl(node, val, less, nullptr);
+}
+
+  // EFFECTS : Returns a pointer to the Node containing the smallest element
+  //           in the tree rooted at 'node' that is not less than 'query',
+  //           or 'candidate' if there is none.
+  // NOTE: This function loops rather than recursing.
+template <typename Key>
+static Node *lower_bound_impl(Node *node, const Key &query,
+                              const Compare &less, Node *candidate) {
+    while (node != nullptr) {
+        if (less(node->datum, query)) {
+            // The node and its left subtree are all too small
+            node = node->right;
+        } else {
+            // The node qualifies; a smaller answer can only be to its left
+            candidate = node;
+            node = node->left;
+        }
     }
+    return candidate;
+}
 
-    if (less(val, node->datum)) {
-        // If the current node's datum is greater than 'val',
-        // we might have found a candidate node that is greater than 'val'
-        // Check the left subtree for a smaller candidate
-        Node *left_candidate = min_greater_than_impl(node->left, val, less);
-        if (left_candidate != nullptr) {
-            // If we found a candidate in the left subtree,
-            // return it as the smallest element greater than 'val'
-            return left_candidate;
+  // EFFECTS : Returns a pointer to the Node containing the smallest element
+  //           in the tree rooted at 'node' that is greater than 'query',
+  //           or 'candidate' if there is none.
+  // NOTE: This function loops rather than recursing.
+template <typename Key>
+static Node *upper_bound_impl(Node *node, const Key &query,
+                              const Compare &less, Node *candidate) {
+    while (node != nullptr) {
+        if (less(query, node->datum)) {
+            // The node qualifies; a smaller answer can only be to its left
+            candidate = node;
+            node = node->left;
+        } else {
+            // The node and its left subtree are all too small
+            node = node->right;
+        }
+    }
+    return candidate;
+}
+
+  // EFFECTS : Returns 'count' plus the number of elements in the tree
+  //           rooted at 'node' that are less than 'val'.
+  // NOTE: This function loops rather than recursing.
+static size_t rank_impl(const Node *node, const T &val, Compare less,
+                        size_t count) {
+    while (node != nullptr) {
+        if (less(node->datum, val)) {
+            // The node and its whole left subtree are less than 'val'
+            count += node_size(node->left) + 1;
+            node = node->right;
+        } else {
+            node = node->left;
         }
-        // If no candidate found in the left subtree, the current node
-        // itself could be the smallest element greater than 'val'
-        return node;
-    } else {
-        // If the current node's datum is not greater than 'val',
-        // the candidate node must be in the right subtree
-        return min_greater_than_impl(node->right, val, less);
     }
+    return count;
+}
+
+  // EFFECTS : Returns a pointer to the Node at zero-based position k in
+  //           the in-order sequence of the tree rooted at 'node', or a
+  //           null pointer if k is not less than the size of the tree.
+  // NOTE: This function loops rather than recursing.
+static Node * select_impl(Node *node, size_t k) {
+    while (node != nullptr) {
+        size_t left_size = node_size(node->left);
+        if (k == left_size) {
+            return node;
+        }
+        if (k < left_size) {
+            node = node->left;
+        } else {
+            k -= left_size + 1;
+            node = node->right;
+        }
+    }
+    return nullptr;
 }
 
 
@@ -614,13 +2269,13 @@ static Node *min_greater_than_impl(Node *node, const T &val, Compare less) {
 // EXAMPLES: [ ]
 //           [ 5 ]
 //           [ 3 5 7 ]
-// NOTE:     The correct operation of this function depends on the
-//           BinarySearchTree Iterator, which in turn depends on some
-//           of the functions you must write.
+// NOTE:     This iterates over the tree, so it relies on the
+//           BinarySearchTree Iterator.
 
-template <typename T, typename Compare>
-std::ostream &operator<<(std::ostream &os,
-                         const BinarySearchTree<T, Compare> &tree) {
+template <typename T, typename Compare, typename Balance, typename Allocator>
+std::ostream &operator<<(
+    std::ostream &os,
+    const BinarySearchTree<T, Compare, Balance, Allocator> &tree) {
 // DO NOT CHANGE THE IMPLEMENTATION OF THIS FUNCTION
   os << "[ ";
   for (T& elt : tree) {
@@ -1,5 +1,10 @@
 #include "BinarySearchTree.hpp"
+#include "Arena.hpp"
 #include "unit_test_framework.hpp"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
 
 TEST(test_empty_tree) {
     BinarySearchTree<int> tree;
@@ -430,4 +435,1052 @@ TEST(test_string_data_type) {
     ASSERT_EQUAL(ss.str(), "apple banana grape orange ");
 }
 
+TEST(test_avl_sorted_insert_height) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    // Sorted input degenerates an unbalanced tree into a list
+    for (int i = 1; i <= 15; ++i) {
+        tree.insert(i);
+    }
+    ASSERT_EQUAL(tree.size(), 15);
+    ASSERT_EQUAL(tree.height(), 4); // perfectly balanced
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_TRUE(tree.check_balance_invariant());
+
+    std::stringstream ss;
+    tree.traverse_inorder(ss);
+    ASSERT_EQUAL(ss.str(), "1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 ");
+}
+
+TEST(test_avl_large_sorted_and_reverse) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> ascending;
+    BinarySearchTree<int, std::less<int>, AVL_tree> descending;
+    for (int i = 0; i < 10000; ++i) {
+        ascending.insert(i);
+        descending.insert(10000 - i);
+    }
+    // 1.44 * log2(10002) is about 19.1
+    ASSERT_TRUE(ascending.height() <= 19);
+    ASSERT_TRUE(descending.height() <= 19);
+    ASSERT_TRUE(ascending.check_balance_invariant());
+    ASSERT_TRUE(descending.check_balance_invariant());
+    ASSERT_EQUAL(*ascending.min_element(), 0);
+    ASSERT_EQUAL(*descending.max_element(), 10000);
+}
+
+TEST(test_avl_double_rotations) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    // Zig-zag insertion orders exercise the left-right and right-left cases
+    tree.insert(30);
+    tree.insert(10);
+    tree.insert(20);
+    tree.insert(50);
+    tree.insert(40);
+    ASSERT_EQUAL(tree.height(), 3);
+    ASSERT_TRUE(tree.check_balance_invariant());
+
+    std::stringstream ss;
+    tree.traverse_preorder(ss);
+    ASSERT_EQUAL(ss.str(), "20 10 40 30 50 ");
+
+    std::vector<int> elements;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        elements.push_back(*it);
+    }
+    std::vector<int> expected{10, 20, 30, 40, 50};
+    ASSERT_EQUAL(elements, expected);
+}
+
+TEST(test_avl_copy_preserves_shape) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i);
+    }
+    BinarySearchTree<int, std::less<int>, AVL_tree> copy_tree(tree);
+    ASSERT_EQUAL(copy_tree.height(), tree.height());
+    ASSERT_TRUE(copy_tree.check_balance_invariant());
+    copy_tree.insert(100);
+    ASSERT_TRUE(copy_tree.check_balance_invariant());
+}
+
+TEST(test_unbalanced_cached_height) {
+    BinarySearchTree<int> tree;
+    tree.insert(10);
+    tree.insert(5);
+    tree.insert(3);
+    tree.insert(15);
+    ASSERT_EQUAL(tree.height(), 3);
+    ASSERT_TRUE(tree.check_balance_invariant());
+}
+
+TEST(test_iterator_full_traversal_after_rotations) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> balanced;
+    BinarySearchTree<int> degenerate;
+    for (int i = 0; i < 5000; ++i) {
+        balanced.insert((i * 7919) % 5000); // permutation of 0..4999
+        degenerate.insert(5000 - i);
+    }
+
+    int expected = 0;
+    for (auto it = balanced.begin(); it != balanced.end(); ++it) {
+        ASSERT_EQUAL(*it, expected);
+        ++expected;
+    }
+    ASSERT_EQUAL(expected, 5000);
+
+    expected = 1;
+    for (int elt : degenerate) {
+        ASSERT_EQUAL(elt, expected);
+        ++expected;
+    }
+    ASSERT_EQUAL(expected, 5001);
+}
+
+TEST(test_iterator_from_copied_tree) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    for (int i = 0; i < 10; ++i) {
+        tree.insert(i);
+    }
+    BinarySearchTree<int, std::less<int>, AVL_tree> copy_tree(tree);
+    auto it = copy_tree.find(4);
+    ++it;
+    ASSERT_EQUAL(*it, 5);
+    it = copy_tree.max_element();
+    ++it;
+    ASSERT_EQUAL(it, copy_tree.end());
+}
+
+TEST(test_rank_and_select) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i * 10); // 0, 10, ..., 990
+    }
+    ASSERT_EQUAL(tree.size(), 100);
+    ASSERT_EQUAL(tree.rank(0), 0);
+    ASSERT_EQUAL(tree.rank(500), 50);
+    ASSERT_EQUAL(tree.rank(505), 51); // not in the tree
+    ASSERT_EQUAL(tree.rank(-1), 0);
+    ASSERT_EQUAL(tree.rank(10000), 100);
+
+    ASSERT_EQUAL(*tree.select(0), 0);
+    ASSERT_EQUAL(*tree.select(37), 370);
+    ASSERT_EQUAL(*tree.select(99), 990);
+    ASSERT_EQUAL(tree.select(100), tree.end());
+
+    for (size_t k = 0; k < tree.size(); ++k) {
+        ASSERT_EQUAL(tree.rank(*tree.select(k)), k);
+    }
+}
+
+TEST(test_rank_select_empty_and_unbalanced) {
+    BinarySearchTree<int> tree;
+    ASSERT_EQUAL(tree.rank(3), 0);
+    ASSERT_EQUAL(tree.select(0), tree.end());
+
+    tree.insert(5);
+    tree.insert(3);
+    tree.insert(8);
+    tree.insert(4);
+    ASSERT_EQUAL(tree.size(), 4);
+    ASSERT_EQUAL(*tree.select(1), 4);
+    ASSERT_EQUAL(tree.rank(8), 3);
+    ASSERT_TRUE(tree.check_balance_invariant());
+}
+
+TEST(test_insert_unique) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    auto first = tree.insert_unique(10);
+    ASSERT_TRUE(first.second);
+    ASSERT_EQUAL(*first.first, 10);
+
+    tree.insert_unique(5);
+    tree.insert_unique(15);
+    auto again = tree.insert_unique(5);
+    ASSERT_FALSE(again.second);
+    ASSERT_EQUAL(again.first, tree.find(5));
+    ASSERT_EQUAL(tree.size(), 3);
+    ASSERT_TRUE(tree.check_balance_invariant());
+}
+
+TEST(test_arena_allocator) {
+    using Arena_tree =
+        BinarySearchTree<int, std::less<int>, AVL_tree, Arena_allocator<int>>;
+    Arena_tree tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i);
+    }
+    ASSERT_EQUAL(tree.size(), 1000);
+    ASSERT_TRUE(tree.check_balance_invariant());
+    // One arena allocation per node, from a handful of large blocks
+    ASSERT_EQUAL(tree.get_allocator().get_arena().allocation_count(), 1000);
+
+    // A copy gets an arena of its own
+    Arena_tree copy_tree(tree);
+    ASSERT_TRUE(copy_tree.get_allocator() != tree.get_allocator());
+    ASSERT_EQUAL(copy_tree.get_allocator().get_arena().allocation_count(), 1000);
+    ASSERT_EQUAL(*copy_tree.select(500), 500);
+
+    copy_tree = Arena_tree();
+    ASSERT_TRUE(copy_tree.empty());
+}
+
+TEST(test_arena_allocator_nontrivial_elements) {
+    BinarySearchTree<std::string, std::less<std::string>, AVL_tree,
+                     Arena_allocator<std::string>> tree;
+    tree.insert("banana");
+    tree.insert("apple");
+    tree.insert(std::string(100, 'z')); // heap-allocated string contents
+    std::stringstream ss;
+    tree.traverse_inorder(ss);
+    ASSERT_EQUAL(ss.str(), "apple banana " + std::string(100, 'z') + " ");
+}
+
+TEST(test_build_from_sorted_range) {
+    std::vector<int> sorted;
+    for (int i = 0; i < 1000; ++i) {
+        sorted.push_back(i * 2);
+    }
+    BinarySearchTree<int> tree(sorted.begin(), sorted.end());
+    ASSERT_EQUAL(tree.size(), 1000);
+    ASSERT_EQUAL(tree.height(), 10); // ceil(log2(1001))
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_TRUE(tree.check_balance_invariant());
+
+    std::vector<int> elements(tree.begin(), tree.end());
+    ASSERT_EQUAL(elements, sorted);
+}
+
+TEST(test_assign_sorted_range) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    tree.insert(42);
+    int sorted[] = { 1, 2, 3, 4, 5, 6, 7 };
+    tree.assign(sorted, sorted + 7);
+    ASSERT_EQUAL(tree.size(), 7);
+    ASSERT_EQUAL(tree.height(), 3);
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_EQUAL(tree.find(42), tree.end());
+
+    std::stringstream ss;
+    tree.traverse_preorder(ss);
+    ASSERT_EQUAL(ss.str(), "4 2 1 3 6 5 7 ");
+
+    // Remains a valid AVL tree for further inserts
+    tree.insert(8);
+    tree.insert(9);
+    ASSERT_TRUE(tree.check_balance_invariant());
+
+    tree.assign(sorted, sorted);
+    ASSERT_TRUE(tree.empty());
+}
+
+// An element type that can be moved but not copied
+struct Move_only {
+    int value;
+    explicit Move_only(int value_in) : value(value_in) {}
+    Move_only(Move_only &&) = default;
+    Move_only(const Move_only &) = delete;
+    bool operator<(const Move_only &rhs) const { return value < rhs.value; }
+};
+
+TEST(test_move_only_elements) {
+    BinarySearchTree<Move_only, std::less<Move_only>, AVL_tree> tree;
+    tree.insert(Move_only(2));
+    ASSERT_TRUE(tree.insert_unique(Move_only(1)).second);
+    ASSERT_TRUE(tree.emplace(3).second);
+    ASSERT_FALSE(tree.emplace(2).second);
+    ASSERT_EQUAL(tree.size(), 3);
+    ASSERT_EQUAL(tree.min_element()->value, 1);
+    ASSERT_EQUAL(tree.max_element()->value, 3);
+    ASSERT_TRUE(tree.check_balance_invariant());
+}
+
+TEST(test_move_constructor_and_assignment) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i);
+    }
+    auto it = tree.find(50);
+
+    BinarySearchTree<int, std::less<int>, AVL_tree> moved(std::move(tree));
+    ASSERT_EQUAL(moved.size(), 100);
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQUAL(it, moved.find(50)); // nodes were taken over, not copied
+
+    BinarySearchTree<int, std::less<int>, AVL_tree> assigned;
+    assigned.insert(-1);
+    assigned = std::move(moved);
+    ASSERT_EQUAL(assigned.size(), 100);
+    ASSERT_TRUE(moved.empty());
+    ASSERT_EQUAL(it, assigned.find(50));
+    ASSERT_EQUAL(assigned.find(-1), assigned.end());
+
+    // A moved-from tree is still usable
+    moved.insert(7);
+    ASSERT_EQUAL(moved.size(), 1);
+
+    assigned.swap(moved);
+    ASSERT_EQUAL(assigned.size(), 1);
+    ASSERT_EQUAL(moved.size(), 100);
+}
+
+TEST(test_try_emplace_skips_construction) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    auto first = tree.try_emplace(5, 5);
+    ASSERT_TRUE(first.second);
+    auto second = tree.try_emplace(5, 5);
+    ASSERT_FALSE(second.second);
+    ASSERT_EQUAL(first.first, second.first);
+}
+
+TEST(test_freeze) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    FrozenTree<int> empty_frozen = tree.freeze();
+    ASSERT_TRUE(empty_frozen.empty());
+    ASSERT_EQUAL(empty_frozen.begin(), empty_frozen.end());
+    ASSERT_EQUAL(empty_frozen.find(1), empty_frozen.end());
+
+    // Check every size up to a few complete levels, so both full and
+    // partial last levels are covered
+    for (int n = 1; n <= 40; ++n) {
+        tree.insert(n * 2);
+        FrozenTree<int> frozen = tree.freeze();
+        ASSERT_EQUAL(frozen.size(), static_cast<size_t>(n));
+
+        std::vector<int> elements(frozen.begin(), frozen.end());
+        std::vector<int> expected(tree.begin(), tree.end());
+        ASSERT_EQUAL(elements, expected);
+
+        for (int q = 0; q <= 2 * n + 1; ++q) {
+            auto it = frozen.find(q);
+            if (q % 2 == 0 && q > 0) {
+                ASSERT_NOT_EQUAL(it, frozen.end());
+                ASSERT_EQUAL(*it, q);
+            } else {
+                ASSERT_EQUAL(it, frozen.end());
+            }
+            auto lb = frozen.lower_bound(q);
+            if (q >= 2 * n) {
+                ASSERT_TRUE(q == 2 * n ? *lb == q : lb == frozen.end());
+            } else {
+                ASSERT_EQUAL(*lb, q <= 2 ? 2 : q + q % 2);
+            }
+        }
+    }
+}
+
+TEST(test_erase_relinks_nodes) {
+    // Unbalanced, so the shape is fully determined by insertion order
+    BinarySearchTree<int> tree;
+    for (int i : { 50, 30, 70, 20, 40, 60, 80, 65 }) {
+        tree.insert(i);
+    }
+    auto forty = tree.find(40);
+
+    // Leaf
+    ASSERT_EQUAL(*tree.erase(tree.find(20)), 30);
+    // One child
+    ASSERT_EQUAL(*tree.erase(tree.find(60)), 65);
+    // Two children, whose successor is a grandchild
+    ASSERT_EQUAL(*tree.erase(tree.find(50)), 65);
+    // Two children, whose successor is its right child
+    ASSERT_EQUAL(*tree.erase(tree.find(65)), 70);
+    // The largest element has no successor
+    ASSERT_EQUAL(tree.erase(tree.find(80)), tree.end());
+
+    std::ostringstream preorder;
+    tree.traverse_preorder(preorder);
+    ASSERT_EQUAL(preorder.str(), "70 30 40 ");
+    ASSERT_EQUAL(tree.size(), 3);
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_EQUAL(*forty, 40); // untouched elements stay put
+}
+
+TEST(test_avl_erase_keeps_balance) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    const int n = 1000;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(i * 7919 % n);
+    }
+    for (int i = 0; i < n; ++i) {
+        int victim = i * 4001 % n;
+        auto next = tree.erase(tree.find(victim));
+        ASSERT_EQUAL(next, tree.min_greater_than(victim));
+        ASSERT_EQUAL(tree.size(), static_cast<size_t>(n - i - 1));
+        if (i % 50 == 0) {
+            ASSERT_TRUE(tree.check_sorting_invariant());
+            ASSERT_TRUE(tree.check_balance_invariant());
+            // An AVL tree of n nodes is no taller than 1.44 log2(n + 2)
+            ASSERT_TRUE(tree.height() <= 15);
+        }
+    }
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQUAL(tree.begin(), tree.end());
+}
+
+TEST(test_splay_moves_accessed_to_root) {
+    BinarySearchTree<int, std::less<int>, Splay_tree> tree;
+    const int n = 1000;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(i * 7919 % n);
+    }
+    auto first = [&tree]() {
+        int root = -1;
+        bool seen = false;
+        tree.for_each_preorder([&](int x) {
+            if (!seen) {
+                root = x;
+                seen = true;
+            }
+        });
+        return root;
+    };
+    ASSERT_EQUAL(first(), (n - 1) * 7919 % n); // the last one inserted
+
+    auto seven = tree.find(7);
+    ASSERT_EQUAL(first(), 7);
+    ASSERT_EQUAL(tree.find(-5), tree.end());
+    ASSERT_EQUAL(first(), 0); // the last node visited
+    ASSERT_EQUAL(*seven, 7);  // iterators survive splaying
+    ASSERT_EQUAL(*++seven, 8);
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_EQUAL(tree.rank(500), 500);
+
+    for (int i = 0; i < n; i += 2) {
+        ASSERT_EQUAL(tree.erase(i), 1);
+    }
+    ASSERT_EQUAL(tree.size(), n / 2);
+    ASSERT_TRUE(tree.check_balance_invariant());
+    std::vector<int> odds(tree.begin(), tree.end());
+    ASSERT_EQUAL(odds.front(), 1);
+    ASSERT_EQUAL(odds.back(), n - 1);
+}
+
+TEST(test_splay_sorted_inserts_then_deep_find) {
+    BinarySearchTree<int, std::less<int>, Splay_tree> tree;
+    const int n = 1024;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(i);
+    }
+    // Each insert became the root, leaving a path of left children
+    ASSERT_EQUAL(tree.height(), n);
+    // Splaying the deepest node roughly halves the height
+    ASSERT_EQUAL(*tree.find(0), 0);
+    ASSERT_TRUE(tree.height() <= n / 2 + 2);
+    ASSERT_TRUE(tree.check_balance_invariant());
+    ASSERT_EQUAL(tree.size(), n);
+}
+
+TEST(test_splay_spine_copy_and_destroy) {
+    // A path of a million left children: nothing may recurse down it
+    BinarySearchTree<int, std::less<int>, Splay_tree> tree;
+    const int n = 1000000;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(i);
+    }
+    ASSERT_EQUAL(tree.height(), n);
+    {
+        BinarySearchTree<int, std::less<int>, Splay_tree> copy(tree);
+        ASSERT_EQUAL(copy.height(), n);
+        ASSERT_TRUE(std::equal(tree.begin(), tree.end(),
+                               copy.begin(), copy.end()));
+        copy.erase(copy.begin());
+        copy = tree;
+        ASSERT_EQUAL(copy.size(), n);
+    }
+    ThreadPool pool(2);
+    BinarySearchTree<int, std::less<int>, Splay_tree> parallel_copy(tree,
+                                                                    pool);
+    ASSERT_EQUAL(parallel_copy.height(), n);
+    parallel_copy.clear(pool);
+    ASSERT_TRUE(parallel_copy.empty());
+
+    ASSERT_EQUAL(tree.rank(n - 1), n - 1);
+    ASSERT_EQUAL(*tree.select(n - 1), n - 1);
+    ASSERT_EQUAL(*tree.lower_bound(0), 0);
+    ASSERT_EQUAL(*tree.upper_bound(0), 1);
+    ASSERT_EQUAL(*--tree.end(), n - 1);
+}
+
+// Compares ints and counts how often it is called
+struct Counting_less {
+    static size_t calls;
+    bool operator()(int lhs, int rhs) const {
+        ++calls;
+        return lhs < rhs;
+    }
+};
+
+size_t Counting_less::calls = 0;
+
+TEST(test_hinted_insert_sorted_takes_few_comparisons) {
+    BinarySearchTree<int, Counting_less, AVL_tree> tree;
+    const int n = 4096;
+    Counting_less::calls = 0;
+    auto hint = tree.end();
+    for (int i = 0; i < n; ++i) {
+        hint = tree.insert(hint, i);
+    }
+    // Unhinted, each insertion would compare about log2(n) = 12 times
+    ASSERT_TRUE(Counting_less::calls <= 2 * static_cast<size_t>(n));
+    ASSERT_EQUAL(tree.size(), n);
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_TRUE(tree.check_balance_invariant());
+
+    // Descending order, hinting with the previous element
+    BinarySearchTree<int, Counting_less, AVL_tree> down;
+    Counting_less::calls = 0;
+    hint = down.end();
+    for (int i = n; i > 0; --i) {
+        hint = down.insert(hint, i);
+    }
+    ASSERT_TRUE(Counting_less::calls <= 3 * static_cast<size_t>(n));
+    ASSERT_EQUAL(*down.begin(), 1);
+
+    // Filling the gaps between even keys, hinting with the element after
+    // the previous insertion: each key falls between the hint and its
+    // successor, so it is compared with just those two
+    BinarySearchTree<int, Counting_less, AVL_tree> gaps;
+    for (int i = 0; i < n; ++i) {
+        gaps.insert(2 * i);
+    }
+    Counting_less::calls = 0;
+    hint = gaps.begin();
+    for (int i = 0; i + 1 < n; ++i) {
+        hint = std::next(gaps.insert(hint, 2 * i + 1));
+    }
+    ASSERT_TRUE(Counting_less::calls <= 2 * static_cast<size_t>(n));
+    ASSERT_TRUE(gaps.check_sorting_invariant());
+    ASSERT_TRUE(gaps.check_balance_invariant());
+
+    // Ascending lookups, each from the previous result
+    Counting_less::calls = 0;
+    auto it = tree.begin();
+    for (int i = 0; i < n; ++i) {
+        it = tree.find(it, i);
+        ASSERT_EQUAL(*it, i);
+    }
+    ASSERT_TRUE(Counting_less::calls <= 4 * static_cast<size_t>(n));
+}
+
+TEST(test_hinted_insert_and_find_any_hint) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    std::vector<BinarySearchTree<int, std::less<int>, AVL_tree>::Iterator>
+        hints;
+    const int n = 500;
+    for (int i = 0; i < n; ++i) {
+        int key = 2 * (i * 7919 % n);
+        auto hint = hints.empty() ? tree.end() : hints[i * 31 % hints.size()];
+        auto it = tree.insert(hint, key);
+        ASSERT_EQUAL(*it, key);
+        ASSERT_EQUAL(tree.insert(hint, key), it); // already there
+        hints.push_back(it);
+    }
+    ASSERT_EQUAL(tree.size(), n);
+    ASSERT_TRUE(tree.check_sorting_invariant());
+    ASSERT_TRUE(tree.check_balance_invariant());
+    for (int i = 0; i < 2 * n; ++i) {
+        auto hint = hints[i * 17 % hints.size()];
+        auto found = tree.find(hint, i);
+        if (i % 2 == 0) {
+            ASSERT_EQUAL(*found, i);
+        } else {
+            ASSERT_EQUAL(found, tree.end());
+        }
+        ASSERT_EQUAL(tree.find(tree.end(), i), found);
+    }
+    BinarySearchTree<int> empty;
+    ASSERT_EQUAL(empty.find(empty.end(), 1), empty.end());
+}
+
+TEST(test_parallel_copy_clear_and_checks) {
+    using Tree = BinarySearchTree<int, std::less<int>, AVL_tree>;
+    Tree tree;
+    const int n = 5000;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(i * 7919 % n);
+    }
+    std::vector<int> shape;
+    tree.for_each_preorder([&](int x) { shape.push_back(x); });
+    for (size_t threads : { 0, 1, 3 }) {
+        ThreadPool pool(threads);
+        for (size_t cutoff : { 0, 64, 100000 }) {
+            Tree copy(tree, pool, cutoff);
+            std::vector<int> copied;
+            copy.for_each_preorder([&](int x) { copied.push_back(x); });
+            ASSERT_EQUAL(copied, shape); // the very same shape
+            ASSERT_TRUE(copy.check_sorting_invariant(pool, cutoff));
+            ASSERT_TRUE(copy.check_balance_invariant(pool, cutoff));
+
+            // Both checks agree with the serial ones on a broken tree
+            auto broken = copy.find(2500);
+            *broken = -1;
+            ASSERT_EQUAL(copy.check_sorting_invariant(pool, cutoff),
+                         copy.check_sorting_invariant());
+            *broken = 2500;
+            copy.clear(pool, cutoff);
+            ASSERT_TRUE(copy.empty());
+            copy.insert(1); // still usable
+            ASSERT_EQUAL(copy.size(), 1);
+        }
+    }
+    // A chain far deeper than the cutoff, and than the call stack allows:
+    // sorted inserts leave a Splay_tree a path of left children
+    BinarySearchTree<int, std::less<int>, Splay_tree> chain;
+    for (int i = 0; i < 1000000; ++i) {
+        chain.insert(i);
+    }
+    ThreadPool pool(2);
+    ASSERT_TRUE(chain.check_balance_invariant(pool, 4));
+    ASSERT_TRUE(chain.check_sorting_invariant(pool, 4));
+    ASSERT_TRUE(chain.check_balance_invariant());
+    ASSERT_TRUE(chain.check_sorting_invariant());
+}
+
+// Counts the instances alive at any time
+struct Live {
+    static int count;
+    int value;
+    Live(int value_in) : value(value_in) { ++count; }
+    Live(const Live &other) : value(other.value) { ++count; }
+    ~Live() { --count; }
+    bool operator<(const Live &rhs) const { return value < rhs.value; }
+};
+
+int Live::count = 0;
+
+TEST(test_erase_by_value_destroys_element) {
+    {
+        BinarySearchTree<Live, std::less<Live>, AVL_tree> tree;
+        for (int i = 0; i < 10; ++i) {
+            tree.insert(Live(i));
+        }
+        ASSERT_EQUAL(Live::count, 10);
+        ASSERT_EQUAL(tree.erase(Live(3)), 1);
+        ASSERT_EQUAL(Live::count, 9);
+        ASSERT_EQUAL(tree.erase(Live(3)), 0);
+        ASSERT_EQUAL(tree.size(), 9);
+        ASSERT_EQUAL(tree.rank(Live(4)), 3);
+    }
+    ASSERT_EQUAL(Live::count, 0);
+}
+
+// Counts the instances alive, and throws from the copy constructor once
+// copies_left runs out
+struct Fragile {
+    static int live;
+    static int copies_left;
+    int value;
+    Fragile(int value_in) : value(value_in) { ++live; }
+    Fragile(const Fragile &other) : value(other.value) {
+        if (copies_left-- == 0) {
+            throw std::runtime_error("copy");
+        }
+        ++live;
+    }
+    ~Fragile() { --live; }
+    bool operator<(const Fragile &rhs) const { return value < rhs.value; }
+};
+
+int Fragile::live = 0;
+int Fragile::copies_left = 0;
+
+TEST(test_build_from_range_frees_nodes_when_a_copy_throws) {
+    std::vector<Fragile> sorted;
+    sorted.reserve(100);
+    for (int i = 0; i < 100; ++i) {
+        sorted.emplace_back(i);
+    }
+    for (int budget : { 0, 1, 49, 50, 99 }) {
+        Fragile::copies_left = budget;
+        bool thrown = false;
+        try {
+            BinarySearchTree<Fragile> tree(sorted.begin(), sorted.end());
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        ASSERT_TRUE(thrown);
+        ASSERT_EQUAL(Fragile::live, 100); // only the vector's
+    }
+    Fragile::copies_left = 100;
+    BinarySearchTree<Fragile> tree(sorted.begin(), sorted.end());
+    ASSERT_EQUAL(Fragile::live, 200);
+}
+
+TEST(test_lower_upper_bound_and_equal_range) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    for (int i = 0; i < 20; i += 2) {
+        tree.insert(i);
+    }
+    ASSERT_EQUAL(*tree.lower_bound(-5), 0);
+    ASSERT_EQUAL(*tree.lower_bound(4), 4);
+    ASSERT_EQUAL(*tree.lower_bound(5), 6);
+    ASSERT_EQUAL(tree.lower_bound(19), tree.end());
+    ASSERT_EQUAL(*tree.upper_bound(4), 6);
+    ASSERT_EQUAL(*tree.upper_bound(5), 6);
+    ASSERT_EQUAL(tree.upper_bound(18), tree.end());
+
+    auto present = tree.equal_range(8);
+    ASSERT_EQUAL(*present.first, 8);
+    ASSERT_EQUAL(*present.second, 10);
+    auto absent = tree.equal_range(9);
+    ASSERT_EQUAL(absent.first, absent.second);
+    ASSERT_EQUAL(*absent.first, 10);
+
+    std::vector<int> in_range;
+    for (int i : tree.range(3, 11)) {
+        in_range.push_back(i);
+    }
+    std::vector<int> expected = { 4, 6, 8, 10 };
+    ASSERT_EQUAL(in_range, expected);
+    ASSERT_TRUE(tree.range(11, 12).empty());
+
+    BinarySearchTree<int> empty_tree;
+    ASSERT_EQUAL(empty_tree.lower_bound(1), empty_tree.end());
+    ASSERT_TRUE(empty_tree.range(0, 10).empty());
+
+    // A transparent comparator searches without converting the query
+    BinarySearchTree<std::string, std::less<>> words;
+    words.insert("apple");
+    words.insert("cherry");
+    auto cherry = words.equal_range(std::string_view("cherry"));
+    ASSERT_EQUAL(*cherry.first, "cherry");
+    ASSERT_EQUAL(cherry.second, words.end());
+    auto banana = words.equal_range("banana");
+    ASSERT_EQUAL(banana.first, banana.second);
+}
+
+TEST(test_iterator_decrement) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    for (int i = 0; i < 200; ++i) {
+        tree.insert(i * 37 % 200);
+    }
+    auto it = tree.end();
+    for (int expected = 199; expected >= 0; --expected) {
+        --it;
+        ASSERT_EQUAL(*it, expected);
+    }
+    ASSERT_EQUAL(it, tree.begin());
+
+    auto max = tree.end();
+    ASSERT_EQUAL(*--max, 199);
+    ASSERT_EQUAL(max, tree.max_element());
+    auto copy = max--;
+    ASSERT_EQUAL(*copy, 199);
+    ASSERT_EQUAL(*max, 198);
+    ASSERT_EQUAL(*++max, 199);
+}
+
+TEST(test_reverse_iteration) {
+    BinarySearchTree<int> tree;
+    for (int i : { 5, 2, 8, 1, 9, 3 }) {
+        tree.insert(i);
+    }
+    std::vector<int> descending(tree.rbegin(), tree.rend());
+    std::vector<int> expected = { 9, 8, 5, 3, 2, 1 };
+    ASSERT_EQUAL(descending, expected);
+
+    BinarySearchTree<int> empty_tree;
+    ASSERT_TRUE(empty_tree.rbegin() == empty_tree.rend());
+}
+
+TEST(test_merge_relinks_nodes) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> evens;
+    BinarySearchTree<int, std::less<int>, AVL_tree> threes;
+    for (int i = 0; i < 300; i += 2) {
+        evens.insert(i);
+    }
+    for (int i = 0; i < 300; i += 3) {
+        threes.insert(i);
+    }
+    auto nine = threes.find(9);
+    int combined = 0;
+    evens.merge(std::move(threes), [&](int &existing, int &&incoming) {
+        ASSERT_EQUAL(existing, incoming);
+        ++combined;
+    });
+    ASSERT_EQUAL(combined, 50); // the multiples of 6
+    ASSERT_TRUE(threes.empty());
+    ASSERT_EQUAL(evens.size(), 200);
+    ASSERT_TRUE(evens.check_sorting_invariant());
+    ASSERT_TRUE(evens.check_balance_invariant());
+    ASSERT_EQUAL(nine, evens.find(9)); // the node itself was relinked
+    ASSERT_EQUAL(evens.rank(9), 6);
+
+    // Merging a copy leaves the source alone
+    BinarySearchTree<int, std::less<int>, AVL_tree> odds;
+    odds.insert(1);
+    odds.insert(301);
+    evens.merge(static_cast<const BinarySearchTree<int, std::less<int>,
+                                                   AVL_tree> &>(odds),
+                [](int &, const int &) {});
+    ASSERT_EQUAL(odds.size(), 2);
+    ASSERT_EQUAL(evens.size(), 202);
+    ASSERT_EQUAL(*evens.max_element(), 301);
+    ASSERT_TRUE(evens.check_balance_invariant());
+}
+
+TEST(test_merge_throwing_combine_keeps_every_node) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> evens;
+    BinarySearchTree<int, std::less<int>, AVL_tree> small;
+    for (int i = 0; i <= 10; i += 2) {
+        evens.insert(i);
+    }
+    for (int i = 1; i <= 7; ++i) {
+        small.insert(i);
+    }
+    bool thrown = false;
+    try {
+        evens.merge(std::move(small), [](int &existing, int &&) {
+            if (existing == 6) {
+                throw std::runtime_error("combine");
+            }
+        });
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+    // 1 to 5 were merged before the throw; 6 and 7 stay behind
+    std::vector<int> kept(evens.begin(), evens.end());
+    std::vector<int> expected_kept = { 0, 1, 2, 3, 4, 5, 6, 8, 10 };
+    ASSERT_EQUAL(kept, expected_kept);
+    std::vector<int> left(small.begin(), small.end());
+    std::vector<int> expected_left = { 6, 7 };
+    ASSERT_EQUAL(left, expected_left);
+    ASSERT_EQUAL(small.size(), 2);
+    ASSERT_TRUE(evens.check_balance_invariant());
+    ASSERT_TRUE(small.check_balance_invariant());
+    ASSERT_TRUE(small.check_sorting_invariant());
+}
+
+TEST(test_merge_across_arenas) {
+    using Tree = BinarySearchTree<std::string, std::less<std::string>,
+                                  AVL_tree, Arena_allocator<std::string>>;
+    Tree a;
+    Tree b;
+    a.insert("apple");
+    a.insert("cherry");
+    b.insert("banana");
+    b.insert("cherry");
+    // Different arenas: the elements are moved into new nodes
+    a.merge(std::move(b), [](std::string &, std::string &&) {});
+    ASSERT_TRUE(b.empty());
+    std::vector<std::string> merged(a.begin(), a.end());
+    std::vector<std::string> expected = { "apple", "banana", "cherry" };
+    ASSERT_EQUAL(merged, expected);
+}
+
+TEST(test_for_each_orders) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    int sorted[] = { 1, 2, 3, 4, 5, 6, 7 };
+    tree.assign(sorted, sorted + 7);
+
+    std::vector<int> inorder;
+    tree.for_each_inorder([&](int &x) { inorder.push_back(x); });
+    ASSERT_EQUAL(inorder, std::vector<int>(sorted, sorted + 7));
+
+    std::vector<int> preorder;
+    tree.for_each_preorder([&](int x) { preorder.push_back(x); });
+    std::vector<int> expected = { 4, 2, 1, 3, 6, 5, 7 };
+    ASSERT_EQUAL(preorder, expected);
+
+    // The visitor may update elements in place
+    tree.for_each_inorder([](int &x) { x *= 10; });
+    ASSERT_EQUAL(*tree.min_element(), 10);
+    ASSERT_TRUE(tree.check_sorting_invariant());
+}
+
+TEST(test_parallel_for_each_visits_each_once) {
+    BinarySearchTree<int, std::less<int>, AVL_tree> tree;
+    const int n = 20000;
+    for (int i = 0; i < n; ++i) {
+        tree.insert((i * 7919) % n);
+    }
+    std::vector<int> visits(n, 0);
+    for (size_t threads : { 0, 1, 3 }) {
+        ThreadPool pool(threads);
+        tree.parallel_for_each([&](int x) { ++visits[x]; }, pool);
+    }
+    ASSERT_EQUAL(std::count(visits.begin(), visits.end(), 3), n);
+
+    // An exception thrown by the visitor reaches the caller
+    ThreadPool pool(2);
+    bool thrown = false;
+    try {
+        tree.parallel_for_each([](int x) {
+            if (x == 1234) {
+                throw std::runtime_error("visit");
+            }
+        }, pool);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+
+TEST(test_for_each_on_deep_spine) {
+    // Sorted inserts leave a Splay_tree a path of a million left children
+    BinarySearchTree<int, std::less<int>, Splay_tree> tree;
+    const int n = 1000000;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(i);
+    }
+    long long sum = 0;
+    int expected = 0;
+    bool in_order = true;
+    tree.for_each_inorder([&](int x) {
+        in_order = in_order && x == expected++;
+        sum += x;
+    });
+    ASSERT_TRUE(in_order);
+    ASSERT_EQUAL(expected, n);
+    ASSERT_EQUAL(sum, (long long)n * (n - 1) / 2);
+
+    expected = n - 1;
+    tree.for_each_preorder([&](int x) {
+        in_order = in_order && x == expected--;
+    });
+    ASSERT_TRUE(in_order);
+
+    std::vector<int> visits(n, 0);
+    ThreadPool pool(2);
+    tree.parallel_for_each([&](int x) { ++visits[x]; }, pool);
+    ASSERT_EQUAL(std::count(visits.begin(), visits.end(), 1), n);
+
+    std::ostringstream inorder;
+    tree.traverse_inorder(inorder);
+    ASSERT_EQUAL(inorder.str().size(), 6888890); // every number and a space
+}
+
+TEST(test_stats_shape) {
+    BinarySearchTree<int> tree;
+    Tree_stats empty = tree.stats();
+    ASSERT_EQUAL(empty.nodes, 0);
+    ASSERT_EQUAL(empty.max_depth, 0);
+    ASSERT_EQUAL(empty.expected_comparisons, 0.0);
+
+    //     4
+    //    / \
+    //   2   5
+    //  / \
+    // 1   3
+    for (int i : { 4, 2, 5, 1, 3 }) {
+        tree.insert(i);
+    }
+    Tree_stats stats = tree.stats();
+    ASSERT_EQUAL(stats.nodes, 5);
+    ASSERT_TRUE(stats.bytes >= 5 * sizeof(int));
+    ASSERT_EQUAL(stats.max_depth, tree.height());
+    ASSERT_EQUAL(stats.min_height, 3);
+    ASSERT_TRUE(stats.depth_histogram == std::vector<size_t>({ 1, 2, 2 }));
+    ASSERT_ALMOST_EQUAL(stats.average_depth, 11.0 / 5, 1e-9);
+    // 4: 2, 2: 1 + 2, 5: 2 + 2, 1: 1 + 1 + 2, 3: 1 + 2 + 2
+    ASSERT_ALMOST_EQUAL(stats.expected_comparisons, 18.0 / 5, 1e-9);
+}
+
+TEST(test_stats_predicts_find_comparisons) {
+    const int n = 3000;
+    BinarySearchTree<int, Counting_less> tree;
+    for (int i = 0; i < n; ++i) {
+        tree.insert((i * 7919) % n);
+    }
+    Counting_less::calls = 0;
+    for (int i = 0; i < n; ++i) {
+        ASSERT_EQUAL(*tree.find(i), i);
+    }
+    Tree_stats stats = tree.stats();
+    ASSERT_ALMOST_EQUAL(stats.expected_comparisons,
+                        double(Counting_less::calls) / n, 1e-9);
+
+    // Finding doesn't change the statistics, even of a Splay_tree
+    BinarySearchTree<int, std::less<int>, Splay_tree> splay;
+    for (int i = 0; i < n; ++i) {
+        splay.insert(i);
+    }
+    Tree_stats before = splay.stats();
+    ASSERT_EQUAL(before.max_depth, n);
+    ASSERT_SEQUENCE_EQUAL(splay.stats().depth_histogram,
+                          before.depth_histogram);
+}
+
+TEST(test_stats_of_deep_spine) {
+    // Sorted inserts leave a Splay_tree a path of left children, where
+    // find() makes one comparison at each ancestor and two at the node
+    BinarySearchTree<int, std::less<int>, Splay_tree> tree;
+    const int n = 1000000;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(i);
+    }
+    Tree_stats stats = tree.stats();
+    ASSERT_EQUAL(stats.nodes, n);
+    ASSERT_EQUAL(stats.max_depth, n);
+    ASSERT_EQUAL(stats.depth_histogram[n - 1], 1);
+    ASSERT_EQUAL(stats.expected_comparisons, (n - 1) / 2.0 + 2);
+}
+
+TEST(test_latency_histogram_buckets) {
+    Latency_histogram latency;
+    ASSERT_EQUAL(latency.percentile(0.5), 0);
+    for (uint64_t ns : { 0, 1, 2, 3, 1000, 1023 }) {
+        latency.record(ns);
+    }
+    latency.record(uint64_t(1) << 50); // beyond the last bucket
+    ASSERT_EQUAL(latency.count(), 7);
+    ASSERT_EQUAL(latency.buckets[0], 2);
+    ASSERT_EQUAL(latency.buckets[1], 2);
+    ASSERT_EQUAL(latency.buckets[9], 2);
+    ASSERT_EQUAL(latency.buckets[Latency_histogram::bucket_count - 1], 1);
+    ASSERT_EQUAL(latency.percentile(0.5), 4);
+    ASSERT_EQUAL(latency.percentile(0.8), 1024);
+}
+
+#ifdef MAP_INSTRUMENT
+TEST(test_instrument_counts_tree_operations) {
+    const int n = 1000;
+    BinarySearchTree<int, Counting_less, AVL_tree> tree;
+    reset_op_counters();
+    Counting_less::calls = 0;
+    for (int i = 0; i < n; ++i) {
+        tree.insert((i * 7919) % n);
+    }
+    ASSERT_EQUAL(op_counters().insert.calls, n);
+    ASSERT_EQUAL(op_counters().insert.comparisons, Counting_less::calls);
+    ASSERT_EQUAL(op_counters().insert.latency.count(), n);
+
+    Counting_less::calls = 0;
+    for (int i = 0; i < n; ++i) {
+        tree.find(i);
+    }
+    const Op_stats &find = op_counters().find;
+    ASSERT_EQUAL(find.calls, n);
+    ASSERT_EQUAL(find.comparisons, Counting_less::calls);
+    ASSERT_TRUE(find.nodes_visited <= find.comparisons);
+    ASSERT_TRUE(find.nodes_visited >= n);
+
+    // Stepping through the whole tree visits each node at most twice
+    // on the way down and once on the way up
+    size_t count = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        ++count;
+    }
+    ASSERT_EQUAL(op_counters().increment.calls, n);
+    ASSERT_EQUAL(op_counters().increment.comparisons, 0);
+    ASSERT_TRUE(op_counters().increment.nodes_visited <= 3 * count);
+
+    reset_op_counters();
+    ASSERT_EQUAL(op_counters().find.calls, 0);
+}
+#else
+TEST(test_instrument_disabled_counts_nothing) {
+    BinarySearchTree<int> tree;
+    reset_op_counters();
+    tree.insert(1);
+    tree.find(1);
+    tree.begin()++;
+    ASSERT_EQUAL(op_counters().insert.calls, 0);
+    ASSERT_EQUAL(op_counters().find.calls, 0);
+    ASSERT_EQUAL(op_counters().increment.calls, 0);
+}
+#endif
+
 TEST_MAIN()
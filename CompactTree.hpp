@@ -0,0 +1,713 @@
+#ifndef COMPACT_TREE_HPP
+#define COMPACT_TREE_HPP
+/* CompactTree.hpp
+ *
+ * An AVL tree whose nodes all live in one vector and refer to each
+ * other by 32-bit positions in it rather than by pointers. Compared with
+ * BinarySearchTree, a node costs 13 bytes beyond its element instead
+ * of about 40 plus the heap's own bookkeeping, nodes sit next to each
+ * other in memory, and the whole tree can be moved or written out as a
+ * block, since no link depends on where the vector is.
+ *
+ * A CompactTree can be used on its own, or as the storage of a Map by
+ * passing Compact_tree as the Map's Storage argument:
+ *
+ *   Map<std::string, int, std::less<std::string>, Compact_tree> counts;
+ */
+
+#include <algorithm>   //max, adjacent_find
+#include <cassert>     //assert
+#include <cstddef>     //size_t, ptrdiff_t
+#include <cstdint>     //uint8_t, uint32_t
+#include <functional>  //less
+#include <iterator>    //bidirectional_iterator_tag, reverse_iterator
+#include <memory>      //allocator, allocator_traits
+#include <utility>     //pair, move, forward, in_place
+#include <vector>
+#include "IteratorRange.hpp"
+
+// Compact_tree selects a CompactTree as the Storage argument of a Map.
+struct Compact_tree {};
+
+template <typename T,
+          typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>>
+class CompactTree {
+  // OVERVIEW: An AVL tree of unique elements of type T, ordered by
+  //           Compare. Node i is nodes[i]; its links are the positions of
+  //           its left and right children and its parent, or nil. A new
+  //           node is appended to the vector, and erasing a node moves
+  //           the last node into its place, so the vector never has
+  //           holes. A tree built from sorted elements (by assign, or by
+  //           merge) stores them in ascending order.
+  //
+  //           Inserting may move every node to a larger vector, and
+  //           erasing moves one node, so both invalidate iterators and
+  //           references to the elements.
+
+public:
+  // Position of a node in the vector
+  using Index = uint32_t;
+
+private:
+  static const Index nil = UINT32_MAX;
+
+  struct Node {
+    template <typename... Args>
+    explicit Node(std::in_place_t, Args&&... args)
+      : datum(std::forward<Args>(args)...), left(nil), right(nil),
+        parent(nil), height(1) { }
+
+    T datum;
+    Index left;
+    Index right;
+    Index parent;
+    uint8_t height; // an AVL tree of 2^32 nodes is under 48 levels high
+  };
+
+  using Node_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+
+public:
+  class Iterator {
+    // OVERVIEW: Iterates over the elements of a CompactTree in ascending
+    //           order, following child and parent links. An Iterator is
+    //           a node position plus a pointer to the tree.
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T *;
+    using reference = T &;
+
+    Iterator()
+      : index(nil), tree(nullptr) { }
+
+    // EFFECTS:  Returns the current element by reference.
+    // WARNING:  Any modification must leave the element equivalent to
+    //           what it was, or the sorting invariant will not hold.
+    T &operator*() const {
+      return tree->nodes[index].datum;
+    }
+
+    T *operator->() const {
+      return &tree->nodes[index].datum;
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      index = tree->successor(index);
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    // Prefix -- ; decrementing an end Iterator yields the largest element
+    Iterator &operator--() {
+      index = index == nil ? tree->rightmost(tree->root)
+                           : tree->predecessor(index);
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Iterator operator--(int) {
+      Iterator result(*this);
+      --(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return index == rhs.index;
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return index != rhs.index;
+    }
+
+  private:
+    friend class CompactTree;
+
+    Index index;
+    CompactTree *tree;
+
+    Iterator(Index index_in, const CompactTree *tree_in)
+      : index(index_in), tree(const_cast<CompactTree *>(tree_in)) { }
+  }; // CompactTree::Iterator
+
+  using Reverse_iterator = std::reverse_iterator<Iterator>;
+
+  CompactTree()
+    : root(nil) { }
+
+  explicit CompactTree(const Allocator &alloc)
+    : nodes(Node_allocator(alloc)), root(nil) { }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order
+  //           according to Compare
+  // EFFECTS : Constructs a tree holding the elements of [first, last),
+  //           shaped as a minimum-height tree, in linear time.
+  template <typename Iter>
+  CompactTree(Iter first, Iter last, const Allocator &alloc = Allocator())
+    : nodes(Node_allocator(alloc)), root(nil) {
+    assign(first, last);
+  }
+
+  // Copying copies the vector of nodes; no link needs to be adjusted.
+  // Moving takes over the vector in constant time.
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order
+  //           according to Compare
+  // MODIFIES: this CompactTree
+  // EFFECTS : Replaces the contents of this tree with the elements of
+  //           [first, last), building a minimum-height tree in linear
+  //           time with the nodes in ascending order. The precondition
+  //           is checked when assertions are enabled.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    assert(std::adjacent_find(first, last, [this](const T &a, const T &b) {
+             return !less(a, b);
+           }) == last);
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    assert(n < nil);
+    nodes.clear();
+    nodes.reserve(n);
+    root = build(first, n, nil);
+  }
+
+  // EFFECTS: Returns whether this CompactTree is empty.
+  bool empty() const {
+    return nodes.empty();
+  }
+
+  // EFFECTS: Returns the number of elements in this CompactTree.
+  size_t size() const {
+    return nodes.size();
+  }
+
+  // EFFECTS: Returns the height of the tree, in constant time.
+  size_t height() const {
+    return height_of(root);
+  }
+
+  // EFFECTS: Returns the number of bytes the vector of nodes occupies,
+  //          including room reserved for future nodes. Memory that
+  //          the elements themselves own is not counted.
+  size_t memory_bytes() const {
+    return nodes.capacity() * sizeof(Node);
+  }
+
+  // MODIFIES: this CompactTree
+  // EFFECTS : Releases the room reserved for future nodes, for a tree
+  //           that will not grow any further.
+  void shrink_to_fit() {
+    nodes.shrink_to_fit();
+  }
+
+  // EFFECTS: Returns whether every subtree is sorted and every link,
+  //          cached height and balance factor is correct.
+  bool check_invariants() const {
+    if (root != nil && nodes[root].parent != nil) {
+      return false;
+    }
+    size_t visited = 0;
+    return check(root, nullptr, nullptr, visited) >= 0 &&
+           visited == nodes.size();
+  }
+
+  Iterator begin() const {
+    return Iterator(root == nil ? nil : leftmost(root), this);
+  }
+
+  Iterator end() const {
+    return Iterator(nil, this);
+  }
+
+  Reverse_iterator rbegin() const {
+    return Reverse_iterator(end());
+  }
+
+  Reverse_iterator rend() const {
+    return Reverse_iterator(begin());
+  }
+
+  // EFFECTS: Returns an Iterator to the element equivalent to query, or
+  //          an end Iterator if there is none.
+  // NOTE:    query may be of type T, or of any type Compare can compare
+  //          against T.
+  template <typename Key>
+  Iterator find(const Key &query) const {
+    Index i = root;
+    while (i != nil) {
+      if (less(query, nodes[i].datum)) {
+        i = nodes[i].left;
+      } else if (less(nodes[i].datum, query)) {
+        i = nodes[i].right;
+      } else {
+        break;
+      }
+    }
+    return Iterator(i, this);
+  }
+
+  // EFFECTS: Same as find(query). The hint is accepted for compatibility
+  //          with BinarySearchTree::find(hint, query) and not used.
+  template <typename Key>
+  Iterator find(Iterator, const Key &query) const {
+    return find(query);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element not less than
+  //          query, or an end Iterator if there is none.
+  template <typename Key>
+  Iterator lower_bound(const Key &query) const {
+    Index candidate = nil;
+    for (Index i = root; i != nil;) {
+      if (less(nodes[i].datum, query)) {
+        i = nodes[i].right;
+      } else {
+        candidate = i;
+        i = nodes[i].left;
+      }
+    }
+    return Iterator(candidate, this);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element greater than
+  //          query, or an end Iterator if there is none.
+  template <typename Key>
+  Iterator upper_bound(const Key &query) const {
+    Index candidate = nil;
+    for (Index i = root; i != nil;) {
+      if (less(query, nodes[i].datum)) {
+        candidate = i;
+        i = nodes[i].left;
+      } else {
+        i = nodes[i].right;
+      }
+    }
+    return Iterator(candidate, this);
+  }
+
+  template <typename Key>
+  std::pair<Iterator, Iterator> equal_range(const Key &query) const {
+    return { lower_bound(query), upper_bound(query) };
+  }
+
+  // EFFECTS: Returns the elements not less than low and less than high.
+  template <typename Key>
+  Iterator_range<Iterator> range(const Key &low, const Key &high) const {
+    Iterator first = lower_bound(low);
+    return Iterator_range<Iterator>(first, less(high, low) ? first
+                                                           : lower_bound(high));
+  }
+
+  // MODIFIES: this CompactTree
+  // EFFECTS : If an element equivalent to item is already contained in
+  //           this tree, returns an Iterator to it along with false.
+  //           Otherwise, inserts item and returns an Iterator to the new
+  //           element along with true.
+  std::pair<Iterator, bool> insert_unique(const T &item) {
+    return try_emplace(item, item);
+  }
+
+  std::pair<Iterator, bool> insert_unique(T &&item) {
+    return try_emplace(item, std::move(item));
+  }
+
+  // MODIFIES: this CompactTree
+  // EFFECTS : Same as insert_unique, with the element constructed from
+  //           args.
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args&&... args) {
+    T item(std::forward<Args>(args)...);
+    return insert_unique(std::move(item));
+  }
+
+  // REQUIRES: An element constructed from args is equivalent to key
+  // MODIFIES: this CompactTree
+  // EFFECTS : If an element equivalent to key is already contained in
+  //           this tree, returns an Iterator to it along with false,
+  //           without constructing anything. Otherwise, constructs an
+  //           element from args in a new node at the end of the vector,
+  //           links it in, and returns an Iterator to it along with true.
+  template <typename Key, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const Key &key, Args&&... args) {
+    Index parent = nil;
+    bool go_left = false;
+    for (Index i = root; i != nil;) {
+      parent = i;
+      if (less(key, nodes[i].datum)) {
+        go_left = true;
+        i = nodes[i].left;
+      } else if (less(nodes[i].datum, key)) {
+        go_left = false;
+        i = nodes[i].right;
+      } else {
+        return { Iterator(i, this), false };
+      }
+    }
+    assert(nodes.size() < nil);
+    Index node = static_cast<Index>(nodes.size());
+    nodes.emplace_back(std::in_place, std::forward<Args>(args)...);
+    nodes[node].parent = parent;
+    if (parent == nil) {
+      root = node;
+    } else {
+      (go_left ? nodes[parent].left : nodes[parent].right) = node;
+      rebalance_path(parent);
+    }
+    return { Iterator(node, this), true };
+  }
+
+  // EFFECTS : Same as try_emplace(key, args...); the hint is not used
+  //           (see find(hint, query)).
+  template <typename Key, typename... Args>
+  std::pair<Iterator, bool> try_emplace_hint(Iterator, const Key &key,
+                                             Args&&... args) {
+    return try_emplace(key, std::forward<Args>(args)...);
+  }
+
+  // REQUIRES: pos is a dereferenceable Iterator into this tree
+  // MODIFIES: this CompactTree
+  // EFFECTS : Removes the element at pos and returns an Iterator to the
+  //           element that followed it (or an end Iterator).
+  // NOTE:    The successor's node takes the place of a removed node with
+  //          two children, and the last node of the vector then moves
+  //          into the freed position.
+  Iterator erase(Iterator pos) {
+    Index node = pos.index;
+    Index next = successor(node);
+    unlink(node);
+    Index last = static_cast<Index>(nodes.size() - 1);
+    if (node != last) {
+      relocate(last, node);
+      if (next == last) {
+        next = node;
+      }
+    }
+    nodes.pop_back();
+    return Iterator(next, this);
+  }
+
+  // MODIFIES: this CompactTree
+  // EFFECTS : Removes the element equivalent to item, if there is one.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const T &item) {
+    Iterator pos = find(item);
+    if (pos == end()) {
+      return 0;
+    }
+    erase(pos);
+    return 1;
+  }
+
+  // REQUIRES: combine(T &existing, T &&incoming) leaves in existing an
+  //           element equivalent to both
+  // MODIFIES: this CompactTree, other
+  // EFFECTS : Adds every element of other to this tree, leaving other
+  //           empty, in O(n + m) time, and rebuilds a minimum-height tree
+  //           with the nodes in ascending order. Elements are moved, not
+  //           copied.
+  template <typename Combine>
+  void merge(CompactTree &&other, Combine combine) {
+    if (this == &other) {
+      return;
+    }
+    merge_impl(other, [](T &theirs) { return std::move(theirs); },
+               [&combine](T &mine, T &theirs) {
+                 combine(mine, std::move(theirs));
+               });
+    other.nodes.clear();
+    other.root = nil;
+  }
+
+  // REQUIRES: combine(T &existing, const T &incoming) leaves in existing
+  //           an element equivalent to both
+  // MODIFIES: this CompactTree
+  // EFFECTS : Same as above, but copies the elements of other, which is
+  //           left unchanged.
+  template <typename Combine>
+  void merge(const CompactTree &other, Combine combine) {
+    if (this == &other) {
+      CompactTree copy(other);
+      merge(std::move(copy), combine);
+      return;
+    }
+    merge_impl(other, [](const T &theirs) { return theirs; },
+               [&combine](T &mine, const T &theirs) {
+                 combine(mine, theirs);
+               });
+  }
+
+private:
+  // DATA REPRESENTATION
+  std::vector<Node, Node_allocator> nodes;
+  Index root;
+  Compare less;
+
+  int height_of(Index i) const {
+    return i == nil ? 0 : nodes[i].height;
+  }
+
+  void update(Index i) {
+    Node &node = nodes[i];
+    node.height = static_cast<uint8_t>(
+      1 + std::max(height_of(node.left), height_of(node.right)));
+  }
+
+  Index leftmost(Index i) const {
+    while (nodes[i].left != nil) {
+      i = nodes[i].left;
+    }
+    return i;
+  }
+
+  Index rightmost(Index i) const {
+    while (nodes[i].right != nil) {
+      i = nodes[i].right;
+    }
+    return i;
+  }
+
+  // EFFECTS: Returns the node of the next larger element, or nil.
+  Index successor(Index i) const {
+    if (nodes[i].right != nil) {
+      return leftmost(nodes[i].right);
+    }
+    Index parent = nodes[i].parent;
+    while (parent != nil && nodes[parent].right == i) {
+      i = parent;
+      parent = nodes[i].parent;
+    }
+    return parent;
+  }
+
+  // EFFECTS: Returns the node of the next smaller element, or nil.
+  Index predecessor(Index i) const {
+    if (nodes[i].left != nil) {
+      return rightmost(nodes[i].left);
+    }
+    Index parent = nodes[i].parent;
+    while (parent != nil && nodes[parent].left == i) {
+      i = parent;
+      parent = nodes[i].parent;
+    }
+    return parent;
+  }
+
+  // MODIFIES: this CompactTree
+  // EFFECTS : Makes new_child take the place of old_child under parent
+  //           (or as the root, if parent is nil).
+  void replace_child(Index parent, Index old_child, Index new_child) {
+    if (parent == nil) {
+      root = new_child;
+    } else if (nodes[parent].left == old_child) {
+      nodes[parent].left = new_child;
+    } else {
+      nodes[parent].right = new_child;
+    }
+    if (new_child != nil) {
+      nodes[new_child].parent = parent;
+    }
+  }
+
+  // REQUIRES: node i has a right child
+  // MODIFIES: this CompactTree
+  // EFFECTS : Rotates the subtree rooted at i to the left and returns its
+  //           new root.
+  Index rotate_left(Index i) {
+    Index pivot = nodes[i].right;
+    Index inner = nodes[pivot].left;
+    replace_child(nodes[i].parent, i, pivot);
+    nodes[i].right = inner;
+    if (inner != nil) {
+      nodes[inner].parent = i;
+    }
+    nodes[pivot].left = i;
+    nodes[i].parent = pivot;
+    update(i);
+    update(pivot);
+    return pivot;
+  }
+
+  // REQUIRES: node i has a left child
+  // MODIFIES: this CompactTree
+  // EFFECTS : Mirror image of rotate_left.
+  Index rotate_right(Index i) {
+    Index pivot = nodes[i].left;
+    Index inner = nodes[pivot].right;
+    replace_child(nodes[i].parent, i, pivot);
+    nodes[i].left = inner;
+    if (inner != nil) {
+      nodes[inner].parent = i;
+    }
+    nodes[pivot].right = i;
+    nodes[i].parent = pivot;
+    update(i);
+    update(pivot);
+    return pivot;
+  }
+
+  // MODIFIES: this CompactTree
+  // EFFECTS : Restores the cached heights and the AVL balance from node
+  //           i up towards the root, stopping once a subtree's height is
+  //           what it was before.
+  void rebalance_path(Index i) {
+    while (i != nil) {
+      int before = nodes[i].height;
+      update(i);
+      int balance = height_of(nodes[i].left) - height_of(nodes[i].right);
+      if (balance > 1) {
+        Index left = nodes[i].left;
+        if (height_of(nodes[left].left) < height_of(nodes[left].right)) {
+          rotate_left(left);
+        }
+        i = rotate_right(i);
+      } else if (balance < -1) {
+        Index right = nodes[i].right;
+        if (height_of(nodes[right].right) < height_of(nodes[right].left)) {
+          rotate_right(right);
+        }
+        i = rotate_left(i);
+      }
+      if (nodes[i].height == before) {
+        return;
+      }
+      i = nodes[i].parent;
+    }
+  }
+
+  // MODIFIES: this CompactTree
+  // EFFECTS : Unlinks node from the tree, leaving it in the vector.
+  void unlink(Index node) {
+    Node &z = nodes[node];
+    Index start;
+    if (z.left == nil || z.right == nil) {
+      start = z.parent;
+      replace_child(z.parent, node, z.left != nil ? z.left : z.right);
+    } else {
+      Index heir = leftmost(z.right);
+      if (heir == z.right) {
+        start = heir;
+      } else {
+        start = nodes[heir].parent;
+        replace_child(start, heir, nodes[heir].right);
+        nodes[heir].right = z.right;
+        nodes[z.right].parent = heir;
+      }
+      replace_child(z.parent, node, heir);
+      nodes[heir].left = z.left;
+      nodes[z.left].parent = heir;
+      nodes[heir].height = z.height;
+    }
+    rebalance_path(start);
+  }
+
+  // REQUIRES: from is a linked node and to is an unlinked one
+  // MODIFIES: this CompactTree
+  // EFFECTS : Moves node from into position to, repointing its links.
+  void relocate(Index from, Index to) {
+    nodes[to] = std::move(nodes[from]);
+    Node &moved = nodes[to];
+    replace_child(moved.parent, from, to);
+    if (moved.left != nil) {
+      nodes[moved.left].parent = to;
+    }
+    if (moved.right != nil) {
+      nodes[moved.right].parent = to;
+    }
+  }
+
+  // MODIFIES: it, this CompactTree
+  // EFFECTS : Appends a minimum-height tree holding the next n elements
+  //           of it to the vector, in ascending order, advancing it past
+  //           them, and returns its root.
+  // NOTE:    This function is tree recursive.
+  template <typename Iter>
+  Index build(Iter &it, size_t n, Index parent) {
+    if (n == 0) {
+      return nil;
+    }
+    size_t left_count = n / 2;
+    Index left = build(it, left_count, nil);
+    Index node = static_cast<Index>(nodes.size());
+    nodes.emplace_back(std::in_place, *it);
+    ++it;
+    nodes[node].parent = parent;
+    nodes[node].left = left;
+    if (left != nil) {
+      nodes[left].parent = node;
+    }
+    Index right = build(it, n - left_count - 1, node);
+    nodes[node].right = right;
+    update(node);
+    return node;
+  }
+
+  // MODIFIES: this CompactTree, and other's elements if take moves them
+  // EFFECTS : Merges the elements of this tree with take(element) for
+  //           each element of other, calling join(mine, theirs) on
+  //           equivalent ones, and rebuilds the tree from the result.
+  template <typename Source, typename Take, typename Join>
+  void merge_impl(Source &other, Take take, Join join) {
+    std::vector<T> merged;
+    merged.reserve(size() + other.size());
+    Iterator mine = begin();
+    auto theirs = other.begin();
+    while (mine != end() && theirs != other.end()) {
+      if (less(*mine, *theirs)) {
+        merged.push_back(std::move(*mine++));
+      } else if (less(*theirs, *mine)) {
+        merged.push_back(take(*theirs++));
+      } else {
+        join(*mine, *theirs++);
+        merged.push_back(std::move(*mine++));
+      }
+    }
+    for (; mine != end(); ++mine) {
+      merged.push_back(std::move(*mine));
+    }
+    for (; theirs != other.end(); ++theirs) {
+      merged.push_back(take(*theirs));
+    }
+    assign(std::make_move_iterator(merged.begin()),
+           std::make_move_iterator(merged.end()));
+  }
+
+  // MODIFIES: visited
+  // EFFECTS : Returns the height of the subtree rooted at i if it is
+  //           sorted within (low, high) and its links, heights and
+  //           balance are correct, and -1 otherwise. Counts its nodes
+  //           in visited.
+  // NOTE:    This function is tree recursive.
+  int check(Index i, const T *low, const T *high, size_t &visited) const {
+    if (i == nil) {
+      return 0;
+    }
+    if (i >= nodes.size() || ++visited > nodes.size()) {
+      return -1;
+    }
+    const Node &node = nodes[i];
+    if ((low && !less(*low, node.datum)) ||
+        (high && !less(node.datum, *high)) ||
+        (node.left != nil && nodes[node.left].parent != i) ||
+        (node.right != nil && nodes[node.right].parent != i)) {
+      return -1;
+    }
+    int left = check(node.left, low, &node.datum, visited);
+    int right = check(node.right, &node.datum, high, visited);
+    if (left < 0 || right < 0 || left - right > 1 || right - left > 1 ||
+        node.height != 1 + std::max(left, right)) {
+      return -1;
+    }
+    return node.height;
+  }
+};
+
+#endif // COMPACT_TREE_HPP
@@ -0,0 +1,231 @@
+#ifndef CONCURRENT_MAP_HPP
+#define CONCURRENT_MAP_HPP
+/* ConcurrentMap.hpp
+ *
+ * A map of key-value pairs with unique keys that many threads may read
+ * and modify at the same time, for example to count the words of a
+ * training set on several cores into one shared vocabulary:
+ *
+ *   ConcurrentMap<std::string, int> counts;
+ *   // on each thread, for each word of its share of the posts:
+ *   counts.increment(word);
+ *
+ * A ConcurrentMap has the lookup and update operations of Map. It does
+ * not hand out iterators or references to its elements, though, since
+ * another thread could erase the element behind them. Lookups return a
+ * copy of the value or run a callback while the element is locked, and
+ * iteration visits the elements under lock or works on a snapshot().
+ */
+
+#include <algorithm>    //sort
+#include <cstddef>      //size_t
+#include <cstdint>      //uint64_t
+#include <functional>   //less, hash
+#include <mutex>        //unique_lock
+#include <optional>
+#include <shared_mutex> //shared_mutex, shared_lock
+#include <type_traits>  //is_same
+#include <utility>      //pair, move
+#include <vector>
+#include "Map.hpp"
+
+template <typename Key_type, typename Value_type,
+          typename Key_compare=std::less<Key_type>,
+          typename Hash=std::hash<Key_type>,
+          size_t Shard_count=64, // must be a power of two
+          typename Storage=Map_default_storage
+         >
+class ConcurrentMap {
+  // OVERVIEW: Splits the keys among Shard_count shards by their hash.
+  //           Each shard is an ordinary Map guarded by its own
+  //           reader-writer lock, so threads working on different shards
+  //           never wait for each other, and any number of threads may
+  //           read the same shard at once. An operation on one key locks
+  //           only that key's shard.
+  //
+  //           Every operation on a single key is atomic. Operations that
+  //           span shards (size, for_each) see each shard at some moment
+  //           during the call, but not necessarily all shards at the same
+  //           moment; snapshot() sees all of them at once.
+
+  static_assert(Shard_count > 0 && (Shard_count & (Shard_count - 1)) == 0,
+                "Shard_count must be a power of two");
+  static_assert(!std::is_same<Storage, Splay_tree>::value,
+                "a Splay_tree is modified by find, so it cannot be read "
+                "by several threads under a shared lock");
+
+public:
+  // Type alias for an element, the combination of a key and mapped
+  // value stored in a std::pair.
+  using Pair_type = std::pair<Key_type, Value_type>;
+
+  // Type alias for an ordinary, single-threaded copy of the contents.
+  using Snapshot = Map<Key_type, Value_type, Key_compare, Storage>;
+
+  // A ConcurrentMap is shared between threads by reference; copying one
+  // would need every shard locked, and moving one while other threads
+  // use it is never safe. Take a snapshot() instead.
+  ConcurrentMap() = default;
+  ConcurrentMap(const ConcurrentMap &) = delete;
+  ConcurrentMap &operator=(const ConcurrentMap &) = delete;
+
+  // EFFECTS : Returns whether this ConcurrentMap is empty.
+  bool empty() const {
+    return size() == 0;
+  }
+
+  // EFFECTS : Returns the number of elements in this ConcurrentMap.
+  size_t size() const {
+    size_t total = 0;
+    for (const Shard &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      total += shard.map.size();
+    }
+    return total;
+  }
+
+  // EFFECTS : Returns whether this ConcurrentMap holds an element with a
+  //           key equivalent to k.
+  bool contains(const Key_type& k) const {
+    const Shard &shard = shard_of(k);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.map.find(k) != shard.map.end();
+  }
+
+  // EFFECTS : Returns a copy of the value associated with k, or an empty
+  //           optional if there is none.
+  std::optional<Value_type> find(const Key_type& k) const {
+    const Shard &shard = shard_of(k);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto pos = shard.map.find(k);
+    if (pos == shard.map.end()) {
+      return std::nullopt;
+    }
+    return pos->second;
+  }
+
+  // EFFECTS : If this ConcurrentMap holds an element with a key
+  //           equivalent to k, calls visit(value) on its value and returns
+  //           true. Otherwise returns false.
+  // NOTE : The value is not copied, and other threads may read it at
+  //        the same time, but none may modify it until visit returns.
+  template <typename Visit>
+  bool find(const Key_type& k, Visit visit) const {
+    const Shard &shard = shard_of(k);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto pos = shard.map.find(k);
+    if (pos == shard.map.end()) {
+      return false;
+    }
+    visit(static_cast<const Value_type &>(pos->second));
+    return true;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Inserts val if no element has an equivalent key. Returns
+  //           whether val was inserted.
+  bool insert(const Pair_type &val) {
+    Shard &shard = shard_of(val.first);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.map.insert(val).second;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Calls update(value) on the value associated with k, first
+  //           inserting a value-initialized one if there is none (like
+  //           Map::operator[]), and returns what update returns.
+  // NOTE : This is the atomic counterpart of an expression such as
+  //        map[k] = f(map[k]), during which no other thread may access
+  //        the value.
+  template <typename Update>
+  auto update(const Key_type& k, Update update) {
+    Shard &shard = shard_of(k);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return update(shard.map[k]);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Atomically adds delta to the value associated with k,
+  //           inserting a value-initialized one if there is none, and
+  //           returns the new value.
+  Value_type increment(const Key_type& k, Value_type delta = 1) {
+    return update(k, [delta](Value_type &value) {
+      value += delta;
+      return value;
+    });
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the element with a key equivalent to k, if any.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const Key_type& k) {
+    Shard &shard = shard_of(k);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.map.erase(k);
+  }
+
+  // EFFECTS : Calls visit(element) on every key-value pair, one shard at
+  //           a time. Pairs within a shard are visited in ascending order
+  //           of key, but the shards are not ordered with respect to each
+  //           other; use snapshot() for a fully ordered traversal.
+  // NOTE : visit must not call back into this ConcurrentMap.
+  template <typename Visit>
+  void for_each(Visit visit) const {
+    for (const Shard &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (const Pair_type &element : shard.map) {
+        visit(element);
+      }
+    }
+  }
+
+  // EFFECTS : Returns an ordinary Map holding a copy of every key-value
+  //           pair, in ascending order of key. All shards are held at
+  //           once, so the copy reflects the contents at a single point
+  //           in time.
+  // NOTE : Each shard is already sorted, but the shards interleave, so
+  //        this sorts the pairs once and builds the Map from them in
+  //        linear time.
+  Snapshot snapshot() const {
+    std::vector<std::shared_lock<std::shared_mutex>> locks;
+    locks.reserve(Shard_count);
+    for (const Shard &shard : shards) {
+      locks.emplace_back(shard.mutex);
+    }
+    std::vector<Pair_type> elements;
+    for (const Shard &shard : shards) {
+      elements.insert(elements.end(), shard.map.begin(), shard.map.end());
+    }
+    std::sort(elements.begin(), elements.end(),
+              [](const Pair_type &lhs, const Pair_type &rhs) {
+                return Key_compare{}(lhs.first, rhs.first);
+              });
+    Snapshot result(elements.begin(), elements.end());
+    return result;
+  }
+
+private:
+  // One shard on its own cache lines, so that locking one shard does not
+  // slow down threads working on its neighbors.
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mutex;
+    Snapshot map;
+  };
+
+  Shard shards[Shard_count];
+
+  // EFFECTS: Returns the shard that holds k. The hash is scrambled by
+  //          a multiplication first, since std::hash of an integer is
+  //          often the integer itself, whose low bits spread poorly.
+  const Shard &shard_of(const Key_type& k) const {
+    uint64_t h = static_cast<uint64_t>(Hash{}(k)) * 0x9E3779B97F4A7C15ull;
+    return shards[(h >> 32) & (Shard_count - 1)];
+  }
+
+  Shard &shard_of(const Key_type& k) {
+    const ConcurrentMap &self = *this;
+    return const_cast<Shard &>(self.shard_of(k));
+  }
+};
+
+#endif // CONCURRENT_MAP_HPP
@@ -0,0 +1,250 @@
+#ifndef FROZEN_TREE_HPP
+#define FROZEN_TREE_HPP
+/* FrozenTree.hpp
+ *
+ * A read-only, array-based snapshot of a sorted set of elements, for
+ * lookup-heavy phases in which the data no longer changes (for example,
+ * classifying a test set after training is complete).
+ *
+ * Obtain one with BinarySearchTree::freeze() or Map::freeze(), or
+ * construct one directly from a sorted range.
+ */
+
+#include <cassert>    //assert
+#include <cstddef>    //size_t, ptrdiff_t
+#include <functional> //less
+#include <iterator>   //forward_iterator_tag
+#include <utility>    //move
+#include <vector>
+
+template <typename T, typename Compare=std::less<T>>
+class FrozenTree {
+  // OVERVIEW: Stores n elements in one contiguous array in Eytzinger
+  //           (breadth-first) order: the root of a perfectly balanced
+  //           search tree is at position 1, and the children of the
+  //           element at position k are at positions 2k and 2k + 1.
+  //           A search walks down this implicit tree with no pointers
+  //           to chase. The next step is chosen arithmetically from the
+  //           comparison result instead of by a branch, and the
+  //           elements four levels below the current one, which share
+  //           a few cache lines, are prefetched ahead of time.
+  //
+  //           Elements are iterated in ascending order. They cannot be
+  //           modified, inserted or removed.
+
+public:
+  class Iterator {
+    // OVERVIEW: Iterates over the elements of a FrozenTree in ascending
+    //           order. An Iterator is a position in the Eytzinger array;
+    //           position 0 is past-the-end.
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator()
+      : tree(nullptr), position(0) { }
+
+    // EFFECTS: Returns the current element by reference.
+    const T &operator*() const {
+      return tree->at(position);
+    }
+
+    // EFFECTS: Returns the current element by pointer.
+    const T *operator->() const {
+      return &tree->at(position);
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      position = tree->successor(position);
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return position == rhs.position;
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return position != rhs.position;
+    }
+
+  private:
+    friend class FrozenTree;
+
+    const FrozenTree *tree;
+    size_t position;
+
+    Iterator(const FrozenTree *tree_in, size_t position_in)
+      : tree(tree_in), position(position_in) { }
+  }; // FrozenTree::Iterator
+
+  // EFFECTS: Constructs an empty FrozenTree.
+  FrozenTree() { }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order
+  //           according to Compare
+  // EFFECTS : Constructs a FrozenTree holding a copy of each element of
+  //           [first, last), in linear time. The precondition is checked
+  //           when assertions are enabled.
+  template <typename Iter>
+  FrozenTree(Iter first, Iter last) {
+    std::vector<T> sorted(first, last);
+    assert(is_strictly_sorted(sorted));
+    std::vector<size_t> rank(sorted.size());
+    size_t next_rank = 0;
+    number_inorder(1, rank, next_rank);
+    elements.reserve(sorted.size());
+    for (size_t r : rank) {
+      elements.push_back(std::move(sorted[r]));
+    }
+  }
+
+  // EFFECTS: Returns whether this FrozenTree is empty.
+  bool empty() const {
+    return elements.empty();
+  }
+
+  // EFFECTS: Returns the number of elements in this FrozenTree.
+  size_t size() const {
+    return elements.size();
+  }
+
+  // EFFECTS: Returns an iterator to the smallest element.
+  Iterator begin() const {
+    if (elements.empty()) {
+      return end();
+    }
+    return Iterator(this, leftmost(1));
+  }
+
+  // EFFECTS: Returns an iterator to past-the-end.
+  Iterator end() const {
+    return Iterator(this, 0);
+  }
+
+  // EFFECTS: Returns an iterator to the first element that is not less
+  //          than query, or an end iterator if there is none.
+  // NOTE:    query may be of any type that Compare can compare against T.
+  template <typename Key>
+  Iterator lower_bound(const Key &query) const {
+    return Iterator(this, lower_bound_position(query));
+  }
+
+  // EFFECTS: Searches for an element equivalent to query. Returns an
+  //          iterator to it if found, and an end iterator otherwise.
+  // NOTE:    query may be of any type that Compare can compare against T.
+  template <typename Key>
+  Iterator find(const Key &query) const {
+    size_t position = lower_bound_position(query);
+    if (position == 0 || less(query, at(position))) {
+      return end();
+    }
+    return Iterator(this, position);
+  }
+
+private:
+  // Elements in Eytzinger order; the element at position k (1-based)
+  // is stored at index k - 1.
+  std::vector<T> elements;
+
+  Compare less;
+
+  // Number of levels ahead to prefetch. 2^4 = 16 consecutive positions.
+  static const size_t prefetch_levels = 4;
+
+  // EFFECTS: Returns the element at the 1-based position k.
+  const T &at(size_t k) const {
+    return elements[k - 1];
+  }
+
+  // EFFECTS: Returns the 1-based position of the first element that is
+  //          not less than query, or 0 if there is none.
+  template <typename Key>
+  size_t lower_bound_position(const Key &query) const {
+    size_t n = elements.size();
+    size_t k = 1;
+    while (k <= n) {
+#if defined(__GNUC__)
+      // Near the leaves the positions ahead are past the end; pointing
+      // there at all is undefined, so those levels are not prefetched
+      size_t ahead = (k << prefetch_levels) - 1;
+      if (ahead < n) {
+        __builtin_prefetch(elements.data() + ahead);
+      }
+#endif
+      // Go right (2k + 1) when the element is less than query, else left
+      k = 2 * k + static_cast<size_t>(less(at(k), query));
+    }
+    // The path ends below the answer; every right turn after it went
+    // past elements less than query. Undo those right turns and the one
+    // left turn at the answer itself.
+    return k >> (trailing_ones(k) + 1);
+  }
+
+  // EFFECTS: Returns the 1-based position of the in-order successor of
+  //          position k, or 0 if k holds the largest element.
+  size_t successor(size_t k) const {
+    if (2 * k + 1 <= elements.size()) {
+      return leftmost(2 * k + 1);
+    }
+    // Climb past every ancestor of which k is in the right subtree
+    return k >> (trailing_ones(k) + 1);
+  }
+
+  // EFFECTS: Returns the position of the smallest element in the subtree
+  //          rooted at position k.
+  size_t leftmost(size_t k) const {
+    while (2 * k <= elements.size()) {
+      k = 2 * k;
+    }
+    return k;
+  }
+
+  // EFFECTS: Returns the number of trailing one bits of k.
+  static size_t trailing_ones(size_t k) {
+    size_t count = 0;
+    while (k & 1) {
+      k >>= 1;
+      ++count;
+    }
+    return count;
+  }
+
+  // MODIFIES: rank, next_rank
+  // EFFECTS : Visits the implicit subtree rooted at position k in order,
+  //           recording in rank[k - 1] the sorted index of the element
+  //           that belongs at each position.
+  // NOTE:    This function is tree recursive.
+  void number_inorder(size_t k, std::vector<size_t> &rank,
+                      size_t &next_rank) const {
+    if (k > rank.size()) {
+      return;
+    }
+    number_inorder(2 * k, rank, next_rank);
+    rank[k - 1] = next_rank++;
+    number_inorder(2 * k + 1, rank, next_rank);
+  }
+
+  // EFFECTS: Returns whether sorted is in strictly ascending order.
+  bool is_strictly_sorted(const std::vector<T> &sorted) const {
+    for (size_t i = 1; i < sorted.size(); ++i) {
+      if (!less(sorted[i - 1], sorted[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif // FROZEN_TREE_HPP
@@ -0,0 +1,293 @@
+#ifndef HASH_MAP_HPP
+#define HASH_MAP_HPP
+/* HashMap.hpp
+ *
+ * A map of key-value pairs with unique keys, stored in a hash table
+ * rather than a tree. Use it in place of Map when lookups are by exact
+ * key and the order of the keys does not matter, except perhaps when
+ * the contents are written out:
+ *
+ *   HashMap<std::string, int> counts;
+ *   ++counts["word"];
+ *   for (const auto *p : counts.sorted()) { ... } // in order of key
+ */
+
+#include <algorithm>  //sort
+#include <cassert>    //assert
+#include <cstddef>    //size_t
+#include <cstdint>    //uint32_t, uint64_t
+#include <functional> //hash, equal_to, less
+#include <tuple>      //forward_as_tuple
+#include <utility>    //pair, move, forward, piecewise_construct
+#include <vector>
+
+template <typename Key_type, typename Value_type,
+          typename Hash=std::hash<Key_type>,
+          typename Key_equal=std::equal_to<Key_type>,
+          typename Key_compare=std::less<Key_type> // for sorted() only
+         >
+class HashMap {
+  // OVERVIEW: Keeps the key-value pairs packed together in one vector,
+  //           in no particular order, and finds them through a separate
+  //           table of small slots. Each slot holds the position of one
+  //           pair plus 32 bits of its key's hash. The table is searched
+  //           by linear probing, so a lookup reads a few neighboring
+  //           slots, compares their hash bits, and compares keys only
+  //           when those match. At most three quarters of the slots are
+  //           in use.
+  //
+  //           Erasing a pair moves the last pair into its place, and
+  //           shifts later slots of its probe sequence back into the
+  //           freed slot, so the table never fills up with deleted
+  //           markers.
+  //
+  //           Inserting may move every pair, and erasing moves one, so
+  //           both invalidate iterators and references to the elements.
+
+public:
+  // Type alias for an element, the combination of a key and mapped
+  // value stored in a std::pair.
+  using Pair_type = std::pair<Key_type, Value_type>;
+
+  // Iterators visit the pairs in an unspecified order, which changes
+  // when the HashMap is modified. See sorted() for a deterministic one.
+  using Iterator = typename std::vector<Pair_type>::iterator;
+  using Const_iterator = typename std::vector<Pair_type>::const_iterator;
+
+  // EFFECTS : Returns whether this HashMap is empty.
+  bool empty() const {
+    return elements.empty();
+  }
+
+  // EFFECTS : Returns the number of elements in this HashMap.
+  size_t size() const {
+    return elements.size();
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Makes room for n elements in total, so that inserting
+  //           up to that many does not grow the table.
+  void reserve(size_t n) {
+    elements.reserve(n);
+    size_t capacity = min_capacity;
+    while (n > max_load(capacity)) {
+      capacity *= 2;
+    }
+    if (capacity > slots.size()) {
+      rehash(capacity);
+    }
+  }
+
+  // EFFECTS : Searches this HashMap for an element with a key equivalent
+  //           to k and returns an Iterator to it if found, otherwise
+  //           returns an end Iterator.
+  Iterator find(const Key_type& k) {
+    size_t slot = find_slot(k, fingerprint_of(k));
+    return slot == npos ? end() : begin() + slots[slot].index;
+  }
+
+  Const_iterator find(const Key_type& k) const {
+    size_t slot = find_slot(k, fingerprint_of(k));
+    return slot == npos ? end() : begin() + slots[slot].index;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Returns a reference to the mapped value for the given key.
+  //           If k matches the key of an element in the container, the
+  //           function returns a reference to its mapped value. If k
+  //           does not match any element, a new element with that key
+  //           and a value-initialized mapped value is inserted.
+  Value_type& operator[](const Key_type& k) {
+    return try_emplace(k).first->second;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Inserts val if no element has an equivalent key. Returns
+  //           an Iterator to the element with that key, and whether val
+  //           was inserted.
+  std::pair<Iterator, bool> insert(const Pair_type &val) {
+    return try_emplace(val.first, val.second);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : If no element has a key equivalent to k, inserts one whose
+  //           value is constructed from args. Returns an Iterator to the
+  //           element with that key, and whether one was inserted.
+  template <typename... Args>
+  std::pair<Iterator, bool> try_emplace(const Key_type& k, Args&&... args) {
+    uint32_t fingerprint = fingerprint_of(k);
+    size_t slot = find_slot(k, fingerprint);
+    if (slot != npos) {
+      return { begin() + slots[slot].index, false };
+    }
+    assert(elements.size() < UINT32_MAX);
+    if (elements.size() + 1 > max_load(slots.size())) {
+      rehash(slots.empty() ? min_capacity : 2 * slots.size());
+    }
+    elements.emplace_back(std::piecewise_construct, std::forward_as_tuple(k),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+    uint32_t index = static_cast<uint32_t>(elements.size() - 1);
+    place({ fingerprint, index });
+    return { begin() + index, true };
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the element with a key equivalent to k, if any.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const Key_type& k) {
+    size_t slot = find_slot(k, fingerprint_of(k));
+    if (slot == npos) {
+      return 0;
+    }
+    uint32_t index = slots[slot].index;
+    remove_slot(slot);
+    uint32_t last = static_cast<uint32_t>(elements.size() - 1);
+    if (index != last) {
+      // Move the last element into the gap and repoint its slot
+      const Key_type &moved = elements[last].first;
+      slots[find_slot(moved, fingerprint_of(moved))].index = index;
+      elements[index] = std::move(elements[last]);
+    }
+    elements.pop_back();
+    return 1;
+  }
+
+  // EFFECTS : Returns an iterator to the first element of this HashMap.
+  Iterator begin() {
+    return elements.begin();
+  }
+
+  Const_iterator begin() const {
+    return elements.begin();
+  }
+
+  // EFFECTS : Returns an iterator to "past-the-end".
+  Iterator end() {
+    return elements.end();
+  }
+
+  Const_iterator end() const {
+    return elements.end();
+  }
+
+  // EFFECTS : Returns pointers to every element, in ascending order of
+  //           key according to Key_compare, for deterministic output.
+  //           The elements themselves are neither copied nor moved; the
+  //           pointers are invalidated along with iterators.
+  // NOTE : Takes O(n log n) time on every call. For repeated ordered
+  //        queries, use a Map instead.
+  std::vector<const Pair_type *> sorted() const {
+    std::vector<const Pair_type *> view;
+    view.reserve(elements.size());
+    for (const Pair_type &element : elements) {
+      view.push_back(&element);
+    }
+    std::sort(view.begin(), view.end(),
+              [](const Pair_type *lhs, const Pair_type *rhs) {
+                return Key_compare{}(lhs->first, rhs->first);
+              });
+    return view;
+  }
+
+private:
+  // A slot of the table. A fingerprint of 0 marks an empty slot; others
+  // hold the high 32 bits of the scrambled hash (see fingerprint_of), so
+  // the slot's home position can be recovered without rehashing its key.
+  struct Slot {
+    uint32_t fingerprint;
+    uint32_t index; // position of the element in elements
+  };
+
+  std::vector<Pair_type> elements;
+  std::vector<Slot> slots; // empty, or a power of two in size
+  size_t shift = 64;       // 64 - log2(slots.size())
+
+  static const size_t min_capacity = 8;
+  static const size_t npos = static_cast<size_t>(-1);
+
+  // EFFECTS: Returns the number of elements a table of the given
+  //          capacity holds before it grows.
+  static size_t max_load(size_t capacity) {
+    return capacity - capacity / 4;
+  }
+
+  // EFFECTS: Returns the fingerprint of k, which is never 0. The hash is
+  //          scrambled by a multiplication first, since std::hash of an
+  //          integer is often the integer itself.
+  static uint32_t fingerprint_of(const Key_type& k) {
+    uint64_t h = static_cast<uint64_t>(Hash{}(k)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<uint32_t>(h >> 32) | 1;
+  }
+
+  // EFFECTS: Returns the first slot to probe for the given fingerprint.
+  size_t home_of(uint32_t fingerprint) const {
+    return static_cast<size_t>(fingerprint) >> (shift - 32);
+  }
+
+  // EFFECTS: Returns the slot of the element with a key equivalent to k,
+  //          or npos if there is none.
+  size_t find_slot(const Key_type& k, uint32_t fingerprint) const {
+    if (slots.empty()) {
+      return npos;
+    }
+    size_t mask = slots.size() - 1;
+    for (size_t i = home_of(fingerprint); slots[i].fingerprint != 0;
+         i = (i + 1) & mask) {
+      if (slots[i].fingerprint == fingerprint &&
+          Key_equal{}(elements[slots[i].index].first, k)) {
+        return i;
+      }
+    }
+    return npos;
+  }
+
+  // REQUIRES: the table has an empty slot
+  // MODIFIES: slots
+  // EFFECTS : Stores slot in the first empty slot of its probe sequence.
+  void place(Slot slot) {
+    size_t mask = slots.size() - 1;
+    size_t i = home_of(slot.fingerprint);
+    while (slots[i].fingerprint != 0) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+  }
+
+  // MODIFIES: slots
+  // EFFECTS : Empties slot i, then moves back each later slot of the
+  //           same run whose home is not between i and its position, so
+  //           that every probe sequence stays unbroken.
+  void remove_slot(size_t i) {
+    size_t mask = slots.size() - 1;
+    for (size_t j = (i + 1) & mask; slots[j].fingerprint != 0;
+         j = (j + 1) & mask) {
+      size_t home = home_of(slots[j].fingerprint);
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i] = Slot{ 0, 0 };
+  }
+
+  // REQUIRES: capacity is a power of two, at least min_capacity and
+  //           large enough to hold every element
+  // MODIFIES: slots, shift
+  // EFFECTS : Moves every slot into a new table of the given capacity.
+  //           Keys are not hashed again; their fingerprints suffice.
+  void rehash(size_t capacity) {
+    std::vector<Slot> old(capacity, Slot{ 0, 0 });
+    old.swap(slots);
+    shift = 64;
+    for (size_t c = capacity; c > 1; c /= 2) {
+      --shift;
+    }
+    for (const Slot &slot : old) {
+      if (slot.fingerprint != 0) {
+        place(slot);
+      }
+    }
+  }
+};
+
+#endif // HASH_MAP_HPP
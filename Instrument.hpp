@@ -0,0 +1,193 @@
+#ifndef INSTRUMENT_HPP
+#define INSTRUMENT_HPP
+/* Instrument.hpp
+ *
+ * Optional counters on the operations of Map and BinarySearchTree:
+ * find, insert, Map::operator[] and Iterator::operator++. For each, the
+ * number of calls, comparator invocations, nodes visited and a latency
+ * histogram are kept per thread. They are compiled in only when
+ * MAP_INSTRUMENT is defined:
+ *
+ *   g++ -DMAP_INSTRUMENT ...
+ *
+ *   reset_op_counters();
+ *   double score = 0;
+ *   for (const string &word : post) {
+ *     score += log_likelihoods.find(word)->second;
+ *   }
+ *   std::cout << op_counters();
+ *
+ * Without MAP_INSTRUMENT, the INSTRUMENT_* hooks below expand to nothing
+ * (or to the bare comparison), so the containers compile to the same
+ * code as if they were not there, and op_counters() stays all zeros.
+ */
+
+#include <chrono>
+#include <cstddef>  //size_t
+#include <cstdint>  //uint64_t
+#include <iostream> //ostream
+
+// A histogram of latencies on a log scale: buckets[0] counts operations
+// that took under 2 ns, and buckets[i] those that took from 2^i ns up to
+// 2^(i + 1) ns. The last bucket also takes everything slower.
+struct Latency_histogram {
+  static constexpr size_t bucket_count = 32;
+  size_t buckets[bucket_count] = {};
+
+  // MODIFIES: this
+  // EFFECTS : Counts one operation that took the given time.
+  void record(uint64_t ns) {
+    size_t i = 0;
+    while (ns > 1 && i + 1 < bucket_count) {
+      ns >>= 1;
+      ++i;
+    }
+    ++buckets[i];
+  }
+
+  // EFFECTS: Returns the number of operations counted.
+  size_t count() const {
+    size_t total = 0;
+    for (size_t n : buckets) {
+      total += n;
+    }
+    return total;
+  }
+
+  // REQUIRES: 0 <= fraction <= 1
+  // EFFECTS : Returns the upper end, in nanoseconds, of the bucket that
+  //           holds the given fraction of the operations counted when
+  //           sorted by latency (0.5 for the median), or 0 if none were.
+  uint64_t percentile(double fraction) const {
+    size_t total = count();
+    size_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+      seen += buckets[i];
+      if (seen != 0 && seen >= fraction * total) {
+        return uint64_t(2) << i;
+      }
+    }
+    return 0;
+  }
+};
+
+// The counters of one kind of operation
+struct Op_stats {
+  size_t calls = 0;
+  size_t comparisons = 0;   // comparator invocations
+  size_t nodes_visited = 0; // nodes searched through or stepped over
+  Latency_histogram latency;
+};
+
+// The counters of every instrumented operation on one thread
+struct Op_counters {
+  Op_stats find;      // find, with or without a hint
+  Op_stats insert;    // insert, insert_unique, emplace, try_emplace
+  Op_stats subscript; // Map::operator[]
+  Op_stats increment; // Iterator::operator++
+};
+
+// EFFECTS: Returns the calling thread's counters.
+inline Op_counters &op_counters() {
+  thread_local Op_counters counters;
+  return counters;
+}
+
+// MODIFIES: the calling thread's counters
+// EFFECTS : Sets them all to zero.
+inline void reset_op_counters() {
+  op_counters() = Op_counters();
+}
+
+// EFFECTS: Prints the calls to one operation, the comparisons and nodes
+//          visited per call, and the median and 99th percentile latency.
+inline std::ostream &operator<<(std::ostream &os, const Op_stats &stats) {
+  os << stats.calls << " calls";
+  if (stats.calls != 0) {
+    os << ", " << double(stats.comparisons) / stats.calls
+       << " comparisons and " << double(stats.nodes_visited) / stats.calls
+       << " nodes per call, latency p50 < "
+       << stats.latency.percentile(0.5) << " ns, p99 < "
+       << stats.latency.percentile(0.99) << " ns";
+  }
+  return os;
+}
+
+// EFFECTS: Prints the counters of each operation on its own line.
+inline std::ostream &operator<<(std::ostream &os,
+                                const Op_counters &counters) {
+  return os << "find: " << counters.find << "\n"
+            << "insert: " << counters.insert << "\n"
+            << "operator[]: " << counters.subscript << "\n"
+            << "operator++: " << counters.increment << "\n";
+}
+
+class Op_scope {
+  // OVERVIEW: Times one call to an operation and charges to it the
+  //           comparisons and nodes counted while the call runs. Only the
+  //           outermost Op_scope on a thread counts, so that the search
+  //           inside Map::operator[] is charged to operator[] and not
+  //           also to insert. Comparisons made outside any Op_scope (by
+  //           erase, say) are not counted.
+
+public:
+  explicit Op_scope(Op_stats Op_counters::*op)
+    : stats(nullptr) {
+    if (current == nullptr) {
+      stats = &(op_counters().*op);
+      current = stats;
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  Op_scope(const Op_scope &) = delete;
+  Op_scope &operator=(const Op_scope &) = delete;
+
+  ~Op_scope() {
+    if (stats != nullptr) {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      stats->latency.record(std::chrono::duration_cast<
+                            std::chrono::nanoseconds>(elapsed).count());
+      ++stats->calls;
+      current = nullptr;
+    }
+  }
+
+  // EFFECTS: Counts one comparison against the running operation.
+  static void compared() {
+    if (current != nullptr) {
+      ++current->comparisons;
+    }
+  }
+
+  // EFFECTS: Counts one node visited by the running operation.
+  static void visited() {
+    if (current != nullptr) {
+      ++current->nodes_visited;
+    }
+  }
+
+private:
+  // The counters of the outermost operation running on this thread
+  inline static thread_local Op_stats *current = nullptr;
+
+  Op_stats *stats; // null unless this is the outermost Op_scope
+  std::chrono::steady_clock::time_point start;
+};
+
+// HOOKS
+// INSTRUMENT_OP(op) starts an Op_scope for the rest of the enclosing
+// block, charging it to the Op_counters member op. INSTRUMENT_NODE()
+// counts a node visited, and INSTRUMENT_COMPARE(comparison) evaluates
+// to the result of comparison, counting the comparator call.
+#ifdef MAP_INSTRUMENT
+#define INSTRUMENT_OP(op) Op_scope instrument_scope_(&Op_counters::op)
+#define INSTRUMENT_NODE() Op_scope::visited()
+#define INSTRUMENT_COMPARE(comparison) (Op_scope::compared(), (comparison))
+#else
+#define INSTRUMENT_OP(op) ((void)0)
+#define INSTRUMENT_NODE() ((void)0)
+#define INSTRUMENT_COMPARE(comparison) (comparison)
+#endif
+
+#endif // INSTRUMENT_HPP
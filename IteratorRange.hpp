@@ -0,0 +1,42 @@
+#ifndef ITERATOR_RANGE_HPP
+#define ITERATOR_RANGE_HPP
+/* IteratorRange.hpp
+ *
+ * A view of the elements between two iterators, returned by the range()
+ * queries of BinarySearchTree, BTree and Map so that the result can be
+ * used directly in a range-based for loop:
+ *
+ *   for (auto &p : counts.range("cat", "cau")) { ... } // keys "cat..."
+ */
+
+template <typename Iterator>
+class Iterator_range {
+  // OVERVIEW: The elements from first up to but not including last. A
+  //           range does not own or copy the elements; it is invalidated
+  //           along with its iterators.
+
+public:
+  Iterator_range(Iterator first_in, Iterator last_in)
+    : first(first_in), last(last_in) { }
+
+  // EFFECTS: Returns an iterator to the first element of the range.
+  Iterator begin() const {
+    return first;
+  }
+
+  // EFFECTS: Returns an iterator past the last element of the range.
+  Iterator end() const {
+    return last;
+  }
+
+  // EFFECTS: Returns whether the range has no elements.
+  bool empty() const {
+    return first == last;
+  }
+
+private:
+  Iterator first;
+  Iterator last;
+};
+
+#endif // ITERATOR_RANGE_HPP
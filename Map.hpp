@@ -16,11 +16,64 @@
  */
 
 #include "BinarySearchTree.hpp"
+#include "BTree.hpp"
+#include "PersistentTree.hpp"
+#include "CompactTree.hpp"
+#include "Instrument.hpp"
 #include <cassert>  //assert
-#include <utility>  //pair
+#include <utility>  //pair, move, forward, piecewise_construct
+#include <tuple>    //forward_as_tuple
+
+// STORAGE
+// The Storage argument of a Map selects the tree that holds its
+// elements. A balancing policy (AVL_tree, Unbalanced_tree or
+// Splay_tree) selects a BinarySearchTree of (key, value) pairs with
+// that policy, and BTree_layout<Node_bytes> selects a BTree with nodes
+// of about Node_bytes bytes. Persistent_tree selects a PersistentTree, whose
+// copies share nodes, and Compact_tree selects a CompactTree, whose
+// nodes are linked by 32-bit positions in one vector. Map_storage maps
+// each choice to the tree type.
+template <typename Key_type, typename Pair_type, typename Key_compare,
+          typename Pair_compare, typename Storage, typename Allocator>
+struct Map_storage {
+  using type = BinarySearchTree<Pair_type, Pair_compare, Storage, Allocator>;
+};
+
+template <typename Key_type, typename Pair_type, typename Key_compare,
+          typename Pair_compare, size_t Node_bytes, typename Allocator>
+struct Map_storage<Key_type, Pair_type, Key_compare, Pair_compare,
+                   BTree_layout<Node_bytes>, Allocator> {
+  using type = BTree<Key_type, Pair_type, Select_first, Key_compare,
+                     Allocator, Node_bytes>;
+};
+
+template <typename Key_type, typename Pair_type, typename Key_compare,
+          typename Pair_compare, typename Allocator>
+struct Map_storage<Key_type, Pair_type, Key_compare, Pair_compare,
+                   Persistent_tree, Allocator> {
+  using type = PersistentTree<Pair_type, Pair_compare, Allocator>;
+};
+
+template <typename Key_type, typename Pair_type, typename Key_compare,
+          typename Pair_compare, typename Allocator>
+struct Map_storage<Key_type, Pair_type, Key_compare, Pair_compare,
+                   Compact_tree, Allocator> {
+  using type = CompactTree<Pair_type, Pair_compare, Allocator>;
+};
+
+// The Storage of a Map unless another is given. Compiling with
+// MAP_USE_BTREE defined makes it a BTree, so that any Map code can be
+// run against either kind of tree.
+#ifdef MAP_USE_BTREE
+using Map_default_storage = BTree_layout<>;
+#else
+using Map_default_storage = AVL_tree;
+#endif
 
 template <typename Key_type, typename Value_type,
-          typename Key_compare=std::less<Key_type> // default argument
+          typename Key_compare=std::less<Key_type>, // default argument
+          typename Storage=Map_default_storage, // tree that holds the elements
+          typename Allocator=std::allocator<std::pair<Key_type, Value_type>>
          >
 class Map {
 
@@ -32,13 +85,32 @@ private:
 
   // A custom comparator
   // Updated code
+  // PairComp compares pairs by key, and can also compare a pair directly
+  // against a bare key (or, with a transparent Key_compare, against any
+  // type Key_compare accepts), so lookups never build a dummy pair.
   class PairComp {
   public:
+    using is_transparent = void;
+
     bool operator()(const Pair_type& lhs, const Pair_type& rhs) const {
       return Key_compare{}(lhs.first, rhs.first);
     }
+
+    template <typename K>
+    bool operator()(const Pair_type& lhs, const K& rhs) const {
+      return Key_compare{}(lhs.first, rhs);
+    }
+
+    template <typename K>
+    bool operator()(const K& lhs, const Pair_type& rhs) const {
+      return Key_compare{}(lhs, rhs.first);
+    }
   };
 
+  // The tree that holds the pairs, as selected by Storage
+  using Tree = typename Map_storage<Key_type, Pair_type, Key_compare,
+                                    PairComp, Storage, Allocator>::type;
+
 public:
 
   // OVERVIEW: Maps are associative containers that store elements
@@ -52,11 +124,42 @@ public:
   //       are compared based on the key stored in the first member of
   //       the pair, rather than the built-in behavior that compares the
   //       both the key and the value stored in first/second of the pair.
+  //
+  // NOTE: Storage selects the tree (see Map_storage above). The
+  //       default, AVL_tree, keeps lookups and insertions logarithmic
+  //       even when keys arrive in sorted order. Use Unbalanced_tree to
+  //       get the plain leaf-insertion behavior, or BTree_layout<> to
+  //       store many pairs per node. With a BTree, inserting a pair
+  //       invalidates iterators and references into the Map.
+  //       Persistent_tree makes copying a Map take constant time; its
+  //       copies share pairs until they are changed, so with it, the
+  //       Iterators are read-only and values change only through
+  //       operator[]. Compact_tree packs the nodes into one
+  //       vector; as with a BTree, inserting a pair invalidates
+  //       iterators and references into the Map. Splay_tree moves each
+  //       key found or inserted to the root, which speeds up skewed
+  //       lookups; even find then modifies the Map, so a Map with it
+  //       must not be searched by several threads at once.
+  //
+  // NOTE: The Allocator is forwarded to the tree, which rebinds it to
+  //       allocate its nodes. See Arena.hpp for an allocator that keeps
+  //       nodes contiguous. It reuses the nodes of erased pairs, but
+  //       those of a Map that is cleared (or destroyed) with trivially
+  //       destructible keys and values only return with the arena.
 
   // Type alias for iterator type. It is sufficient to use the Iterator
-  // from BinarySearchTree<Pair_type> since it will yield elements of Pair_type
+  // of the underlying tree since it will yield elements of Pair_type
   // in the appropriate order for the Map.
-  using Iterator = typename BinarySearchTree<Pair_type, PairComp>::Iterator;
+  using Iterator = typename Tree::Iterator;
+
+  // Type alias for a reverse iterator, which visits the key-value pairs
+  // in descending order of key (see rbegin() and rend()).
+  using Reverse_iterator = typename Tree::Reverse_iterator;
+
+  // Type alias for a read-only snapshot of a Map (see freeze()). It
+  // supports find (by key), begin and end like a Map, but its elements
+  // cannot be modified.
+  using Frozen = FrozenTree<Pair_type, PairComp>;
 
   // You should add in a default constructor, destructor, copy
   // constructor, and overloaded assignment operator, if appropriate.
@@ -67,14 +170,47 @@ public:
   // Default constructor, destructor, copy constructor, and overloaded assignment operator
   // Updated code
   Map() = default;
+  explicit Map(const Allocator& alloc)
+    : tree(alloc) { }
+
+  // REQUIRES: [first, last) holds (key, value) pairs whose keys are in
+  //           strictly ascending order according to Key_compare
+  // EFFECTS : Constructs a Map holding those pairs in linear time. The
+  //           precondition is checked when assertions are enabled.
+  template <typename Iter>
+  Map(Iter first, Iter last, const Allocator& alloc = Allocator())
+    : tree(first, last, alloc) { }
   ~Map() = default;
   Map(const Map& other) = default;
   Map& operator=(const Map& other) = default;
 
+  // EFFECTS : Same as the copy constructor, but copies the tree in
+  //           parallel on pool, for very large Maps.
+  // NOTE : Only available with BinarySearchTree storage (AVL_tree,
+  //        Unbalanced_tree or Splay_tree). See the parallel copy
+  //        constructor of BinarySearchTree.
+  Map(const Map& other, ThreadPool& pool)
+    : tree(other.tree, pool) { }
+
+  // MODIFIES: this
+  // EFFECTS : Removes every element, freeing the tree in parallel on
+  //           pool. See BinarySearchTree::clear(pool) for when this is
+  //           faster than letting the Map go out of scope.
+  // NOTE : Only available with BinarySearchTree storage (AVL_tree,
+  //        Unbalanced_tree or Splay_tree).
+  void clear(ThreadPool& pool) {
+    tree.clear(pool);
+  }
+
+  // Move constructor and move assignment take over the other Map's tree
+  // without copying any element.
+  Map(Map&& other) = default;
+  Map& operator=(Map&& other) = default;
+
   // EFFECTS : Returns whether this Map is empty.
   // Updated code
   /*bool empty() const {
-    return bst.empty();
+    return tree.empty();
   }*/
   bool empty() const;
 
@@ -82,7 +218,7 @@ public:
   // NOTE : size_t is an integral type from the STL
   // Updated code
   /*size_t size() const {
-    return bst.size();
+    return tree.size();
   }*/
   size_t size() const;
 
@@ -90,12 +226,82 @@ public:
   // EFFECTS : Searches this Map for an element with a key equivalent
   //           to k and returns an Iterator to the associated value if found,
   //           otherwise returns an end Iterator.
-  //
-  // HINT: Since Map is implemented using a BinarySearchTree that stores
-  //       (key, value) pairs, you'll need to construct a dummy value
-  //       using "Value_type()".
+  // NOTE : k is compared directly against the stored keys; no pair
+  //        or Value_type is constructed.
   Iterator find(const Key_type& k) const;
 
+  // EFFECTS : Same as find(const Key_type&), but for any key type K that
+  //           Key_compare can compare against Key_type. Only available
+  //           when Key_compare is transparent (e.g. std::less<>), so that
+  //           Map<std::string, int, std::less<>>::find("word") does not
+  //           construct a std::string.
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator find(const K& k) const {
+    INSTRUMENT_OP(find);
+    return tree.find(k);
+  }
+
+  // REQUIRES: hint is an Iterator into this Map
+  // EFFECTS : Same as find(k), but with BinarySearchTree storage
+  //           (AVL_tree, Unbalanced_tree or Splay_tree) searches outward
+  //           from hint instead of down from the root. A key at hint or
+  //           at its in-order neighbour takes at most three comparisons,
+  //           as when looking up keys in ascending order starting each
+  //           time from the previous result. Other storages ignore the
+  //           hint.
+  Iterator find(Iterator hint, const Key_type& k) const {
+    INSTRUMENT_OP(find);
+    return tree.find(hint, k);
+  }
+
+  // EFFECTS : Returns an Iterator to the first element whose key is not
+  //           less than k, or an end Iterator if there is none.
+  // NOTE : This and the other ordered queries below take logarithmic
+  //        time, and the transparent overloads follow find.
+  Iterator lower_bound(const Key_type& k) const {
+    return tree.lower_bound(k);
+  }
+
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator lower_bound(const K& k) const {
+    return tree.lower_bound(k);
+  }
+
+  // EFFECTS : Returns an Iterator to the first element whose key is
+  //           greater than k, or an end Iterator if there is none.
+  Iterator upper_bound(const Key_type& k) const {
+    return tree.upper_bound(k);
+  }
+
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  Iterator upper_bound(const K& k) const {
+    return tree.upper_bound(k);
+  }
+
+  // EFFECTS : Returns the pair (lower_bound(k), upper_bound(k)), which
+  //           holds the element with key k if there is one.
+  std::pair<Iterator, Iterator> equal_range(const Key_type& k) const;
+
+  template <typename K, typename C = Key_compare,
+            typename = typename C::is_transparent>
+  std::pair<Iterator, Iterator> equal_range(const K& k) const {
+    return tree.equal_range(k);
+  }
+
+  // REQUIRES: low is not greater than high
+  // EFFECTS : Returns a view of the elements whose keys are not less than
+  //           low and less than high, in ascending order. Iterating over
+  //           it takes time proportional to the number of elements in it.
+  //           For example, the words beginning with "ca" in a
+  //           Map<std::string, int> counts are counts.range("ca", "cb").
+  Iterator_range<Iterator> range(const Key_type& low,
+                                 const Key_type& high) const {
+    return Iterator_range<Iterator>(lower_bound(low), lower_bound(high));
+  }
+
   // MODIFIES: this
   // EFFECTS : Returns a reference to the mapped value for the given
   //           key. If k matches the key of an element in the
@@ -114,6 +320,12 @@ public:
   // HINT: http://www.cplusplus.com/reference/map/map/operator[]/
   Value_type& operator[](const Key_type& k);
 
+  // Same as above, but moves k into the new element if one is inserted.
+  Value_type& operator[](Key_type&& k) {
+    INSTRUMENT_OP(subscript);
+    return mapped(try_emplace(std::move(k)).first);
+  }
+
   // MODIFIES: this
   // EFFECTS : Inserts the given element into this Map if the given key
   //           is not already contained in the Map. If the key is
@@ -124,6 +336,167 @@ public:
   //           the value true.
   std::pair<Iterator, bool> insert(const Pair_type &val);
 
+  // Same as above, but moves val into the Map if it is inserted.
+  std::pair<Iterator, bool> insert(Pair_type &&val) {
+    INSTRUMENT_OP(insert);
+    return tree.insert_unique(std::move(val));
+  }
+
+  // REQUIRES: hint is an Iterator into this Map
+  // MODIFIES: this
+  // EFFECTS : Inserts val if its key is not already contained in the
+  //           Map, and returns an Iterator to the element with that key
+  //           either way. With BinarySearchTree storage the search
+  //           starts from hint (see find(hint, k)), and a key that falls
+  //           between hint and its in-order neighbour is linked in after
+  //           at most three comparisons, as when inserting keys in
+  //           ascending order, each time with the Iterator returned by
+  //           the last insertion.
+  // NOTE : Only comparisons are saved; the insertion still takes
+  //        O(log n) time (see BinarySearchTree::insert(hint, item)), so
+  //        this beats insert(val) only when comparing keys is dear.
+  Iterator insert(Iterator hint, const Pair_type &val) {
+    INSTRUMENT_OP(insert);
+    return tree.try_emplace_hint(hint, val.first, val).first;
+  }
+
+  // Same as above, but moves val into the Map if it is inserted.
+  Iterator insert(Iterator hint, Pair_type &&val) {
+    INSTRUMENT_OP(insert);
+    return tree.try_emplace_hint(hint, val.first, std::move(val)).first;
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Constructs a (key, value) pair from args directly inside a
+  //           new tree node, and inserts it if its key is not already
+  //           contained in the Map. Returns the same as insert().
+  // NOTE : The pair is always constructed, since its key is needed for
+  //        the search. Prefer try_emplace when the key is at hand.
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args&&... args) {
+    INSTRUMENT_OP(insert);
+    return tree.emplace(std::forward<Args>(args)...);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : If k is already contained in the Map, returns an iterator
+  //           to its element along with false, and constructs nothing.
+  //           Otherwise, inserts an element whose key is k and whose
+  //           value is constructed in place from args, and returns an
+  //           iterator to it along with true.
+  template <typename... Args>
+  std::pair<Iterator, bool> try_emplace(const Key_type& k, Args&&... args) {
+    INSTRUMENT_OP(insert);
+    return tree.try_emplace(k, std::piecewise_construct,
+                           std::forward_as_tuple(k),
+                           std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  // Same as above, but moves k into the new element if one is inserted.
+  template <typename... Args>
+  std::pair<Iterator, bool> try_emplace(Key_type&& k, Args&&... args) {
+    INSTRUMENT_OP(insert);
+    return tree.try_emplace(k, std::piecewise_construct,
+                           std::forward_as_tuple(std::move(k)),
+                           std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  // REQUIRES: pos is a dereferenceable Iterator into this Map
+  // MODIFIES: this
+  // EFFECTS : Removes the element at pos, frees its memory, and returns
+  //           an Iterator to the element that followed it (or an end
+  //           Iterator). Takes logarithmic time with the default storage.
+  Iterator erase(Iterator pos) {
+    return tree.erase(pos);
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Removes the element with key k, if there is one. Returns
+  //           the number of elements removed (0 or 1).
+  size_t erase(const Key_type& k);
+
+  // MODIFIES: this, other
+  // EFFECTS : Adds every key-value pair of other to this Map, leaving
+  //           other empty. For a key contained in both, the value becomes
+  //           combine(this Map's value, other's value); for example,
+  //           std::plus<int>() adds two word counts. Takes linear time in
+  //           the total size, and the result is balanced. The elements of
+  //           other are taken over rather than copied, and with the
+  //           default storage and equal allocators even its nodes are
+  //           relinked into this Map. If combine throws, a Map with
+  //           BinarySearchTree storage loses nothing: this Map keeps
+  //           the pairs merged so far, other keeps the rest, and only
+  //           the value being combined may be left moved from. Other
+  //           storages rebuild from moved elements and give no such
+  //           guarantee.
+  template <typename Combine>
+  void merge(Map&& other, Combine combine) {
+    tree.merge(std::move(other.tree),
+               [&combine](Pair_type& mine, Pair_type&& theirs) {
+                 mine.second = combine(std::move(mine.second),
+                                       std::move(theirs.second));
+               });
+  }
+
+  // MODIFIES: this
+  // EFFECTS : Same as above, but copies the key-value pairs of other,
+  //           which is left unchanged.
+  template <typename Combine>
+  void merge(const Map& other, Combine combine) {
+    tree.merge(other.tree,
+               [&combine](Pair_type& mine, const Pair_type& theirs) {
+                 mine.second = combine(std::move(mine.second), theirs.second);
+               });
+  }
+
+  // REQUIRES: [first, last) holds (key, value) pairs whose keys are in
+  //           strictly ascending order according to Key_compare
+  // MODIFIES: this
+  // EFFECTS : Replaces the contents of this Map with those pairs, in
+  //           linear time. The precondition is checked when assertions
+  //           are enabled.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    tree.assign(first, last);
+  }
+
+  // EFFECTS : Returns a read-only snapshot of the contents of this Map,
+  //           stored in one contiguous array for cache-friendly lookups.
+  //           Use it once the Map will no longer change (for example,
+  //           after training). Takes linear time.
+  Frozen freeze() const {
+    return Frozen(tree.begin(), tree.end());
+  }
+
+  // REQUIRES: visit may be called concurrently from several threads, each
+  //           time on a different key-value pair, and does not change
+  //           the keys
+  // EFFECTS : Calls visit(pair) once for each key-value pair, in no
+  //           particular order, spreading the calls over the threads of
+  //           pool; for example, to recompute a value derived from each
+  //           count. Returns once every call has finished.
+  // NOTE : Only available with BinarySearchTree storage (AVL_tree,
+  //        Unbalanced_tree or Splay_tree). See
+  //        BinarySearchTree::parallel_for_each. A Splay_tree may be
+  //        traversed by several threads at once only because this
+  //        walks the nodes without splaying; it must not be searched
+  //        while the calls run.
+  template <typename Visit>
+  void parallel_for_each(Visit visit, ThreadPool &pool) const {
+    tree.parallel_for_each(visit, pool);
+  }
+
+  // EFFECTS : Returns statistics on the shape of the underlying tree
+  //           (node count, memory, depths, expected comparisons per
+  //           find), for comparing storage policies on real data.
+  // NOTE : Only available with BinarySearchTree storage (AVL_tree,
+  //        Unbalanced_tree or Splay_tree). See BinarySearchTree::stats;
+  //        it does not splay, so the statistics of a Splay_tree
+  //        describe its shape as left by the last search.
+  Tree_stats stats() const {
+    return tree.stats();
+  }
+
   // EFFECTS : Returns an iterator to the first key-value pair in this Map.
   Iterator begin() const;
 
@@ -131,79 +504,130 @@ public:
   // Updated code
   Iterator end() const;
 
+  // EFFECTS : Returns a reverse iterator to the last key-value pair in
+  //           this Map. Stepping backwards costs the same as stepping
+  //           forwards, so descending scans need no copy of the Map.
+  Reverse_iterator rbegin() const {
+    return tree.rbegin();
+  }
+
+  // EFFECTS : Returns a reverse iterator to "past-the-end" in descending
+  //           order, before the first key-value pair.
+  Reverse_iterator rend() const {
+    return tree.rend();
+  }
+
 private:
   // Add a BinarySearchTree private member HERE.
   // Updated code
-  BinarySearchTree<Pair_type, PairComp> bst;
+  Tree tree;
+
+  // REQUIRES: pos was returned by try_emplace on this Map, which has not
+  //           been modified since
+  // EFFECTS : Returns the mapped value of the pair at pos for writing.
+  //           The Iterators of a PersistentTree are read-only, because
+  //           their pairs may be shared with copies of the Map, so it
+  //           goes through PersistentTree::writable instead.
+  Value_type &mapped(Iterator pos) {
+    return mapped_impl(tree, pos);
+  }
+
+  template <typename Any_tree>
+  static Value_type &mapped_impl(Any_tree &, Iterator pos) {
+    return pos->second;
+  }
+
+  template <typename Compare, typename Alloc>
+  static Value_type &mapped_impl(PersistentTree<Pair_type, Compare, Alloc> &t,
+                                 Iterator pos) {
+    return t.writable(pos).second;
+  }
 };
 
 // You may implement member functions below using an "out-of-line" definition
 // or you may simply define them "in-line" in the class definition above.
 // If you choose to define them "out-of-line", here is an example.
-// (Note that we're using K, V, and C as shorthands for Key_type,
-// Value_type, and Key_compare, respectively - the compiler doesn't
-// mind, and will just match them up by position.)
-//    template <typename K, typename V, typename C>
-//    typename Map<K, V, C>::Iterator Map<K, V, C>::begin() const {
+// (Note that we're using K, V, C, S, and A as shorthands for Key_type,
+// Value_type, Key_compare, Storage, and Allocator, respectively - the
+// compiler doesn't mind, and will just match them up by position.)
+//    template <typename K, typename V, typename C, typename S, typename A>
+//    typename Map<K, V, C, S, A>::Iterator Map<K, V, C, S, A>::begin() const {
 //      // YOUR IMPLEMENTATION GOES HERE
 //    }
 
 // Updated code for Empty function 
-template <typename Key_type, typename Value_type, typename Key_compare>
-bool Map<Key_type, Value_type, Key_compare>::empty() const {
-  return bst.empty();
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+bool Map<Key_type, Value_type, Key_compare, Storage, Allocator>::empty() const {
+  return tree.empty();
 }
 
 // Updated code for Size function 
-template <typename Key_type, typename Value_type, typename Key_compare>
-size_t Map<Key_type, Value_type, Key_compare>::size() const {
-    return bst.size();
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+size_t Map<Key_type, Value_type, Key_compare, Storage, Allocator>::size() const {
+    return tree.size();
 }
 
 // Updated code for Find function 
-template <typename Key_type, typename Value_type, typename Key_compare>
-typename Map<Key_type, Value_type, Key_compare>::Iterator Map<Key_type, Value_type, Key_compare>::find(const Key_type& k) const {
-  Pair_type dummy_pair{k, Value_type()}; // Create a dummy pair with the key k
-  return bst.find(dummy_pair); // Call the find function of the BinarySearchTree
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+typename Map<Key_type, Value_type, Key_compare, Storage, Allocator>::Iterator Map<Key_type, Value_type, Key_compare, Storage, Allocator>::find(const Key_type& k) const {
+  INSTRUMENT_OP(find);
+  return tree.find(k); // Compare k against the keys stored in the tree
+}
+
+// Updated code for Equal_range function 
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+std::pair<typename Map<Key_type, Value_type, Key_compare, Storage, Allocator>::Iterator, typename Map<Key_type, Value_type, Key_compare, Storage, Allocator>::Iterator> Map<Key_type, Value_type, Key_compare, Storage, Allocator>::equal_range(const Key_type& k) const {
+  return tree.equal_range(k); // compares k against the stored keys
 }
 
 // Updated code for Operator function 
-template <typename Key_type, typename Value_type, typename Key_compare>
-Value_type& Map<Key_type, Value_type, Key_compare>::operator[](const Key_type& k) {
-  auto it = find(k); // Find the element with key k
-  if (it == end()) { // If key does not exist, insert it with default value
-    it = insert({k, Value_type()}).first;
-  }
-  return (*it).second; // Return a reference to the value associated with the key
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+Value_type& Map<Key_type, Value_type, Key_compare, Storage, Allocator>::operator[](const Key_type& k) {
+  // Find the element with key k, inserting it with a value-initialized
+  // value if it does not exist, in a single descent of the tree. No
+  // value is constructed when k is already present.
+  INSTRUMENT_OP(subscript);
+  return mapped(try_emplace(k).first);
 }
 
 // Updated code for Insert function 
-template <typename Key_type, typename Value_type, typename Key_compare>
-std::pair<typename Map<Key_type, Value_type, Key_compare>::Iterator, bool> Map<Key_type, Value_type, Key_compare>::insert(const Pair_type &val) {
-    // Attempt to insert the value into the binary search tree
-    Iterator inserted = bst.insert(val);
-    
-    // Check if the insertion was successful
-    if (inserted != end()) {
-        // If the element was inserted successfully, return the iterator to the newly inserted element and true
-        return std::make_pair(inserted, true);
-    } else {
-        // If the element already exists, return the iterator to the existing element and false
-        Iterator existing = find(val.first);
-        return std::make_pair(existing, false);
-    }
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+std::pair<typename Map<Key_type, Value_type, Key_compare, Storage, Allocator>::Iterator, bool> Map<Key_type, Value_type, Key_compare, Storage, Allocator>::insert(const Pair_type &val) {
+    // Either inserts val or locates the existing element with the same key
+    INSTRUMENT_OP(insert);
+    return tree.insert_unique(val);
+}
+
+// Updated code for Erase function 
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+size_t Map<Key_type, Value_type, Key_compare, Storage, Allocator>::erase(const Key_type& k) {
+  Iterator pos = find(k);
+  if (pos == end()) {
+    return 0;
+  }
+  tree.erase(pos);
+  return 1;
 }
 
 // Updated code for Begin function 
-template <typename Key_type, typename Value_type, typename Key_compare>
-typename Map<Key_type, Value_type, Key_compare>::Iterator Map<Key_type, Value_type, Key_compare>::begin() const {
-  return bst.begin(); // Call the begin function of the BinarySearchTree
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+typename Map<Key_type, Value_type, Key_compare, Storage, Allocator>::Iterator Map<Key_type, Value_type, Key_compare, Storage, Allocator>::begin() const {
+  return tree.begin(); // Call the begin function of the tree
 }
 
 // Updated code for End function 
-template <typename Key_type, typename Value_type, typename Key_compare>
-typename Map<Key_type, Value_type, Key_compare>::Iterator Map<Key_type, Value_type, Key_compare>::end() const {
-  return bst.end(); // Call the end function of the BinarySearchTree
+template <typename Key_type, typename Value_type, typename Key_compare,
+          typename Storage, typename Allocator>
+typename Map<Key_type, Value_type, Key_compare, Storage, Allocator>::Iterator Map<Key_type, Value_type, Key_compare, Storage, Allocator>::end() const {
+  return tree.end(); // Call the end function of the tree
 }
 
 
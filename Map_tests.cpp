@@ -0,0 +1,1057 @@
+#include "Map.hpp"
+#include "ConcurrentMap.hpp"
+#include "HashMap.hpp"
+#include "StringPool.hpp"
+#include "Arena.hpp"
+#include "unit_test_framework.hpp"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+TEST(test_map_sorted_keys_iterate_in_order) {
+    Map<int, int> map;
+    for (int i = 0; i < 1000; ++i) {
+        map[i] = i * 2;
+    }
+    ASSERT_EQUAL(map.size(), 1000);
+
+    int expected = 0;
+    for (auto &p : map) {
+        ASSERT_EQUAL(p.first, expected);
+        ASSERT_EQUAL(p.second, expected * 2);
+        ++expected;
+    }
+    ASSERT_EQUAL(expected, 1000);
+}
+
+TEST(test_map_unbalanced_policy) {
+    Map<string, int, std::less<string>, Unbalanced_tree> map;
+    map["b"] = 2;
+    map["a"] = 1;
+    map["c"] = 3;
+
+    vector<string> keys;
+    for (auto &p : map) {
+        keys.push_back(p.first);
+    }
+    vector<string> expected = { "a", "b", "c" };
+    ASSERT_EQUAL(keys, expected);
+    ASSERT_EQUAL(map.find("b")->second, 2);
+    ASSERT_EQUAL(map.find("z"), map.end());
+}
+
+TEST(test_map_insert_existing_key) {
+    Map<string, int> map;
+    auto first = map.insert({"word", 1});
+    ASSERT_TRUE(first.second);
+    ASSERT_EQUAL(first.first->second, 1);
+
+    auto second = map.insert({"word", 2});
+    ASSERT_FALSE(second.second);
+    ASSERT_EQUAL(second.first, first.first);
+    ASSERT_EQUAL(map["word"], 1); // existing value is kept
+    ASSERT_EQUAL(map.size(), 1);
+}
+
+TEST(test_map_subscript_counts) {
+    Map<string, int> counts;
+    vector<string> words = { "the", "cat", "the", "hat", "the", "cat" };
+    for (const string &w : words) {
+        ++counts[w];
+    }
+    ASSERT_EQUAL(counts.size(), 3);
+    ASSERT_EQUAL(counts["the"], 3);
+    ASSERT_EQUAL(counts["cat"], 2);
+    ASSERT_EQUAL(counts["hat"], 1);
+}
+
+// A value type that counts how many times it is default constructed
+struct Counted_value {
+    static int constructions;
+    Counted_value() { ++constructions; }
+};
+int Counted_value::constructions = 0;
+
+TEST(test_map_find_does_not_construct_value) {
+    Map<int, Counted_value> map;
+    map[1];
+    map[2];
+    Counted_value::constructions = 0;
+    ASSERT_NOT_EQUAL(map.find(1), map.end());
+    ASSERT_EQUAL(map.find(3), map.end());
+    ASSERT_EQUAL(Counted_value::constructions, 0);
+}
+
+TEST(test_map_transparent_find) {
+    Map<string, int, std::less<>> map;
+    map["apple"] = 1;
+    map["banana"] = 2;
+
+    ASSERT_EQUAL(map.find("apple")->second, 1);
+    std::string_view key = "banana";
+    ASSERT_EQUAL(map.find(key)->second, 2);
+    ASSERT_EQUAL(map.find(std::string_view("cherry")), map.end());
+    ASSERT_EQUAL(map.find(string("apple")), map.begin());
+
+    auto present = map.equal_range(key);
+    ASSERT_EQUAL(present.first->second, 2);
+    ASSERT_EQUAL(present.second, map.end());
+    auto absent = map.equal_range("avocado");
+    ASSERT_EQUAL(absent.first, absent.second);
+    ASSERT_EQUAL(absent.first->first, "banana");
+
+    // A string_view converts to string only explicitly, so these compile
+    // only if the BTree storage compares it directly
+    Map<string, int, std::less<>, BTree_layout<>> btree_map;
+    btree_map["apple"] = 1;
+    btree_map["banana"] = 2;
+    auto btree_present = btree_map.equal_range(key);
+    ASSERT_EQUAL(btree_present.first->second, 2);
+    ASSERT_EQUAL(btree_present.second, btree_map.end());
+    auto btree_absent = btree_map.equal_range(std::string_view("avocado"));
+    ASSERT_EQUAL(btree_absent.first, btree_absent.second);
+    ASSERT_EQUAL(btree_absent.first->first, "banana");
+}
+
+TEST(test_map_arena_allocator) {
+    using Arena_map = Map<string, int, std::less<string>, AVL_tree,
+                          Arena_allocator<std::pair<string, int>>>;
+    Arena_map map;
+    map["one"] = 1;
+    map["two"] = 2;
+    map["three"] = 3;
+    Arena_map copy_map(map);
+    copy_map["four"] = 4;
+    ASSERT_EQUAL(map.size(), 3);
+    ASSERT_EQUAL(copy_map.size(), 4);
+    ASSERT_EQUAL(copy_map["two"], 2);
+}
+
+TEST(test_map_arena_reuses_erased_nodes) {
+    using Arena_map = Map<int, int, std::less<int>, AVL_tree,
+                          Arena_allocator<std::pair<int, int>>>;
+    auto arena = std::make_shared<Arena>();
+    Arena_map map{ Arena_allocator<std::pair<int, int>>(arena) };
+    for (int i = 0; i < 1000; ++i) {
+        map[i] = i;
+    }
+    size_t reserved = arena->bytes_reserved();
+    for (int round = 1; round <= 20; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            ASSERT_EQUAL(map.erase(i + round - 1), 1);
+        }
+        for (int i = 0; i < 1000; ++i) {
+            map[i + round] = i;
+        }
+    }
+    ASSERT_EQUAL(map.size(), 1000);
+    ASSERT_EQUAL(arena->bytes_reserved(), reserved);
+}
+
+TEST(test_map_from_sorted_range) {
+    vector<std::pair<string, int>> sorted = {
+        { "apple", 1 }, { "banana", 2 }, { "cherry", 3 }, { "date", 4 }
+    };
+    Map<string, int> map(sorted.begin(), sorted.end());
+    ASSERT_EQUAL(map.size(), 4);
+    ASSERT_EQUAL(map["cherry"], 3);
+
+    map.assign(sorted.begin(), sorted.begin() + 2);
+    ASSERT_EQUAL(map.size(), 2);
+    ASSERT_EQUAL(map.find("cherry"), map.end());
+    ASSERT_EQUAL(map.begin()->first, "apple");
+}
+
+TEST(test_map_subscript_skips_value_construction) {
+    Map<int, Counted_value> map;
+    map[1];
+    Counted_value::constructions = 0;
+    map[1];
+    ASSERT_EQUAL(Counted_value::constructions, 0);
+    map[2];
+    ASSERT_EQUAL(Counted_value::constructions, 1);
+}
+
+TEST(test_map_try_emplace_and_emplace) {
+    Map<string, string> map;
+    auto result = map.try_emplace("key", 3, 'x');
+    ASSERT_TRUE(result.second);
+    ASSERT_EQUAL(result.first->second, "xxx");
+    result = map.try_emplace("key", 5, 'y');
+    ASSERT_FALSE(result.second);
+    ASSERT_EQUAL(result.first->second, "xxx");
+
+    result = map.emplace("other", "value");
+    ASSERT_TRUE(result.second);
+    ASSERT_EQUAL(map["other"], "value");
+}
+
+TEST(test_map_move) {
+    Map<string, Map<string, int>> nested;
+    nested["label"]["word"] = 3;
+    string key = "another";
+    nested[std::move(key)]["x"] = 1;
+    ASSERT_EQUAL(nested.size(), 2);
+
+    auto it = nested.find("label");
+    Map<string, Map<string, int>> moved(std::move(nested));
+    ASSERT_TRUE(nested.empty());
+    ASSERT_EQUAL(moved.find("label"), it);
+    ASSERT_EQUAL(moved["label"]["word"], 3);
+
+    Map<string, int> inner;
+    inner.insert(std::make_pair(string("a"), 1));
+    moved["label"] = std::move(inner);
+    ASSERT_EQUAL(moved["label"].size(), 1);
+    ASSERT_TRUE(inner.empty());
+}
+
+TEST(test_map_freeze) {
+    Map<string, int> map;
+    map["the"] = 10;
+    map["cat"] = 2;
+    map["hat"] = 1;
+    Map<string, int>::Frozen frozen = map.freeze();
+    ASSERT_EQUAL(frozen.size(), 3);
+    ASSERT_EQUAL(frozen.find("cat")->second, 2);
+    ASSERT_EQUAL(frozen.find(string("the"))->second, 10);
+    ASSERT_EQUAL(frozen.find("dog"), frozen.end());
+
+    vector<string> keys;
+    for (const auto &p : frozen) {
+        keys.push_back(p.first);
+    }
+    vector<string> expected = { "cat", "hat", "the" };
+    ASSERT_EQUAL(keys, expected);
+
+    // The snapshot is independent of later changes to the Map
+    map["dog"] = 4;
+    ASSERT_EQUAL(frozen.find("dog"), frozen.end());
+}
+
+TEST(test_btree_map_random_keys) {
+    vector<int> keys;
+    for (int i = 0; i < 10000; ++i) {
+        keys.push_back(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(280));
+
+    Map<int, int, std::less<int>, BTree_layout<>> map;
+    for (int k : keys) {
+        map[k] = k * 2;
+    }
+    ASSERT_EQUAL(map.size(), 10000);
+    int expected = 0;
+    for (auto &p : map) {
+        ASSERT_EQUAL(p.first, expected);
+        ASSERT_EQUAL(p.second, expected * 2);
+        ++expected;
+    }
+    ASSERT_EQUAL(expected, 10000);
+    for (int k : keys) {
+        ASSERT_EQUAL(map.find(k)->second, k * 2);
+    }
+    ASSERT_EQUAL(map.find(-1), map.end());
+    ASSERT_EQUAL(map.find(10000), map.end());
+    ASSERT_FALSE(map.insert({ 5, 0 }).second);
+}
+
+TEST(test_btree_invariants_with_small_nodes) {
+    // 64-byte nodes hold only a few keys, so the tree gets several levels
+    using Small_tree = BTree<int, int, Select_self, std::less<int>,
+                             std::allocator<int>, 64>;
+    Small_tree ascending;
+    Small_tree descending;
+    Small_tree shuffled;
+    vector<int> keys;
+    for (int i = 0; i < 2000; ++i) {
+        ascending.insert_unique(i);
+        descending.insert_unique(1999 - i);
+        keys.push_back(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(280));
+    for (int k : keys) {
+        shuffled.insert_unique(k);
+    }
+    for (const Small_tree *tree : { &ascending, &descending, &shuffled }) {
+        ASSERT_TRUE(tree->check_invariants());
+        ASSERT_EQUAL(tree->size(), 2000);
+        ASSERT_TRUE(tree->height() > 3);
+        ASSERT_TRUE(std::equal(tree->begin(), tree->end(),
+                               ascending.begin()));
+        ASSERT_EQUAL(*tree->find(1234), 1234);
+    }
+    // Sorted insertion leaves every leaf but the last full
+    ASSERT_TRUE(ascending.height() <= descending.height());
+}
+
+TEST(test_btree_map_string_keys_copy_and_assign) {
+    using Btree_map = Map<string, int, std::less<string>, BTree_layout<>>;
+    Btree_map map;
+    for (int i = 0; i < 500; ++i) {
+        map[std::to_string(i)] = i;
+    }
+    Btree_map copy_map(map);
+    copy_map["extra"] = -1;
+    ASSERT_EQUAL(map.size(), 500);
+    ASSERT_EQUAL(copy_map.size(), 501);
+    ASSERT_EQUAL(map.find("extra"), map.end());
+    ASSERT_EQUAL(copy_map["250"], 250);
+
+    vector<std::pair<string, int>> sorted(map.begin(), map.end());
+    Btree_map assigned;
+    assigned.assign(sorted.begin(), sorted.end());
+    ASSERT_EQUAL(assigned.size(), 500);
+    ASSERT_TRUE(std::equal(assigned.begin(), assigned.end(), map.begin()));
+
+    Btree_map moved(std::move(assigned));
+    ASSERT_TRUE(assigned.empty());
+    ASSERT_EQUAL(moved.find("499")->second, 499);
+}
+
+TEST(test_btree_assign_builds_full_nodes) {
+    using Small_tree = BTree<int, int, Select_self, std::less<int>,
+                             std::allocator<int>, 64>;
+    vector<int> keys;
+    for (int i = 0; i < 1000; ++i) {
+        keys.push_back(i);
+    }
+    Small_tree tree(keys.begin(), keys.end());
+    ASSERT_TRUE(tree.check_invariants());
+    ASSERT_EQUAL(tree.size(), 1000);
+    ASSERT_TRUE(std::equal(tree.begin(), tree.end(), keys.begin()));
+
+    Small_tree empty_tree(keys.begin(), keys.begin());
+    ASSERT_TRUE(empty_tree.empty());
+    ASSERT_EQUAL(empty_tree.begin(), empty_tree.end());
+    ASSERT_EQUAL(empty_tree.height(), 0);
+}
+
+TEST(test_map_erase) {
+    Map<string, int> map;
+    map["a"] = 1;
+    map["b"] = 2;
+    map["c"] = 3;
+    ASSERT_EQUAL(map.erase("b"), 1);
+    ASSERT_EQUAL(map.erase("b"), 0);
+    ASSERT_EQUAL(map.find("b"), map.end());
+    auto next = map.erase(map.find("a"));
+    ASSERT_EQUAL(next->first, "c");
+    ASSERT_EQUAL(map.erase(next), map.end());
+    ASSERT_TRUE(map.empty());
+    map["d"] = 4;
+    ASSERT_EQUAL(map.begin()->second, 4);
+}
+
+TEST(test_btree_erase_keeps_invariants) {
+    using Small_tree = BTree<int, int, Select_self, std::less<int>,
+                             std::allocator<int>, 64>;
+    vector<int> keys;
+    for (int i = 0; i < 3000; ++i) {
+        keys.push_back(i);
+    }
+    Small_tree tree(keys.begin(), keys.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(280));
+    for (size_t i = 0; i < keys.size(); ++i) {
+        int victim = keys[i];
+        auto next = tree.erase(tree.find(victim));
+        // The returned Iterator points at the next larger remaining key
+        int expected = victim + 1;
+        while (expected < 3000 && tree.find(expected) == tree.end()) {
+            ++expected;
+        }
+        if (expected == 3000) {
+            ASSERT_EQUAL(next, tree.end());
+        } else {
+            ASSERT_EQUAL(*next, expected);
+        }
+        if (i % 100 == 0) {
+            ASSERT_TRUE(tree.check_invariants());
+            ASSERT_EQUAL(tree.size(), keys.size() - i - 1);
+        }
+    }
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQUAL(tree.height(), 0);
+    ASSERT_TRUE(tree.check_invariants());
+
+    // Emptied and refilled by erasing in both directions
+    for (int i = 0; i < 500; ++i) {
+        tree.insert_unique(i);
+    }
+    for (int i = 0; i < 250; ++i) {
+        ASSERT_EQUAL(tree.erase(i), 1);
+        ASSERT_EQUAL(tree.erase(499 - i), 1);
+    }
+    ASSERT_TRUE(tree.empty());
+    ASSERT_TRUE(tree.check_invariants());
+}
+
+TEST(test_btree_map_erase_strings) {
+    Map<string, int, std::less<string>, BTree_layout<>> map;
+    for (int i = 0; i < 1000; ++i) {
+        map[std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        ASSERT_EQUAL(map.erase(std::to_string(i)), 1);
+    }
+    ASSERT_EQUAL(map.size(), 500);
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQUAL(map.find(std::to_string(i)) == map.end(), i % 2 == 0);
+    }
+    size_t remaining = 0;
+    for (auto it = map.begin(); it != map.end(); ) {
+        it = map.erase(it);
+        ++remaining;
+    }
+    ASSERT_EQUAL(remaining, 500);
+    ASSERT_TRUE(map.empty());
+}
+
+TEST(test_map_prefix_range) {
+    Map<string, int> counts;
+    for (const char *word : { "car", "cat", "cab", "dog", "bat", "ca" }) {
+        counts[word] = 1;
+    }
+    vector<string> words;
+    for (const auto &p : counts.range("ca", "cb")) {
+        words.push_back(p.first);
+    }
+    vector<string> expected = { "ca", "cab", "car", "cat" };
+    ASSERT_EQUAL(words, expected);
+
+    ASSERT_EQUAL(counts.lower_bound("cb")->first, "dog");
+    ASSERT_EQUAL(counts.upper_bound("cat")->first, "dog");
+    ASSERT_EQUAL(counts.upper_bound("dog"), counts.end());
+    auto range = counts.equal_range("car");
+    ASSERT_EQUAL(range.first->first, "car");
+    ASSERT_EQUAL(range.second->first, "cat");
+}
+
+TEST(test_map_pair_key_range) {
+    using Label_word = std::pair<string, string>;
+    Map<Label_word, int> counts;
+    counts[{ "euchre", "bid" }] = 3;
+    counts[{ "calculator", "stack" }] = 1;
+    counts[{ "euchre", "trump" }] = 2;
+    counts[{ "image", "seam" }] = 5;
+
+    // Every (label, word) pair for one label, without a full scan
+    int total = 0;
+    size_t entries = 0;
+    for (const auto &p : counts.range({ "euchre", "" }, { "euchre\x01", "" })) {
+        total += p.second;
+        ++entries;
+    }
+    ASSERT_EQUAL(entries, 2);
+    ASSERT_EQUAL(total, 5);
+}
+
+TEST(test_btree_map_bounds_cross_leaves) {
+    Map<int, int, std::less<int>, BTree_layout<64>> map;
+    for (int i = 0; i < 1000; i += 10) {
+        map[i] = i;
+    }
+    for (int q = -5; q < 1005; ++q) {
+        int expected_lower = q <= 0 ? 0 : (q + 9) / 10 * 10;
+        int expected_upper = q < 0 ? 0 : (q / 10 + 1) * 10;
+        auto lower = map.lower_bound(q);
+        auto upper = map.upper_bound(q);
+        if (expected_lower >= 1000) {
+            ASSERT_EQUAL(lower, map.end());
+        } else {
+            ASSERT_EQUAL(lower->first, expected_lower);
+        }
+        if (expected_upper >= 1000) {
+            ASSERT_EQUAL(upper, map.end());
+        } else {
+            ASSERT_EQUAL(upper->first, expected_upper);
+        }
+    }
+    size_t count = 0;
+    for (const auto &p : map.range(95, 505)) {
+        ASSERT_TRUE(p.first >= 95 && p.first < 505);
+        ++count;
+    }
+    ASSERT_EQUAL(count, 41);
+}
+
+// EFFECTS: Returns the keys of map in descending order, both by reverse
+//          iteration and by decrementing from end().
+template <typename Map_type>
+static std::pair<vector<int>, vector<int>>
+descending_keys(const Map_type &map) {
+    vector<int> reversed;
+    for (auto it = map.rbegin(); it != map.rend(); ++it) {
+        reversed.push_back(it->first);
+    }
+    vector<int> decremented;
+    for (auto it = map.end(); it != map.begin(); ) {
+        --it;
+        decremented.push_back(it->first);
+    }
+    return { reversed, decremented };
+}
+
+TEST(test_map_reverse_iteration) {
+    Map<int, int> avl_map;
+    Map<int, int, std::less<int>, BTree_layout<64>> btree_map;
+    vector<int> expected;
+    for (int i = 0; i < 500; ++i) {
+        avl_map[i * 3 % 500] = i;
+        btree_map[i * 3 % 500] = i;
+        expected.push_back(499 - i);
+    }
+    auto avl_keys = descending_keys(avl_map);
+    auto btree_keys = descending_keys(btree_map);
+    ASSERT_EQUAL(avl_keys.first, expected);
+    ASSERT_EQUAL(avl_keys.second, expected);
+    ASSERT_EQUAL(btree_keys.first, expected);
+    ASSERT_EQUAL(btree_keys.second, expected);
+
+    // Largest counts first
+    auto top = btree_map.rbegin();
+    ASSERT_EQUAL(top->first, 499);
+    ASSERT_EQUAL((++top)->first, 498);
+    auto it = btree_map.find(250);
+    --it;
+    ASSERT_EQUAL(it->first, 249);
+    ++it;
+    ASSERT_EQUAL(it->first, 250);
+}
+
+// EFFECTS: Counts two overlapping sets of words into two Maps with the
+//          given storage, merges them, and checks the combined counts.
+template <typename Storage>
+static void check_merge_counts() {
+    using Counts = Map<string, int, std::less<string>, Storage>;
+    Counts first;
+    Counts second;
+    for (int i = 0; i < 1000; ++i) {
+        ++first[std::to_string(i)];
+    }
+    for (int i = 500; i < 2000; ++i) {
+        second[std::to_string(i)] += 2;
+    }
+    Counts copy_first(first);
+    copy_first.merge(second, std::plus<int>());
+    ASSERT_EQUAL(second.size(), 1500); // merged by copy
+
+    first.merge(std::move(second), std::plus<int>());
+    ASSERT_TRUE(second.empty());
+    ASSERT_EQUAL(first.size(), 2000);
+    ASSERT_EQUAL(first["0"], 1);
+    ASSERT_EQUAL(first["750"], 3);
+    ASSERT_EQUAL(first["1500"], 2);
+    ASSERT_TRUE(std::equal(first.begin(), first.end(), copy_first.begin(),
+                           copy_first.end()));
+}
+
+TEST(test_map_merge_counts) {
+    check_merge_counts<AVL_tree>();
+    check_merge_counts<BTree_layout<>>();
+    check_merge_counts<Persistent_tree>();
+    check_merge_counts<Compact_tree>();
+    check_merge_counts<Splay_tree>();
+}
+
+TEST(test_map_merge_nested) {
+    using Label_counts = Map<string, Map<string, int>>;
+    Label_counts shard1;
+    Label_counts shard2;
+    shard1["euchre"]["trump"] = 2;
+    shard1["image"]["seam"] = 1;
+    shard2["euchre"]["trump"] = 3;
+    shard2["euchre"]["bid"] = 1;
+    shard1.merge(std::move(shard2), [](Map<string, int> mine,
+                                       Map<string, int> theirs) {
+        mine.merge(std::move(theirs), std::plus<int>());
+        return mine;
+    });
+    ASSERT_EQUAL(shard1.size(), 2);
+    ASSERT_EQUAL(shard1["euchre"]["trump"], 5);
+    ASSERT_EQUAL(shard1["euchre"]["bid"], 1);
+    ASSERT_EQUAL(shard1["image"]["seam"], 1);
+}
+
+TEST(test_map_parallel_for_each_updates_values) {
+    Map<int, std::pair<int, double>, std::less<int>, AVL_tree> counts;
+    for (int i = 0; i < 10000; ++i) {
+        counts[i].first = i % 7 + 1;
+    }
+    ThreadPool pool(3);
+    counts.parallel_for_each([](auto &entry) {
+        entry.second.second = 0.5 * entry.second.first;
+    }, pool);
+    for (const auto &entry : counts) {
+        ASSERT_EQUAL(entry.second.second, 0.5 * (entry.first % 7 + 1));
+    }
+}
+
+// EFFECTS: Inserts words in ascending order into a Map with the given
+//          storage, each time hinting with the previous result, and
+//          looks them up the same way.
+template <typename Storage>
+static void check_hinted_insert() {
+    Map<string, int, std::less<string>, Storage> counts;
+    auto hint = counts.end();
+    for (int i = 100; i < 400; ++i) {
+        hint = counts.insert(hint, { std::to_string(i), i });
+    }
+    hint = counts.insert(counts.begin(), { "250", -1 }); // already there
+    ASSERT_EQUAL(hint->second, 250);
+    hint = counts.insert(hint, { "0", 0 });
+    ASSERT_EQUAL(counts.begin(), hint);
+    ASSERT_EQUAL(counts.size(), 301);
+    auto it = counts.begin();
+    for (int i = 100; i < 400; ++i) {
+        it = counts.find(it, std::to_string(i));
+        ASSERT_EQUAL(it->second, i);
+    }
+    ASSERT_EQUAL(counts.find(it, "1000"), counts.end());
+}
+
+TEST(test_map_hinted_insert) {
+    check_hinted_insert<AVL_tree>();
+    check_hinted_insert<Splay_tree>();
+    check_hinted_insert<BTree_layout<>>();
+    check_hinted_insert<Persistent_tree>();
+    check_hinted_insert<Compact_tree>();
+}
+
+// Counts the instances alive, and throws from the copy constructor once
+// copies_left runs out
+struct Fragile {
+    static int live;
+    static int copies_left;
+    Fragile() { ++live; }
+    Fragile(const Fragile &) {
+        if (copies_left-- == 0) {
+            throw std::runtime_error("copy");
+        }
+        ++live;
+    }
+    ~Fragile() { --live; }
+};
+
+int Fragile::live = 0;
+int Fragile::copies_left = 0;
+
+TEST(test_map_btree_build_and_copy_free_nodes_when_a_copy_throws) {
+    using Fragile_map = Map<int, Fragile, std::less<int>, BTree_layout<64>>;
+    std::vector<std::pair<int, Fragile>> sorted(200);
+    for (int i = 0; i < 200; ++i) {
+        sorted[i].first = i;
+    }
+    Fragile::copies_left = 200;
+    Fragile_map map(sorted.begin(), sorted.end());
+    ASSERT_EQUAL(Fragile::live, 400);
+    for (int budget : { 0, 1, 77, 199 }) {
+        Fragile::copies_left = budget;
+        bool thrown = false;
+        try {
+            Fragile_map built(sorted.begin(), sorted.end());
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        ASSERT_TRUE(thrown);
+        Fragile::copies_left = budget;
+        try {
+            Fragile_map copy(map);
+            thrown = false;
+        } catch (const std::runtime_error &) {
+        }
+        ASSERT_TRUE(thrown);
+        ASSERT_EQUAL(Fragile::live, 400); // only the vector's and map's
+    }
+}
+
+TEST(test_map_splay_sorted_keys_copy_and_destroy) {
+    // Sorted keys leave the splay tree a single path of a million nodes
+    Map<int, int, std::less<int>, Splay_tree> values;
+    const int n = 1000000;
+    for (int i = 0; i < n; ++i) {
+        values[i] = i;
+    }
+    Map<int, int, std::less<int>, Splay_tree> copy(values);
+    ASSERT_EQUAL(copy.size(), n);
+    ASSERT_TRUE(std::equal(values.begin(), values.end(), copy.begin()));
+}
+
+TEST(test_map_parallel_copy_and_clear) {
+    using Counts = Map<string, int, std::less<string>, AVL_tree>;
+    Counts counts;
+    for (int i = 0; i < 20000; ++i) {
+        counts[std::to_string(i)] = i;
+    }
+    ThreadPool pool(2);
+    Counts copy(counts, pool);
+    ASSERT_EQUAL(copy.size(), counts.size());
+    ASSERT_TRUE(std::equal(copy.begin(), copy.end(), counts.begin(),
+                           counts.end()));
+    copy.clear(pool);
+    ASSERT_TRUE(copy.empty());
+    ASSERT_EQUAL(counts["19999"], 19999);
+}
+
+TEST(test_map_stats_compares_storage) {
+    Map<int, int, std::less<int>, AVL_tree> balanced;
+    Map<int, int, std::less<int>, Unbalanced_tree> unbalanced;
+    for (int i = 0; i < 1000; ++i) {
+        balanced[i] = i;
+        unbalanced[i] = i;
+    }
+    Tree_stats avl = balanced.stats();
+    Tree_stats chain = unbalanced.stats();
+    ASSERT_EQUAL(avl.nodes, 1000);
+    ASSERT_EQUAL(chain.nodes, 1000);
+    ASSERT_EQUAL(avl.min_height, 10);
+    ASSERT_TRUE(avl.max_depth <= 11);
+    ASSERT_EQUAL(chain.max_depth, 1000);
+    ASSERT_TRUE(avl.expected_comparisons < 2 * avl.max_depth);
+    ASSERT_ALMOST_EQUAL(chain.expected_comparisons, 1001.0, 1e-9);
+}
+
+#ifdef MAP_INSTRUMENT
+TEST(test_map_instrument_charges_outermost_operation) {
+    Map<string, int> counts;
+    reset_op_counters();
+    for (const char *word : { "the", "cat", "the", "dog", "the" }) {
+        ++counts[word];
+    }
+    const Op_counters &ops = op_counters();
+    ASSERT_EQUAL(ops.subscript.calls, 5);
+    ASSERT_TRUE(ops.subscript.comparisons > 0);
+    ASSERT_EQUAL(ops.insert.calls, 0); // the insertions inside operator[]
+
+    counts.insert({ "emu", 1 });
+    counts.find("cat");
+    counts.find("yak");
+    ASSERT_EQUAL(ops.insert.calls, 1);
+    ASSERT_EQUAL(ops.find.calls, 2);
+    ASSERT_TRUE(ops.find.comparisons >= 2);
+
+    // Other storages count calls and latency, but not comparisons
+    Map<string, int, std::less<string>, BTree_layout<>> btree;
+    btree["cat"] = 1;
+    btree.find("cat");
+    ASSERT_EQUAL(ops.subscript.calls, 6);
+    ASSERT_EQUAL(ops.find.calls, 3);
+    ASSERT_EQUAL(ops.find.latency.count(), 3);
+}
+#endif
+
+TEST(test_concurrent_map_single_thread) {
+    ConcurrentMap<string, int> counts;
+    ASSERT_TRUE(counts.empty());
+    ASSERT_TRUE(counts.insert({ "cat", 1 }));
+    ASSERT_FALSE(counts.insert({ "cat", 5 }));
+    ASSERT_EQUAL(counts.increment("cat"), 2);
+    ASSERT_EQUAL(counts.increment("dog", 3), 3);
+    ASSERT_EQUAL(counts.size(), 2);
+    ASSERT_EQUAL(*counts.find("cat"), 2);
+    ASSERT_FALSE(counts.find("emu").has_value());
+    ASSERT_FALSE(counts.contains("emu"));
+
+    int seen = 0;
+    ASSERT_TRUE(counts.find("dog", [&](const int &value) { seen = value; }));
+    ASSERT_EQUAL(seen, 3);
+    ASSERT_EQUAL(counts.erase("dog"), 1);
+    ASSERT_EQUAL(counts.erase("dog"), 0);
+    ASSERT_EQUAL(counts.size(), 1);
+}
+
+TEST(test_concurrent_map_threads_increment) {
+    const int threads = 4;
+    const int keys = 1000;
+    ConcurrentMap<int, int> counts;
+    vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&counts, t]() {
+            // Each thread counts every key, in a different order
+            for (int i = 0; i < keys; ++i) {
+                counts.increment((i * 7 + t * 131) % keys);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    // The snapshot is an ordinary Map, in ascending order of key
+    auto snapshot = counts.snapshot();
+    ASSERT_EQUAL(snapshot.size(), keys);
+    int expected_key = 0;
+    for (auto &p : snapshot) {
+        ASSERT_EQUAL(p.first, expected_key++);
+        ASSERT_EQUAL(p.second, threads);
+    }
+
+    long total = 0;
+    counts.for_each([&](const std::pair<int, int> &p) { total += p.second; });
+    ASSERT_EQUAL(total, threads * keys);
+}
+
+TEST(test_hash_map_basic) {
+    HashMap<string, int> counts;
+    ASSERT_TRUE(counts.empty());
+    ++counts["cat"];
+    ++counts["cat"];
+    counts["dog"] = 5;
+    ASSERT_TRUE(counts.insert({ "emu", 1 }).second);
+    ASSERT_FALSE(counts.insert({ "emu", 9 }).second);
+    ASSERT_EQUAL(counts.size(), 3);
+    ASSERT_EQUAL(counts.find("cat")->second, 2);
+    ASSERT_EQUAL(counts.find("emu")->second, 1);
+    ASSERT_TRUE(counts.find("fox") == counts.end());
+
+    const HashMap<string, int> copy(counts);
+    ASSERT_EQUAL(counts.erase("cat"), 1);
+    ASSERT_EQUAL(counts.erase("cat"), 0);
+    ASSERT_EQUAL(counts.size(), 2);
+    ASSERT_EQUAL(counts.find("dog")->second, 5);
+    ASSERT_EQUAL(copy.find("cat")->second, 2);
+}
+
+// A hash that sends many keys to the same slots, so that probe
+// sequences run long and erasing has slots to shift back.
+struct Clumping_hash {
+    size_t operator()(int k) const {
+        return static_cast<size_t>(k % 16);
+    }
+};
+
+TEST(test_hash_map_matches_map_under_churn) {
+    HashMap<int, int, Clumping_hash> hashed;
+    HashMap<int, int> spread;
+    Map<int, int> reference;
+    std::mt19937 rng(280);
+    for (int i = 0; i < 20000; ++i) {
+        int k = static_cast<int>(rng() % 500);
+        if (rng() % 3 == 0) {
+            size_t expected = reference.erase(k);
+            ASSERT_EQUAL(hashed.erase(k), expected);
+            ASSERT_EQUAL(spread.erase(k), expected);
+        } else {
+            hashed[k] += i;
+            spread[k] += i;
+            reference[k] += i;
+        }
+    }
+    ASSERT_EQUAL(hashed.size(), reference.size());
+    ASSERT_EQUAL(spread.size(), reference.size());
+    for (auto &p : reference) {
+        ASSERT_EQUAL(hashed.find(p.first)->second, p.second);
+        ASSERT_EQUAL(spread.find(p.first)->second, p.second);
+    }
+    for (int k = 500; k < 600; ++k) {
+        ASSERT_TRUE(hashed.find(k) == hashed.end());
+    }
+}
+
+TEST(test_hash_map_sorted_view) {
+    HashMap<string, int> counts;
+    counts.reserve(100);
+    for (int i = 99; i >= 0; --i) {
+        counts[std::to_string(i)] = i;
+    }
+    vector<string> keys;
+    for (const auto *p : counts.sorted()) {
+        keys.push_back(p->first);
+    }
+    ASSERT_EQUAL(keys.size(), 100);
+    ASSERT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+    ASSERT_EQUAL(keys.front(), "0");
+    ASSERT_EQUAL(keys.back(), "99");
+}
+
+// A mapped value that counts how many of its kind exist
+struct Counted {
+    static int live;
+    int value = 0;
+    Counted() {
+        ++live;
+    }
+    Counted(const Counted &other)
+        : value(other.value) {
+        ++live;
+    }
+    Counted &operator=(const Counted &other) = default;
+    ~Counted() {
+        --live;
+    }
+};
+
+int Counted::live = 0;
+
+TEST(test_persistent_map_copies_share_nodes) {
+    {
+        Map<int, Counted, std::less<int>, Persistent_tree> v1;
+        for (int i = 0; i < 1000; ++i) {
+            v1[i].value = i;
+        }
+        ASSERT_EQUAL(Counted::live, 1000);
+
+        auto v2 = v1; // no pair is copied
+        ASSERT_EQUAL(Counted::live, 1000);
+
+        // Changing v2 copies only the path to key 500
+        v2[500].value = -1;
+        ASSERT_TRUE(Counted::live > 1000);
+        ASSERT_TRUE(Counted::live <= 1000 + 16);
+        ASSERT_EQUAL(v1.find(500)->second.value, 500);
+        ASSERT_EQUAL(v2.find(500)->second.value, -1);
+
+        ASSERT_EQUAL(v2.erase(7), 1);
+        v2[2000].value = 2000;
+        ASSERT_EQUAL(v1.size(), 1000);
+        ASSERT_EQUAL(v2.size(), 1000);
+        ASSERT_EQUAL(v1.find(7)->second.value, 7);
+        ASSERT_TRUE(v1.find(2000) == v1.end());
+        ASSERT_EQUAL(v2.find(2000)->second.value, 2000);
+
+        // The pairs behind an Iterator may be shared with v1, so the
+        // Iterators cannot write to them
+        static_assert(std::is_const<std::remove_reference_t<
+                          decltype(*v2.find(500))>>::value, "");
+        static_assert(std::is_const<std::remove_reference_t<
+                          decltype(*v2.insert({3000, Counted()}).first)>>::value,
+                      "");
+    }
+    ASSERT_EQUAL(Counted::live, 0);
+}
+
+TEST(test_persistent_tree_versions) {
+    // Each step derives a new version from the last; every earlier
+    // version must keep its contents and its shape.
+    vector<PersistentTree<int>> versions(1);
+    vector<vector<int>> contents(1);
+    std::mt19937 rng(280);
+    for (int step = 0; step < 400; ++step) {
+        PersistentTree<int> next = versions.back();
+        vector<int> expected = contents.back();
+        int k = static_cast<int>(rng() % 100);
+        auto pos = std::lower_bound(expected.begin(), expected.end(), k);
+        if (pos != expected.end() && *pos == k) {
+            auto after = next.erase(next.find(k));
+            pos = expected.erase(pos);
+            if (pos == expected.end()) {
+                ASSERT_TRUE(after == next.end());
+            } else {
+                ASSERT_EQUAL(*after, *pos);
+            }
+        } else {
+            ASSERT_TRUE(next.insert_unique(k).second);
+            expected.insert(pos, k);
+        }
+        versions.push_back(next);
+        contents.push_back(expected);
+    }
+    for (size_t i = 0; i < versions.size(); ++i) {
+        ASSERT_TRUE(versions[i].check_invariants());
+        vector<int> actual(versions[i].begin(), versions[i].end());
+        ASSERT_EQUAL(actual, contents[i]);
+        vector<int> reversed(versions[i].rbegin(), versions[i].rend());
+        std::reverse(reversed.begin(), reversed.end());
+        ASSERT_EQUAL(reversed, contents[i]);
+    }
+}
+
+TEST(test_compact_tree_churn) {
+    CompactTree<int> tree;
+    vector<int> expected;
+    std::mt19937 rng(280);
+    for (int step = 0; step < 5000; ++step) {
+        int k = static_cast<int>(rng() % 300);
+        auto pos = std::lower_bound(expected.begin(), expected.end(), k);
+        if (pos != expected.end() && *pos == k) {
+            // Erasing moves the last node; the successor must survive it
+            auto after = tree.erase(tree.find(k));
+            pos = expected.erase(pos);
+            if (pos == expected.end()) {
+                ASSERT_TRUE(after == tree.end());
+            } else {
+                ASSERT_EQUAL(*after, *pos);
+            }
+        } else {
+            ASSERT_TRUE(tree.insert_unique(k).second);
+            expected.insert(pos, k);
+        }
+        if (step % 250 == 0) {
+            ASSERT_TRUE(tree.check_invariants());
+        }
+    }
+    ASSERT_TRUE(tree.check_invariants());
+    vector<int> actual(tree.begin(), tree.end());
+    ASSERT_EQUAL(actual, expected);
+    vector<int> reversed(tree.rbegin(), tree.rend());
+    std::reverse(reversed.begin(), reversed.end());
+    ASSERT_EQUAL(reversed, expected);
+
+    // Links are positions, so a copy needs no fixing up
+    CompactTree<int> copy(tree);
+    tree.erase(tree.begin());
+    ASSERT_TRUE(copy.check_invariants());
+    ASSERT_EQUAL(copy.size(), expected.size());
+    copy.shrink_to_fit();
+    ASSERT_TRUE(copy.memory_bytes() <= copy.size() * (sizeof(int) + 16));
+}
+
+TEST(test_string_pool_ids) {
+    StringPool words;
+    ASSERT_EQUAL(words.find("cat"), StringPool::none);
+    StringPool::Id cat = words.intern("cat");
+    StringPool::Id dog = words.intern(string("dog"));
+    ASSERT_EQUAL(cat, 0);
+    ASSERT_EQUAL(dog, 1);
+    ASSERT_EQUAL(words.intern("cat"), cat);
+    ASSERT_EQUAL(words.intern(""), 2);
+    ASSERT_EQUAL(words.size(), 3);
+    ASSERT_EQUAL(words.chars(), 6);
+
+    // IDs and strings survive the table and buffer growing
+    for (int i = 0; i < 5000; ++i) {
+        ASSERT_EQUAL(words.intern(std::to_string(i)), i + 3);
+    }
+    ASSERT_EQUAL(words.find("cat"), cat);
+    ASSERT_EQUAL(words.find("4999"), 5002);
+    ASSERT_EQUAL(words.str(dog), "dog");
+    ASSERT_EQUAL(words.str(2), "");
+    ASSERT_EQUAL(words.str(words.find("1234")), "1234");
+}
+
+TEST(test_map_keyed_by_interned_ids) {
+    StringPool words;
+    Map<std::pair<StringPool::Id, StringPool::Id>, int> label_word;
+    Map<StringPool::Id, int> word_counts;
+    const char *posts[][2] = { { "euchre", "trump" }, { "image", "seam" },
+                               { "euchre", "bid" }, { "euchre", "trump" } };
+    for (auto &post : posts) {
+        StringPool::Id label = words.intern(post[0]);
+        StringPool::Id word = words.intern(post[1]);
+        ++label_word[{ label, word }];
+        ++word_counts[word];
+    }
+    ASSERT_EQUAL((label_word[{ words.find("euchre"), words.find("trump") }]),
+                 2);
+    ASSERT_EQUAL(word_counts[words.find("seam")], 1);
+
+    // Output in alphabetical order goes through the pool
+    vector<string> dumped;
+    for (StringPool::Id id : words.sorted_ids()) {
+        if (word_counts.find(id) != word_counts.end()) {
+            dumped.push_back(string(words.str(id)) + ":" +
+                             std::to_string(word_counts[id]));
+        }
+    }
+    vector<string> expected = { "bid:1", "seam:1", "trump:2" };
+    ASSERT_EQUAL(dumped, expected);
+}
+
+TEST_MAIN()
@@ -0,0 +1,857 @@
+#ifndef PERSISTENT_TREE_HPP
+#define PERSISTENT_TREE_HPP
+/* PersistentTree.hpp
+ *
+ * An AVL tree whose nodes are shared between copies. Copying a
+ * PersistentTree takes constant time, and a modification copies only
+ * the nodes on the path to the element it touches, so that many
+ * versions of a large tree (for example, successive snapshots of a
+ * model handed to readers) cost little more than one.
+ *
+ * A PersistentTree can be used on its own, or as the storage of a Map
+ * by passing Persistent_tree as the Map's Storage argument:
+ *
+ *   Map<std::string, int, std::less<std::string>, Persistent_tree> model;
+ *   auto snapshot = model; // constant time
+ */
+
+#include <algorithm>   //max, adjacent_find
+#include <atomic>
+#include <cassert>     //assert
+#include <cstddef>     //size_t, ptrdiff_t
+#include <functional>  //less
+#include <iterator>    //bidirectional_iterator_tag, reverse_iterator
+#include <memory>      //allocator, allocator_traits
+#include <utility>     //pair, move, forward, in_place
+#include <vector>
+#include "IteratorRange.hpp"
+
+// Persistent_tree selects a PersistentTree as the Storage argument of a
+// Map.
+struct Persistent_tree {};
+
+template <typename T,
+          typename Compare = std::less<T>,
+          typename Allocator = std::allocator<T>>
+class PersistentTree {
+  // OVERVIEW: An AVL tree of unique elements of type T, ordered by
+  //           Compare, whose nodes carry a reference count. A node is
+  //           referenced by its parent, or by a tree if it is a root, and
+  //           may belong to several trees at once. Nodes referenced more
+  //           than once are never modified: an operation that changes
+  //           the tree first replaces each shared node on its path by a
+  //           private copy, which shares the children of the original
+  //           ("path copying"). Nodes referenced once are modified in
+  //           place, so a tree that is never copied behaves like an
+  //           ordinary AVL tree.
+  //
+  //           Reference counts are atomic, so different trees that share
+  //           nodes may be used, copied and destroyed on different
+  //           threads. A single tree is no more thread-safe than any
+  //           other container.
+  //
+  //           Nodes have no parent links, which would tie each node to a
+  //           single tree. An Iterator that has no right subtree to step
+  //           into therefore finds its successor by searching from the
+  //           root, so a full traversal takes O(n log n) time.
+  //
+  //           Any modification invalidates every Iterator into the tree.
+
+private:
+  struct Node {
+    template <typename... Args>
+    explicit Node(std::in_place_t, Args&&... args)
+      : datum(std::forward<Args>(args)...), left(nullptr), right(nullptr),
+        height(1), refs(1) { }
+
+    T datum;
+    Node *left;
+    Node *right;
+    int height;
+    std::atomic<size_t> refs;
+  };
+
+  using Node_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+  using Node_traits = std::allocator_traits<Node_allocator>;
+
+public:
+  class Iterator {
+    // OVERVIEW: Iterates over the elements of a PersistentTree in
+    //           ascending order. An Iterator is a node pointer plus a
+    //           pointer to the tree, whose root it searches from when it
+    //           has to climb.
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    Iterator()
+      : node(nullptr), tree(nullptr) { }
+
+    // EFFECTS:  Returns the current element by const reference. An
+    //           element may be shared with copies of the tree, so it
+    //           cannot be modified through an Iterator.
+    const T &operator*() const {
+      return node->datum;
+    }
+
+    const T *operator->() const {
+      return &node->datum;
+    }
+
+    // Prefix ++
+    Iterator &operator++() {
+      if (node->right) {
+        node = leftmost_impl(node->right);
+      } else {
+        node = tree->successor(node);
+      }
+      return *this;
+    }
+
+    // Postfix ++ (implemented in terms of prefix ++)
+    Iterator operator++(int) {
+      Iterator result(*this);
+      ++(*this);
+      return result;
+    }
+
+    // Prefix -- ; decrementing an end Iterator yields the largest element
+    Iterator &operator--() {
+      if (node == nullptr) {
+        node = rightmost_impl(tree->root);
+      } else if (node->left) {
+        node = rightmost_impl(node->left);
+      } else {
+        node = tree->predecessor(node);
+      }
+      return *this;
+    }
+
+    // Postfix -- (implemented in terms of prefix --)
+    Iterator operator--(int) {
+      Iterator result(*this);
+      --(*this);
+      return result;
+    }
+
+    bool operator==(const Iterator &rhs) const {
+      return node == rhs.node;
+    }
+
+    bool operator!=(const Iterator &rhs) const {
+      return node != rhs.node;
+    }
+
+  private:
+    friend class PersistentTree;
+
+    Node *node;
+    const PersistentTree *tree;
+
+    Iterator(Node *node_in, const PersistentTree *tree_in)
+      : node(node_in), tree(tree_in) { }
+  }; // PersistentTree::Iterator
+
+  using Reverse_iterator = std::reverse_iterator<Iterator>;
+
+  PersistentTree()
+    : root(nullptr), count(0) { }
+
+  explicit PersistentTree(const Allocator &alloc_in)
+    : root(nullptr), count(0), alloc(alloc_in) { }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order
+  //           according to Compare
+  // EFFECTS : Constructs a tree holding the elements of [first, last),
+  //           shaped as a minimum-height tree, in linear time.
+  template <typename Iter>
+  PersistentTree(Iter first, Iter last, const Allocator &alloc_in = Allocator())
+    : root(nullptr), count(0), alloc(alloc_in) {
+    assign(first, last);
+  }
+
+  // Copy constructor
+  // Shares every node of other, in constant time. Since the nodes may be
+  // freed by either tree, the copy uses the same allocator as other.
+  PersistentTree(const PersistentTree &other)
+    : root(acquire_impl(other.root)), count(other.count),
+      alloc(other.alloc) { }
+
+  // Move constructor
+  PersistentTree(PersistentTree &&other) noexcept
+    : root(other.root), count(other.count), alloc(other.alloc) {
+    other.root = nullptr;
+    other.count = 0;
+  }
+
+  // Assignment operators
+  // Both take over the nodes and allocator of rhs in constant time.
+  PersistentTree &operator=(const PersistentTree &rhs) {
+    Node *shared = acquire_impl(rhs.root);
+    release_impl(root, alloc);
+    root = shared;
+    count = rhs.count;
+    alloc = rhs.alloc;
+    return *this;
+  }
+
+  PersistentTree &operator=(PersistentTree &&rhs) noexcept {
+    if (this != &rhs) {
+      release_impl(root, alloc);
+      root = rhs.root;
+      count = rhs.count;
+      alloc = rhs.alloc;
+      rhs.root = nullptr;
+      rhs.count = 0;
+    }
+    return *this;
+  }
+
+  // Destructor
+  // Frees the nodes that no other tree shares.
+  ~PersistentTree() {
+    release_impl(root, alloc);
+  }
+
+  // REQUIRES: [first, last) is sorted in strictly ascending order
+  //           according to Compare
+  // MODIFIES: this PersistentTree
+  // EFFECTS : Replaces the contents of this tree with the elements of
+  //           [first, last), building a minimum-height tree in linear
+  //           time. The precondition is checked when assertions are
+  //           enabled.
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    assert(std::adjacent_find(first, last, [this](const T &a, const T &b) {
+             return !less(a, b);
+           }) == last);
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    Node *built = build_impl(first, n, alloc);
+    release_impl(root, alloc);
+    root = built;
+    count = n;
+  }
+
+  // EFFECTS: Returns whether this PersistentTree is empty.
+  bool empty() const {
+    return root == nullptr;
+  }
+
+  // EFFECTS: Returns the number of elements in this PersistentTree.
+  size_t size() const {
+    return count;
+  }
+
+  // EFFECTS: Returns the height of the tree, in constant time.
+  size_t height() const {
+    return static_cast<size_t>(node_height(root));
+  }
+
+  // EFFECTS: Returns whether every subtree is sorted, and whether every
+  //          cached height is correct and every node is AVL balanced.
+  bool check_invariants() const {
+    return check_impl(root, nullptr, nullptr, less) >= 0;
+  }
+
+  Iterator begin() const {
+    return Iterator(root ? leftmost_impl(root) : nullptr, this);
+  }
+
+  Iterator end() const {
+    return Iterator(nullptr, this);
+  }
+
+  Reverse_iterator rbegin() const {
+    return Reverse_iterator(end());
+  }
+
+  Reverse_iterator rend() const {
+    return Reverse_iterator(begin());
+  }
+
+  // EFFECTS: Returns an Iterator to the element equivalent to query, or
+  //          an end Iterator if there is none.
+  // NOTE:    query may be of type T, or of any type Compare can compare
+  //          against T.
+  template <typename Key>
+  Iterator find(const Key &query) const {
+    Node *node = root;
+    while (node) {
+      if (less(query, node->datum)) {
+        node = node->left;
+      } else if (less(node->datum, query)) {
+        node = node->right;
+      } else {
+        break;
+      }
+    }
+    return Iterator(node, this);
+  }
+
+  // EFFECTS: Same as find(query). The hint is accepted for compatibility
+  //          with BinarySearchTree::find(hint, query) and not used: without
+  //          parent links, every search starts at the root.
+  template <typename Key>
+  Iterator find(Iterator, const Key &query) const {
+    return find(query);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element not less than
+  //          query, or an end Iterator if there is none.
+  template <typename Key>
+  Iterator lower_bound(const Key &query) const {
+    Node *candidate = nullptr;
+    for (Node *node = root; node;) {
+      if (less(node->datum, query)) {
+        node = node->right;
+      } else {
+        candidate = node;
+        node = node->left;
+      }
+    }
+    return Iterator(candidate, this);
+  }
+
+  // EFFECTS: Returns an Iterator to the first element greater than
+  //          query, or an end Iterator if there is none.
+  template <typename Key>
+  Iterator upper_bound(const Key &query) const {
+    Node *candidate = nullptr;
+    for (Node *node = root; node;) {
+      if (less(query, node->datum)) {
+        candidate = node;
+        node = node->left;
+      } else {
+        node = node->right;
+      }
+    }
+    return Iterator(candidate, this);
+  }
+
+  template <typename Key>
+  std::pair<Iterator, Iterator> equal_range(const Key &query) const {
+    return { lower_bound(query), upper_bound(query) };
+  }
+
+  // EFFECTS: Returns the elements not less than low and less than high.
+  template <typename Key>
+  Iterator_range<Iterator> range(const Key &low, const Key &high) const {
+    Iterator first = lower_bound(low);
+    return Iterator_range<Iterator>(first, less(high, low) ? first
+                                                           : lower_bound(high));
+  }
+
+  // MODIFIES: this PersistentTree
+  // EFFECTS : If an element equivalent to item is already contained in
+  //           this tree, returns an Iterator to it along with false.
+  //           Otherwise, inserts item and returns an Iterator to the new
+  //           element along with true. Either way, the path to the
+  //           element is made private to this tree.
+  std::pair<Iterator, bool> insert_unique(const T &item) {
+    return try_emplace(item, item);
+  }
+
+  std::pair<Iterator, bool> insert_unique(T &&item) {
+    return try_emplace(item, std::move(item));
+  }
+
+  // MODIFIES: this PersistentTree
+  // EFFECTS : Same as insert_unique, with the element constructed from
+  //           args.
+  template <typename... Args>
+  std::pair<Iterator, bool> emplace(Args&&... args) {
+    T item(std::forward<Args>(args)...);
+    return insert_unique(std::move(item));
+  }
+
+  // REQUIRES: An element constructed from args is equivalent to key
+  // MODIFIES: this PersistentTree
+  // EFFECTS : If an element equivalent to key is already contained in
+  //           this tree, returns an Iterator to it along with false,
+  //           without constructing anything. Otherwise, constructs an
+  //           element from args in a new node, links it in, and returns
+  //           an Iterator to it along with true. Either way, the path to
+  //           the element is made private to this tree, so writable() may
+  //           give access to it.
+  // NOTE:    Copies at most the O(log n) shared nodes on the path.
+  template <typename Key, typename... Args>
+  std::pair<Iterator, bool> try_emplace(const Key &key, Args&&... args) {
+    std::pair<Node *, bool> result =
+      try_emplace_impl(root, key, less, alloc, std::forward<Args>(args)...);
+    count += result.second;
+    return { Iterator(result.first, this), result.second };
+  }
+
+  // REQUIRES: pos was returned by insert_unique, emplace or try_emplace
+  //           on this tree, which has not been modified since
+  // EFFECTS : Returns the element at pos for writing. The path to it is
+  //           private to this tree, so no copy of the tree sees the
+  //           change. The element must stay equivalent to what it was.
+  T &writable(Iterator pos) {
+    return pos.node->datum;
+  }
+
+  // EFFECTS : Same as try_emplace(key, args...); the hint is not used
+  //           (see find(hint, query)).
+  template <typename Key, typename... Args>
+  std::pair<Iterator, bool> try_emplace_hint(Iterator, const Key &key,
+                                             Args&&... args) {
+    return try_emplace(key, std::forward<Args>(args)...);
+  }
+
+  // REQUIRES: pos is a dereferenceable Iterator into this tree
+  // MODIFIES: this PersistentTree
+  // EFFECTS : Removes the element at pos and returns an Iterator to the
+  //           element that followed it (or an end Iterator).
+  // NOTE:    Copies at most the O(log n) shared nodes on the path.
+  Iterator erase(Iterator pos) {
+    Node *next = nullptr;
+    bool erased = erase_impl(root, pos.node->datum, less, alloc, next);
+    assert(erased);
+    (void)erased;
+    --count;
+    return Iterator(next, this);
+  }
+
+  // MODIFIES: this PersistentTree
+  // EFFECTS : Removes the element equivalent to item, if there is one.
+  //           Returns the number of elements removed (0 or 1).
+  size_t erase(const T &item) {
+    Iterator pos = find(item);
+    if (pos == end()) {
+      return 0;
+    }
+    erase(pos);
+    return 1;
+  }
+
+  // REQUIRES: combine(T &existing, T &&incoming) leaves in existing an
+  //           element equivalent to both
+  // MODIFIES: this PersistentTree, other
+  // EFFECTS : Adds every element of other to this tree, leaving other
+  //           empty, in O(n + m) time, and rebuilds a minimum-height tree.
+  //           Elements that no other tree shares are moved rather than
+  //           copied.
+  template <typename Combine>
+  void merge(PersistentTree &&other, Combine combine) {
+    if (this == &other) {
+      return;
+    }
+    std::vector<Entry> theirs;
+    collect_impl(other.root, true, theirs);
+    merge_impl(theirs, [&](T &existing, Entry incoming) {
+      if (incoming.unique) {
+        combine(existing, std::move(incoming.node->datum));
+      } else {
+        T copy(incoming.node->datum);
+        combine(existing, std::move(copy));
+      }
+    }, true);
+    release_impl(other.root, other.alloc);
+    other.root = nullptr;
+    other.count = 0;
+  }
+
+  // REQUIRES: combine(T &existing, const T &incoming) leaves in existing
+  //           an element equivalent to both
+  // MODIFIES: this PersistentTree
+  // EFFECTS : Same as above, but copies the elements of other, which is
+  //           left unchanged.
+  template <typename Combine>
+  void merge(const PersistentTree &other, Combine combine) {
+    PersistentTree copy(other); // constant time; also covers self-merge
+    std::vector<Entry> theirs;
+    collect_impl(copy.root, false, theirs);
+    merge_impl(theirs, [&](T &existing, Entry incoming) {
+      combine(existing, static_cast<const T &>(incoming.node->datum));
+    }, false);
+  }
+
+private:
+  // DATA REPRESENTATION
+  Node *root;
+  size_t count;
+  Compare less;
+  Node_allocator alloc;
+
+  // An element gathered for merging, and whether this tree is the only
+  // owner of the node holding it (so that it may be moved from).
+  struct Entry {
+    Node *node;
+    bool unique;
+  };
+
+  // REQUIRES: node is a node of this tree with no right child
+  // EFFECTS : Returns the node of the next larger element, or null.
+  Node *successor(const Node *node) const {
+    Node *next = nullptr;
+    for (Node *n = root; n != node;) {
+      if (less(node->datum, n->datum)) {
+        next = n;
+        n = n->left;
+      } else {
+        n = n->right;
+      }
+    }
+    return next;
+  }
+
+  // REQUIRES: node is a node of this tree with no left child
+  // EFFECTS : Returns the node of the next smaller element, or null.
+  Node *predecessor(const Node *node) const {
+    Node *prev = nullptr;
+    for (Node *n = root; n != node;) {
+      if (less(n->datum, node->datum)) {
+        prev = n;
+        n = n->right;
+      } else {
+        n = n->left;
+      }
+    }
+    return prev;
+  }
+
+  // REQUIRES: theirs is sorted
+  // MODIFIES: this PersistentTree
+  // EFFECTS : Merges the elements of this tree with those of theirs,
+  //           calling join(existing, entry) for equivalent ones, and
+  //           rebuilds the tree from the result. Incoming elements are
+  //           moved when their node is unique and may_move_theirs.
+  template <typename Join>
+  void merge_impl(const std::vector<Entry> &theirs, Join join,
+                  bool may_move_theirs) {
+    std::vector<Entry> mine;
+    collect_impl(root, true, mine);
+    std::vector<T> merged;
+    merged.reserve(mine.size() + theirs.size());
+    auto take = [&merged](const Entry &entry, bool may_move) {
+      if (entry.unique && may_move) {
+        merged.push_back(std::move(entry.node->datum));
+      } else {
+        merged.push_back(entry.node->datum);
+      }
+    };
+    size_t i = 0;
+    size_t j = 0;
+    while (i < mine.size() && j < theirs.size()) {
+      const T &a = mine[i].node->datum;
+      const T &b = theirs[j].node->datum;
+      if (less(a, b)) {
+        take(mine[i++], true);
+      } else if (less(b, a)) {
+        take(theirs[j++], may_move_theirs);
+      } else {
+        take(mine[i++], true);
+        join(merged.back(), theirs[j++]);
+      }
+    }
+    for (; i < mine.size(); ++i) {
+      take(mine[i], true);
+    }
+    for (; j < theirs.size(); ++j) {
+      take(theirs[j], may_move_theirs);
+    }
+    assign(std::make_move_iterator(merged.begin()),
+           std::make_move_iterator(merged.end()));
+  }
+
+  // EFFECTS: Returns the height of the subtree rooted at node.
+  static int node_height(const Node *node) {
+    return node ? node->height : 0;
+  }
+
+  static void update_impl(Node *node) {
+    node->height = 1 + std::max(node_height(node->left),
+                                node_height(node->right));
+  }
+
+  static Node *leftmost_impl(Node *node) {
+    while (node->left) {
+      node = node->left;
+    }
+    return node;
+  }
+
+  static Node *rightmost_impl(Node *node) {
+    while (node->right) {
+      node = node->right;
+    }
+    return node;
+  }
+
+  // EFFECTS: Adds a reference to node, if any, and returns it.
+  static Node *acquire_impl(Node *node) {
+    if (node) {
+      node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Drops a reference to node, if any. If it was the last one,
+  //           drops the node's references to its children and frees it.
+  // NOTE:    This function is tree recursive.
+  static void release_impl(Node *node, Node_allocator &alloc) {
+    if (node == nullptr ||
+        node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    release_impl(node->left, alloc);
+    release_impl(node->right, alloc);
+    Node_traits::destroy(alloc, node);
+    Node_traits::deallocate(alloc, node, 1);
+  }
+
+  // MODIFIES: alloc
+  // EFFECTS : Allocates a new leaf Node and constructs its datum in place
+  //           from args.
+  template <typename... Args>
+  static Node *new_node_impl(Node_allocator &alloc, Args&&... args) {
+    Node *node = Node_traits::allocate(alloc, 1);
+    try {
+      Node_traits::construct(alloc, node, std::in_place,
+                             std::forward<Args>(args)...);
+    } catch (...) {
+      Node_traits::deallocate(alloc, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  // REQUIRES: slot is not null
+  // MODIFIES: slot, alloc
+  // EFFECTS : If the node in slot is shared, replaces this reference to
+  //           it with a private copy that shares its children.
+  static void unshare_impl(Node *&slot, Node_allocator &alloc) {
+    if (slot->refs.load(std::memory_order_acquire) == 1) {
+      return;
+    }
+    Node *copy = new_node_impl(alloc, static_cast<const T &>(slot->datum));
+    copy->left = acquire_impl(slot->left);
+    copy->right = acquire_impl(slot->right);
+    copy->height = slot->height;
+    release_impl(slot, alloc);
+    slot = copy;
+  }
+
+  // REQUIRES: slot and slot->right are not null, and slot is private
+  // MODIFIES: slot, alloc
+  // EFFECTS : Rotates the subtree in slot to the left.
+  static void rotate_left_impl(Node *&slot, Node_allocator &alloc) {
+    unshare_impl(slot->right, alloc);
+    Node *pivot = slot->right;
+    slot->right = pivot->left;
+    pivot->left = slot;
+    update_impl(slot);
+    update_impl(pivot);
+    slot = pivot;
+  }
+
+  // REQUIRES: slot and slot->left are not null, and slot is private
+  // MODIFIES: slot, alloc
+  // EFFECTS : Mirror image of rotate_left_impl.
+  static void rotate_right_impl(Node *&slot, Node_allocator &alloc) {
+    unshare_impl(slot->left, alloc);
+    Node *pivot = slot->left;
+    slot->left = pivot->right;
+    pivot->right = slot;
+    update_impl(slot);
+    update_impl(pivot);
+    slot = pivot;
+  }
+
+  // REQUIRES: slot is private, and the subtrees of slot are AVL trees
+  //           whose heights differ by at most two
+  // MODIFIES: slot, alloc
+  // EFFECTS : Performs at most two rotations so that the subtree in slot
+  //           is an AVL tree, copying the shared nodes they move.
+  static void rebalance_impl(Node *&slot, Node_allocator &alloc) {
+    update_impl(slot);
+    int balance = node_height(slot->left) - node_height(slot->right);
+    if (balance > 1) {
+      if (node_height(slot->left->left) < node_height(slot->left->right)) {
+        unshare_impl(slot->left, alloc);
+        rotate_left_impl(slot->left, alloc);
+      }
+      rotate_right_impl(slot, alloc);
+    } else if (balance < -1) {
+      if (node_height(slot->right->right) < node_height(slot->right->left)) {
+        unshare_impl(slot->right, alloc);
+        rotate_right_impl(slot->right, alloc);
+      }
+      rotate_left_impl(slot, alloc);
+    }
+  }
+
+  // MODIFIES: slot, alloc
+  // EFFECTS : Finds or inserts the element equivalent to key in the
+  //           subtree in slot, making every node on the way private, and
+  //           returns its node and whether it was inserted.
+  // NOTE:    This function is linear recursive.
+  template <typename Key, typename... Args>
+  static std::pair<Node *, bool> try_emplace_impl(Node *&slot, const Key &key,
+                                                  const Compare &less,
+                                                  Node_allocator &alloc,
+                                                  Args&&... args) {
+    if (slot == nullptr) {
+      slot = new_node_impl(alloc, std::forward<Args>(args)...);
+      return { slot, true };
+    }
+    unshare_impl(slot, alloc);
+    std::pair<Node *, bool> result;
+    if (less(key, slot->datum)) {
+      result = try_emplace_impl(slot->left, key, less, alloc,
+                                std::forward<Args>(args)...);
+    } else if (less(slot->datum, key)) {
+      result = try_emplace_impl(slot->right, key, less, alloc,
+                                std::forward<Args>(args)...);
+    } else {
+      return { slot, false };
+    }
+    if (result.second) {
+      rebalance_impl(slot, alloc);
+    }
+    return result;
+  }
+
+  // REQUIRES: slot is not null
+  // MODIFIES: slot, alloc
+  // EFFECTS : Detaches the node of the smallest element of the subtree in
+  //           slot, rebalancing on the way back up, and returns it with
+  //           no children. The returned node is private.
+  // NOTE:    This function is linear recursive.
+  static Node *detach_min_impl(Node *&slot, Node_allocator &alloc) {
+    unshare_impl(slot, alloc);
+    if (slot->left == nullptr) {
+      Node *min = slot;
+      slot = min->right;
+      min->right = nullptr;
+      return min;
+    }
+    Node *min = detach_min_impl(slot->left, alloc);
+    rebalance_impl(slot, alloc);
+    return min;
+  }
+
+  // MODIFIES: slot, alloc, next
+  // EFFECTS : Removes the element equivalent to key from the subtree in
+  //           slot, if any, and returns whether it did. The node of the
+  //           in-order successor takes the place of a removed node with
+  //           two children, rather than its element being moved. Sets
+  //           next to the node of the following element if it is in the
+  //           subtree, and leaves it unchanged otherwise.
+  // NOTE:    This function is linear recursive.
+  static bool erase_impl(Node *&slot, const T &key, const Compare &less,
+                         Node_allocator &alloc, Node *&next) {
+    if (slot == nullptr) {
+      return false;
+    }
+    // Compare before copying: key may be the datum of this very node,
+    // which only this tree is known to keep alive
+    bool go_left = less(key, slot->datum);
+    bool go_right = !go_left && less(slot->datum, key);
+    unshare_impl(slot, alloc);
+    if (go_left) {
+      // Rotations below relink nodes but never replace them
+      next = slot;
+      if (!erase_impl(slot->left, key, less, alloc, next)) {
+        return false;
+      }
+    } else if (go_right) {
+      if (!erase_impl(slot->right, key, less, alloc, next)) {
+        return false;
+      }
+    } else {
+      Node *node = slot;
+      if (node->left == nullptr || node->right == nullptr) {
+        if (node->right) {
+          // Balance leaves a lone right child, which is the successor;
+          // make it private so that no rotation above replaces it
+          assert(node->right->height == 1);
+          unshare_impl(node->right, alloc);
+          next = node->right;
+        }
+        slot = node->left ? node->left : node->right;
+      } else {
+        Node *heir = detach_min_impl(node->right, alloc);
+        heir->left = node->left;
+        heir->right = node->right;
+        slot = heir;
+        next = heir;
+      }
+      // The children now belong to slot; free the node alone
+      node->left = nullptr;
+      node->right = nullptr;
+      release_impl(node, alloc);
+    }
+    if (slot) {
+      rebalance_impl(slot, alloc);
+    }
+    return true;
+  }
+
+  // MODIFIES: it, alloc
+  // EFFECTS : Creates a minimum-height tree holding the next n elements
+  //           of it, advancing it past them, and returns its root.
+  // NOTE:    This function is tree recursive.
+  template <typename Iter>
+  static Node *build_impl(Iter &it, size_t n, Node_allocator &alloc) {
+    if (n == 0) {
+      return nullptr;
+    }
+    size_t left_count = n / 2;
+    Node *left = build_impl(it, left_count, alloc);
+    Node *node = new_node_impl(alloc, *it);
+    ++it;
+    node->left = left;
+    node->right = build_impl(it, n - left_count - 1, alloc);
+    update_impl(node);
+    return node;
+  }
+
+  // MODIFIES: entries
+  // EFFECTS : Appends the nodes of the subtree rooted at node in order,
+  //           each marked unique if it and all of its ancestors (when
+  //           unique_path) are referenced only once.
+  // NOTE:    This function is tree recursive.
+  static void collect_impl(Node *node, bool unique_path,
+                           std::vector<Entry> &entries) {
+    if (node == nullptr) {
+      return;
+    }
+    bool unique = unique_path &&
+                  node->refs.load(std::memory_order_acquire) == 1;
+    collect_impl(node->left, unique, entries);
+    entries.push_back({ node, unique });
+    collect_impl(node->right, unique, entries);
+  }
+
+  // EFFECTS: Returns the height of the subtree rooted at node if it is
+  //          sorted within (low, high), has correct cached heights and is
+  //          AVL balanced, and -1 otherwise. Null bounds are open.
+  // NOTE:    This function is tree recursive.
+  static int check_impl(const Node *node, const T *low, const T *high,
+                        const Compare &less) {
+    if (node == nullptr) {
+      return 0;
+    }
+    if ((low && !less(*low, node->datum)) ||
+        (high && !less(node->datum, *high))) {
+      return -1;
+    }
+    int left = check_impl(node->left, low, &node->datum, less);
+    int right = check_impl(node->right, &node->datum, high, less);
+    if (left < 0 || right < 0 || left - right > 1 || right - left > 1 ||
+        node->height != 1 + std::max(left, right)) {
+      return -1;
+    }
+    return node->height;
+  }
+};
+
+#endif // PERSISTENT_TREE_HPP
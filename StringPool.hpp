@@ -0,0 +1,163 @@
+#ifndef STRING_POOL_HPP
+#define STRING_POOL_HPP
+/* StringPool.hpp
+ *
+ * Interns strings: gives each distinct string a small integer ID, and
+ * keeps a single copy of its characters. Maps that would otherwise each
+ * store and compare copies of the same words can key on the IDs
+ * instead, which take four bytes and compare in one instruction:
+ *
+ *   StringPool words;
+ *   Map<StringPool::Id, int> counts;
+ *   ++counts[words.intern("euchre")];
+ *   for (auto &p : counts) {
+ *     std::cout << words.str(p.first) << " " << p.second << "\n";
+ *   }
+ */
+
+#include <algorithm>   //sort
+#include <cassert>     //assert
+#include <cstddef>     //size_t
+#include <cstdint>     //uint32_t, uint64_t
+#include <functional>  //hash
+#include <string>
+#include <string_view>
+#include <vector>
+
+class StringPool {
+  // OVERVIEW: Stores the characters of every interned string back to
+  //           back in one buffer; string i occupies the characters from
+  //           ends[i - 1] (or 0) up to ends[i]. IDs are assigned in the
+  //           order strings are first interned, starting from 0, and are
+  //           never reused or invalidated. A string is found again
+  //           through an open-addressing table of IDs, keyed by a hash of
+  //           the characters, laid out like the one in HashMap.hpp.
+  //
+  //           The views returned by str() point into the buffer, which
+  //           moves when it grows; they are invalidated by intern().
+
+public:
+  using Id = uint32_t;
+
+  // The result of find() for a string that was never interned
+  static constexpr Id none = UINT32_MAX;
+
+  // EFFECTS: Returns the number of distinct strings interned.
+  size_t size() const {
+    return ends.size();
+  }
+
+  // EFFECTS: Returns the total length of the interned strings.
+  size_t chars() const {
+    return buffer.size();
+  }
+
+  // MODIFIES: this StringPool
+  // EFFECTS : Returns the ID of s, interning a copy of it first if this
+  //           is the first time it is seen.
+  Id intern(std::string_view s) {
+    uint32_t fingerprint = fingerprint_of(s);
+    size_t slot = find_slot(s, fingerprint);
+    if (slots[slot].fingerprint != 0) {
+      return slots[slot].id;
+    }
+    assert(ends.size() < none);
+    Id id = static_cast<Id>(ends.size());
+    buffer.append(s);
+    ends.push_back(buffer.size());
+    slots[slot] = Slot{ fingerprint, id };
+    if (ends.size() > max_load()) {
+      grow();
+    }
+    return id;
+  }
+
+  // EFFECTS: Returns the ID of s, or none if it was never interned.
+  Id find(std::string_view s) const {
+    const Slot &slot = slots[find_slot(s, fingerprint_of(s))];
+    return slot.fingerprint == 0 ? none : slot.id;
+  }
+
+  // REQUIRES: id was returned by intern()
+  // EFFECTS : Returns the characters of the string with the given ID.
+  std::string_view str(Id id) const {
+    assert(id < ends.size());
+    size_t begin = id == 0 ? 0 : ends[id - 1];
+    return std::string_view(buffer.data() + begin, ends[id] - begin);
+  }
+
+  // EFFECTS: Returns every ID, in ascending order of its string, for
+  //          writing out a Map keyed by ID in alphabetical order.
+  std::vector<Id> sorted_ids() const {
+    std::vector<Id> ids(ends.size());
+    for (Id id = 0; id < ids.size(); ++id) {
+      ids[id] = id;
+    }
+    std::sort(ids.begin(), ids.end(), [this](Id lhs, Id rhs) {
+      return str(lhs) < str(rhs);
+    });
+    return ids;
+  }
+
+private:
+  // A slot of the table. A fingerprint of 0 marks an empty slot; others
+  // hold the high 32 bits of the scrambled hash of the string.
+  struct Slot {
+    uint32_t fingerprint;
+    Id id;
+  };
+
+  std::string buffer;
+  std::vector<size_t> ends;
+  std::vector<Slot> slots = std::vector<Slot>(16, Slot{ 0, 0 });
+  size_t shift = 64 - 4; // 64 - log2(slots.size())
+
+  size_t max_load() const {
+    return slots.size() - slots.size() / 4;
+  }
+
+  static uint32_t fingerprint_of(std::string_view s) {
+    uint64_t h = static_cast<uint64_t>(std::hash<std::string_view>{}(s)) *
+                 0x9E3779B97F4A7C15ull;
+    return static_cast<uint32_t>(h >> 32) | 1;
+  }
+
+  // EFFECTS: Returns the slot holding s, or else the empty slot where it
+  //          belongs.
+  size_t find_slot(std::string_view s, uint32_t fingerprint) const {
+    size_t mask = slots.size() - 1;
+    size_t i = home_of(fingerprint);
+    while (slots[i].fingerprint != 0 &&
+           (slots[i].fingerprint != fingerprint || str(slots[i].id) != s)) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  // EFFECTS: Returns the first slot to probe for the given fingerprint,
+  //          taken from its high bits.
+  size_t home_of(uint32_t fingerprint) const {
+    return static_cast<size_t>(fingerprint) >> (shift - 32);
+  }
+
+  // MODIFIES: slots, shift
+  // EFFECTS : Moves every slot into a new table of twice the capacity.
+  void grow() {
+    size_t capacity = 2 * slots.size();
+    std::vector<Slot> old(capacity, Slot{ 0, 0 });
+    old.swap(slots);
+    --shift;
+    size_t mask = slots.size() - 1;
+    for (const Slot &slot : old) {
+      if (slot.fingerprint != 0) {
+        size_t i = home_of(slot.fingerprint);
+        while (slots[i].fingerprint != 0) {
+          i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+      }
+    }
+  }
+};
+
+#endif // STRING_POOL_HPP
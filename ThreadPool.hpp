@@ -0,0 +1,259 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+/* ThreadPool.hpp
+ *
+ * A fixed set of worker threads that run tasks, for splitting work on a
+ * large tree across cores:
+ *
+ *   ThreadPool pool;                  // one worker per core
+ *   ThreadPool::Group group(pool);
+ *   group.run([&]() { ... });         // runs on some worker
+ *   group.run([&]() { ... });
+ *   group.wait();                     // both have finished
+ *
+ * or, for the common case of splitting work in two,
+ *
+ *   pool.parallel_invoke([&]() { ... }, [&]() { ... });
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>     //size_t
+#include <deque>
+#include <exception>   //exception_ptr, current_exception, rethrow_exception
+#include <functional>  //function
+#include <memory>      //unique_ptr
+#include <mutex>
+#include <thread>
+#include <utility>     //move
+#include <vector>
+
+class ThreadPool {
+  // OVERVIEW: Each worker thread has its own queue of tasks. A task
+  //           submitted by a worker goes on that worker's queue, and a
+  //           worker runs the newest task of its own queue first, so a
+  //           recursive split keeps working on the piece it just made,
+  //           whose data is still in its cache. A worker whose queue is
+  //           empty steals the oldest task of another queue, which for a
+  //           recursive split is the largest piece left. Tasks submitted
+  //           by other threads go on one shared queue.
+  //
+  //           Tasks are submitted through a Group, which can be waited
+  //           on. A thread waiting on a Group runs queued tasks itself
+  //           until the Group is done, so a task may itself split its
+  //           work into a nested Group and wait on it without tying up a
+  //           worker.
+
+public:
+  class Group {
+    // OVERVIEW: A set of tasks submitted to a ThreadPool that can be
+    //           waited on together. The first exception thrown by one of
+    //           the tasks is rethrown by wait().
+
+  public:
+    explicit Group(ThreadPool &pool_in)
+      : pool(pool_in), pending(0) { }
+
+    Group(const Group &) = delete;
+    Group &operator=(const Group &) = delete;
+
+    // EFFECTS: Waits for any tasks still running, discarding their
+    //          exceptions, since the tasks refer to this Group.
+    ~Group() {
+      finish();
+    }
+
+    // MODIFIES: the pool
+    // EFFECTS : Queues task to be run by a worker (or by a waiting
+    //           thread).
+    template <typename Task>
+    void run(Task task) {
+      std::function<void()> wrapped = [this, task = std::move(task)]() mutable {
+        try {
+          task();
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+        }
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+      };
+      pending.fetch_add(1, std::memory_order_relaxed);
+      try {
+        pool.push(std::move(wrapped));
+      } catch (...) {
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        throw;
+      }
+    }
+
+    // EFFECTS: Returns once every task of this Group has finished,
+    //          running queued tasks in the meantime, and rethrows the
+    //          first exception any of them threw.
+    void wait() {
+      finish();
+      if (error) {
+        std::exception_ptr thrown = error;
+        error = nullptr;
+        std::rethrow_exception(thrown);
+      }
+    }
+
+  private:
+    ThreadPool &pool;
+    std::atomic<size_t> pending;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    // EFFECTS: Runs queued tasks, or yields, until every task of this
+    //          Group has finished.
+    void finish() {
+      while (pending.load(std::memory_order_acquire) != 0) {
+        if (!pool.run_one()) {
+          std::this_thread::yield();
+        }
+      }
+    }
+  }; // ThreadPool::Group
+
+  // EFFECTS: Starts the given number of worker threads, by default one
+  //          per core. A pool of zero workers runs every task on the
+  //          thread that waits for it.
+  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency())
+    : queued(0), stopping(false) {
+    for (size_t i = 0; i <= threads; ++i) {
+      queues.emplace_back(new Queue);
+    }
+    for (size_t i = 1; i <= threads; ++i) {
+      workers.emplace_back([this, i]() { work(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // EFFECTS: Finishes the queued tasks and stops the workers.
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+    ready.notify_all();
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+  // EFFECTS: Returns the number of worker threads.
+  size_t size() const {
+    return workers.size();
+  }
+
+  // EFFECTS: Runs first on the pool and second on this thread, and
+  //          returns once both have finished, rethrowing an exception
+  //          thrown by either (second's, if both throw).
+  template <typename First, typename Second>
+  void parallel_invoke(First first, Second second) {
+    Group group(*this);
+    group.run(std::move(first));
+    second();
+    group.wait();
+  }
+
+private:
+  // A queue of tasks, taken from either end
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // queues[0] is shared by threads outside the pool; queues[i] belongs
+  // to worker i, for i from 1 to the number of workers
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> queued; // tasks in all queues
+  std::mutex sleep_mutex;
+  std::condition_variable ready;
+  bool stopping;
+
+  // The pool that the current thread works for, if any, and the index
+  // of its queue
+  inline static thread_local ThreadPool *current_pool = nullptr;
+  inline static thread_local size_t current_queue = 0;
+
+  // EFFECTS: Returns the index of the calling thread's queue.
+  size_t own_queue() const {
+    return current_pool == this ? current_queue : 0;
+  }
+
+  void push(std::function<void()> task) {
+    Queue &queue = *queues[own_queue()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+      queued.fetch_add(1, std::memory_order_release);
+    }
+    {
+      // Pairs with the check in work(), so the wakeup is not lost
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    ready.notify_one();
+  }
+
+  // EFFECTS: Takes the newest task of the calling thread's queue or,
+  //          failing that, the oldest task of another queue. Returns
+  //          whether there was one.
+  bool take(std::function<void()> &task) {
+    size_t own = own_queue();
+    for (size_t k = 0; k < queues.size(); ++k) {
+      size_t i = (own + k) % queues.size();
+      Queue &queue = *queues[i];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        if (i == own) {
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
+        } else {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // EFFECTS: Runs a queued task, if there is one, on this thread.
+  //          Returns whether there was one.
+  bool run_one() {
+    std::function<void()> task;
+    if (!take(task)) {
+      return false;
+    }
+    task();
+    return true;
+  }
+
+  // EFFECTS: The loop of the worker whose queue is queues[index]. Once
+  //          the pool is stopping, it leaves when every queue is empty.
+  void work(size_t index) {
+    current_pool = this;
+    current_queue = index;
+    while (true) {
+      if (run_one()) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      ready.wait(lock, [this]() {
+        return stopping || queued.load(std::memory_order_acquire) != 0;
+      });
+      if (stopping && queued.load(std::memory_order_acquire) == 0) {
+        return;
+      }
+    }
+  }
+};
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,1161 @@
+/* bench.cpp
+ *
+ * Micro-benchmarks for BinarySearchTree and Map.
+ *
+ * Usage: ./bench.exe [name ...]
+ *   With no arguments, runs every benchmark. Otherwise runs only the
+ *   benchmarks whose names are given.
+ *
+ * Build with "make bench", which compiles with optimizations and
+ * assertions disabled.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <mutex>
+#include <new>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BinarySearchTree.hpp"
+#include "Map.hpp"
+#include "ConcurrentMap.hpp"
+#include "HashMap.hpp"
+#include "StringPool.hpp"
+#include "ThreadPool.hpp"
+#include "Arena.hpp"
+#include "csvstream.hpp"
+
+using namespace std;
+
+// Count every heap allocation made by the program, so benchmarks can
+// report allocations per operation.
+static size_t heap_allocations = 0;
+
+void *operator new(size_t size) {
+  ++heap_allocations;
+  if (void *p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw bad_alloc();
+}
+
+// GCC cannot see that the replacement operator new above uses malloc
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// EFFECTS: Returns the number of bytes of heap memory in use, including
+//          the allocator's per-block overhead, or 0 if unknown.
+static size_t heap_bytes_in_use() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd; // small blocks + mmapped blocks
+#else
+  return 0;
+#endif
+}
+
+// Prevents the optimizer from discarding a computed value.
+static volatile size_t sink;
+
+// EFFECTS: Calls fn() once and returns the elapsed wall time in
+//          milliseconds.
+template <typename Fn>
+static double time_ms(Fn fn) {
+  auto start = chrono::steady_clock::now();
+  fn();
+  auto stop = chrono::steady_clock::now();
+  return chrono::duration<double, milli>(stop - start).count();
+}
+
+// EFFECTS: Prints one row of a benchmark table.
+static void report(const string &label, size_t n, double ms) {
+  cout << "  " << left << setw(36) << label
+       << right << setw(9) << n << " ops "
+       << fixed << setprecision(2) << setw(10) << ms << " ms "
+       << setw(9) << (ms * 1e6 / n) << " ns/op" << endl;
+}
+
+// EFFECTS: Returns the keys 0 .. n-1 in ascending order.
+static vector<int> sorted_keys(int n) {
+  vector<int> keys;
+  for (int i = 0; i < n; ++i) {
+    keys.push_back(i);
+  }
+  return keys;
+}
+
+// EFFECTS: Returns the keys 0 .. n-1 in a fixed pseudo-random order.
+static vector<int> shuffled_keys(int n) {
+  vector<int> keys = sorted_keys(n);
+  shuffle(keys.begin(), keys.end(), mt19937(280));
+  return keys;
+}
+
+// EFFECTS: Times inserting and then finding every key in a tree with the
+//          given balancing policy.
+template <typename Balance>
+static void bench_insert_find(const string &label, const vector<int> &keys) {
+  BinarySearchTree<int, less<int>, Balance> tree;
+  double insert_ms = time_ms([&]() {
+    for (int k : keys) {
+      tree.insert(k);
+    }
+  });
+  double find_ms = time_ms([&]() {
+    size_t found = 0;
+    for (int k : keys) {
+      found += tree.find(k) != tree.end();
+    }
+    sink = found;
+  });
+  report(label + " insert", keys.size(), insert_ms);
+  report(label + " find (height " + to_string(tree.height()) + ")",
+         keys.size(), find_ms);
+}
+
+// Compares plain and AVL insertion on sorted and random keys.
+static void bench_balance() {
+  cout << "balance: insert/find cost on sorted vs random keys" << endl;
+  // The unbalanced tree is quadratic on sorted input, so it gets a
+  // smaller input to keep the run short.
+  bench_insert_find<Unbalanced_tree>("unbalanced sorted", sorted_keys(10000));
+  bench_insert_find<Unbalanced_tree>("unbalanced random", shuffled_keys(10000));
+  bench_insert_find<AVL_tree>("avl sorted", sorted_keys(10000));
+  bench_insert_find<AVL_tree>("avl random", shuffled_keys(10000));
+  bench_insert_find<AVL_tree>("avl sorted", sorted_keys(1000000));
+  bench_insert_find<AVL_tree>("avl random", shuffled_keys(1000000));
+}
+
+// EFFECTS: Times a full in-order traversal of a tree built from keys.
+template <typename Balance>
+static void bench_traversal(const string &label, const vector<int> &keys) {
+  BinarySearchTree<int, less<int>, Balance> tree;
+  for (int k : keys) {
+    tree.insert(k);
+  }
+  double ms = time_ms([&]() {
+    size_t total = 0;
+    for (int elt : tree) {
+      total += static_cast<size_t>(elt);
+    }
+    sink = total;
+  });
+  double reverse_ms = time_ms([&]() {
+    size_t total = 0;
+    for (auto it = tree.rbegin(); it != tree.rend(); ++it) {
+      total += static_cast<size_t>(*it);
+    }
+    sink = total;
+  });
+  report(label + " traversal", keys.size(), ms);
+  report(label + " reverse traversal", keys.size(), reverse_ms);
+}
+
+// Measures the per-element cost of iterating over a whole tree, in both
+// directions.
+static void bench_iterate() {
+  cout << "iterate: full in-order traversal" << endl;
+  bench_traversal<Unbalanced_tree>("unbalanced sorted", sorted_keys(10000));
+  bench_traversal<AVL_tree>("avl random", shuffled_keys(1000000));
+}
+
+// A (label, content) row of a training or test CSV file.
+struct Post {
+  string label;
+  string content;
+};
+
+// EFFECTS: Reads every post from the given CSV file.
+static vector<Post> read_posts(const string &filename) {
+  csvstream csv(filename);
+  vector<Post> posts;
+  map<string, string> row;
+  while (csv >> row) {
+    posts.push_back({ row["tag"], row["content"] });
+  }
+  return posts;
+}
+
+// EFFECTS: Returns the distinct whitespace-separated words of content.
+static set<string> unique_words(const string &content) {
+  istringstream source(content);
+  set<string> words;
+  string word;
+  while (source >> word) {
+    words.insert(word);
+  }
+  return words;
+}
+
+// Tokenized posts of the large training set, shared by benchmarks.
+static const vector<vector<string>> &training_words() {
+  static vector<vector<string>> words;
+  if (words.empty()) {
+    for (const Post &post : read_posts("w14-f15_instructor_student.csv")) {
+      set<string> unique = unique_words(post.content);
+      words.emplace_back(unique.begin(), unique.end());
+    }
+  }
+  return words;
+}
+
+// Tokenized posts of the large test set, shared by benchmarks.
+static const vector<vector<string>> &test_words() {
+  static vector<vector<string>> words;
+  if (words.empty()) {
+    for (const Post &post : read_posts("w16_instructor_student.csv")) {
+      set<string> unique = unique_words(post.content);
+      words.emplace_back(unique.begin(), unique.end());
+    }
+  }
+  return words;
+}
+
+// EFFECTS: Times looking up every word of the test set in lookup_table.
+template <typename Table>
+static void bench_lookup_stream(const string &label, const Table &table) {
+  size_t lookups = 0;
+  double ms = time_ms([&]() {
+    size_t found = 0;
+    for (const vector<string> &post : test_words()) {
+      for (const string &word : post) {
+        found += table.find(word) != table.end();
+        ++lookups;
+      }
+    }
+    sink = found;
+  });
+  report(label, lookups, ms);
+}
+
+// EFFECTS: Times counting the words of the large training set into a
+//          Map with the given allocator, and then destroying the Map.
+template <typename Allocator>
+static void bench_word_counts(const string &label) {
+  const vector<vector<string>> &posts = training_words();
+  size_t words = 0;
+  for (const vector<string> &post : posts) {
+    words += post.size();
+  }
+
+  auto *counts = new Map<string, int, less<string>, AVL_tree, Allocator>();
+  size_t allocations_before = heap_allocations;
+  double build_ms = time_ms([&]() {
+    for (const vector<string> &post : posts) {
+      for (const string &word : post) {
+        ++(*counts)[word];
+      }
+    }
+  });
+  size_t allocations = heap_allocations - allocations_before;
+  size_t distinct = counts->size();
+  double destroy_ms = time_ms([&]() { delete counts; });
+
+  report(label + " count words", words, build_ms);
+  cout << "    " << distinct << " distinct words, " << allocations
+       << " heap allocations" << endl;
+  report(label + " destroy", distinct, destroy_ms);
+}
+
+// EFFECTS: Times building and destroying a tree of n ints.
+template <typename Allocator>
+static void bench_int_tree(const string &label, const vector<int> &keys) {
+  using Tree = BinarySearchTree<int, less<int>, AVL_tree, Allocator>;
+  auto *tree = new Tree();
+  size_t allocations_before = heap_allocations;
+  double build_ms = time_ms([&]() {
+    for (int k : keys) {
+      tree->insert(k);
+    }
+  });
+  size_t allocations = heap_allocations - allocations_before;
+  double destroy_ms = time_ms([&]() { delete tree; });
+  report(label + " insert", keys.size(), build_ms);
+  cout << "    " << allocations << " heap allocations" << endl;
+  report(label + " destroy", keys.size(), destroy_ms);
+}
+
+// Compares node allocation through the heap and through an Arena.
+static void bench_allocator() {
+  cout << "allocator: std::allocator vs Arena_allocator" << endl;
+  training_words(); // load outside the timed region
+  bench_word_counts<allocator<pair<const string, int>>>("heap");
+  bench_word_counts<Arena_allocator<pair<const string, int>>>("arena");
+  bench_int_tree<allocator<int>>("heap ints", shuffled_keys(1000000));
+  bench_int_tree<Arena_allocator<int>>("arena ints", shuffled_keys(1000000));
+}
+
+// Compares building a tree from sorted data by repeated insertion and
+// by linear-time bulk construction.
+static void bench_bulk() {
+  cout << "bulk: build from 1M sorted keys" << endl;
+  vector<int> keys = sorted_keys(1000000);
+  BinarySearchTree<int, less<int>, AVL_tree> inserted;
+  double insert_ms = time_ms([&]() {
+    for (int k : keys) {
+      inserted.insert(k);
+    }
+  });
+  BinarySearchTree<int, less<int>, AVL_tree> assigned;
+  double assign_ms = time_ms([&]() {
+    assigned.assign(keys.begin(), keys.end());
+  });
+  report("avl repeated insert", keys.size(), insert_ms);
+  report("assign (height " + to_string(assigned.height()) + ")",
+         keys.size(), assign_ms);
+}
+
+// Compares lookups in a pointer-based tree and in a FrozenTree.
+static void bench_freeze() {
+  cout << "freeze: pointer tree vs Eytzinger snapshot" << endl;
+  Map<string, int> vocabulary;
+  for (const vector<string> &post : training_words()) {
+    for (const string &word : post) {
+      ++vocabulary[word];
+    }
+  }
+  test_words(); // load outside the timed region
+  Map<string, int>::Frozen frozen;
+  double freeze_ms = time_ms([&]() { frozen = vocabulary.freeze(); });
+  report("freeze vocabulary", vocabulary.size(), freeze_ms);
+  bench_lookup_stream("test-set lookups, Map", vocabulary);
+  bench_lookup_stream("test-set lookups, frozen", frozen);
+
+  vector<int> keys = shuffled_keys(1000000);
+  BinarySearchTree<int, less<int>, AVL_tree> tree;
+  for (int k : keys) {
+    tree.insert(k);
+  }
+  FrozenTree<int> frozen_ints = tree.freeze();
+  double tree_ms = time_ms([&]() {
+    size_t found = 0;
+    for (int k : keys) {
+      found += tree.find(k) != tree.end();
+    }
+    sink = found;
+  });
+  double frozen_ms = time_ms([&]() {
+    size_t found = 0;
+    for (int k : keys) {
+      found += frozen_ints.find(k) != frozen_ints.end();
+    }
+    sink = found;
+  });
+  report("1M random int finds, tree", keys.size(), tree_ms);
+  report("1M random int finds, frozen", keys.size(), frozen_ms);
+}
+
+// EFFECTS: Times counting the words of the large training set into a
+//          Table, and then looking up every word of the test set.
+template <typename Table>
+static void bench_word_table(const string &label) {
+  Table counts;
+  size_t words = 0;
+  double build_ms = time_ms([&]() {
+    for (const vector<string> &post : training_words()) {
+      for (const string &word : post) {
+        ++counts[word];
+        ++words;
+      }
+    }
+  });
+  report(label + " count words", words, build_ms);
+  bench_lookup_stream(label + " test-set lookups", counts);
+}
+
+// EFFECTS: Same as above, for a Map with the given storage.
+template <typename Storage>
+static void bench_word_storage(const string &label) {
+  bench_word_table<Map<string, int, less<string>, Storage>>(label);
+}
+
+// EFFECTS: Times inserting and then finding n random ints in a Map with
+//          the given storage.
+template <typename Storage>
+static void bench_int_storage(const string &label, const vector<int> &keys) {
+  Map<int, int, less<int>, Storage> map;
+  double insert_ms = time_ms([&]() {
+    for (int k : keys) {
+      map[k] = k;
+    }
+  });
+  double find_ms = time_ms([&]() {
+    size_t found = 0;
+    for (int k : keys) {
+      found += map.find(k) != map.end();
+    }
+    sink = found;
+  });
+  report(label + " insert", keys.size(), insert_ms);
+  report(label + " find", keys.size(), find_ms);
+}
+
+// Compares Maps stored in an AVL tree and in a B-tree.
+static void bench_btree() {
+  cout << "btree: AVL tree vs B-tree Map storage" << endl;
+  training_words(); // load outside the timed region
+  test_words();
+  bench_word_storage<AVL_tree>("avl");
+  bench_word_storage<BTree_layout<>>("btree");
+  vector<int> keys = shuffled_keys(1000000);
+  bench_int_storage<AVL_tree>("avl 1M random ints", keys);
+  bench_int_storage<BTree_layout<>>("btree 1M random ints", keys);
+}
+
+// EFFECTS: Times a sliding window over keys: each key is inserted, and
+//          the key window positions earlier is erased, so the Map never
+//          holds more than window elements.
+template <typename Storage>
+static void bench_window(const string &label, const vector<int> &keys,
+                         size_t window) {
+  Map<int, int, less<int>, Storage> map;
+  double ms = time_ms([&]() {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      map[keys[i]] = 1;
+      if (i >= window) {
+        map.erase(keys[i - window]);
+      }
+    }
+  });
+  report(label + " (size " + to_string(map.size()) + ")", keys.size(), ms);
+}
+
+// Measures insertion and removal in a Map of bounded size.
+static void bench_erase() {
+  cout << "erase: sliding window of 100k over 1M random keys" << endl;
+  vector<int> keys = shuffled_keys(1000000);
+  bench_window<AVL_tree>("avl window", keys, 100000);
+  bench_window<BTree_layout<>>("btree window", keys, 100000);
+}
+
+// EFFECTS: Returns a Map from each word in posts to the number of posts
+//          that contain it.
+template <typename Storage>
+static Map<string, int, less<string>, Storage>
+count_words(const vector<vector<string>> &posts) {
+  Map<string, int, less<string>, Storage> counts;
+  for (const vector<string> &post : posts) {
+    for (const string &word : post) {
+      ++counts[word];
+    }
+  }
+  return counts;
+}
+
+// EFFECTS: Times combining the word counts of the two training sets,
+//          once by operator[] on each entry and once with merge().
+template <typename Storage>
+static void bench_merge_counts(const string &label) {
+  auto first = count_words<Storage>(training_words());
+  auto second = count_words<Storage>(test_words());
+  size_t entries = first.size() + second.size();
+
+  auto by_lookup = first;
+  double lookup_ms = time_ms([&]() {
+    for (const auto &entry : second) {
+      by_lookup[entry.first] += entry.second;
+    }
+  });
+  double merge_ms = time_ms([&]() {
+    first.merge(std::move(second), std::plus<int>());
+  });
+  sink = first.size() + by_lookup.size();
+  report(label + " operator[] per entry", entries, lookup_ms);
+  report(label + " merge", entries, merge_ms);
+}
+
+// Compares combining two Maps entry by entry and with merge().
+static void bench_merge() {
+  cout << "merge: combining w14-f15 and w16 word counts" << endl;
+  bench_merge_counts<AVL_tree>("avl");
+  bench_merge_counts<BTree_layout<>>("btree");
+}
+
+// EFFECTS: Times threads threads together counting the words of the
+//          training set and then looking up the words of the test set,
+//          with each thread taking every threads-th post. count(word)
+//          and lookup(word) do the work on the shared table.
+template <typename Count, typename Lookup>
+static void bench_shared_table(const string &label, size_t threads,
+                               Count count, Lookup lookup) {
+  const vector<vector<string>> &train = training_words();
+  const vector<vector<string>> &test = test_words();
+  size_t ops = 0;
+  for (const vector<string> &post : train) {
+    ops += post.size();
+  }
+  for (const vector<string> &post : test) {
+    ops += post.size();
+  }
+
+  double ms = time_ms([&]() {
+    vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t]() {
+        for (size_t i = t; i < train.size(); i += threads) {
+          for (const string &word : train[i]) {
+            count(word);
+          }
+        }
+        size_t found = 0;
+        for (size_t i = t; i < test.size(); i += threads) {
+          for (const string &word : test[i]) {
+            found += lookup(word);
+          }
+        }
+        sink = found;
+      });
+    }
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+  });
+  report(label + " " + to_string(threads) + " threads", ops, ms);
+}
+
+// Measures how counting and lookups on a shared table scale with the
+// number of threads, for a ConcurrentMap and for a Map behind one lock.
+static void bench_concurrent() {
+  size_t cores = std::thread::hardware_concurrency();
+  cout << "concurrent: shared word counts, " << cores << " cores" << endl;
+  training_words();
+  test_words();
+  for (size_t threads = 1; threads <= std::max<size_t>(cores, 4);
+       threads *= 2) {
+    ConcurrentMap<string, int> sharded;
+    bench_shared_table("sharded", threads,
+                       [&](const string &word) { sharded.increment(word); },
+                       [&](const string &word) {
+                         return sharded.contains(word);
+                       });
+    Map<string, int> locked;
+    std::mutex mutex;
+    bench_shared_table("one mutex", threads,
+                       [&](const string &word) {
+                         std::lock_guard<std::mutex> lock(mutex);
+                         ++locked[word];
+                       },
+                       [&](const string &word) {
+                         std::lock_guard<std::mutex> lock(mutex);
+                         return locked.find(word) != locked.end();
+                       });
+  }
+}
+
+// EFFECTS: Times writing every word count of the training set in
+//          ascending order of word, as the classifier's output would.
+static void bench_sorted_dump() {
+  Map<string, int> tree;
+  HashMap<string, int> hashed;
+  for (const vector<string> &post : training_words()) {
+    for (const string &word : post) {
+      ++tree[word];
+      ++hashed[word];
+    }
+  }
+  double tree_ms = time_ms([&]() {
+    size_t total = 0;
+    for (const auto &p : tree) {
+      total += p.first.size() + p.second;
+    }
+    sink = total;
+  });
+  double hashed_ms = time_ms([&]() {
+    size_t total = 0;
+    for (const auto *p : hashed.sorted()) {
+      total += p->first.size() + p->second;
+    }
+    sink = total;
+  });
+  report("avl in-order dump", tree.size(), tree_ms);
+  report("hash sorted() dump", hashed.size(), hashed_ms);
+}
+
+// Compares tree-based Maps with a HashMap on the word counts.
+static void bench_hash() {
+  cout << "hash: tree Maps vs HashMap on word counts" << endl;
+  training_words();
+  test_words();
+  bench_word_storage<AVL_tree>("avl");
+  bench_word_storage<BTree_layout<>>("btree");
+  bench_word_table<HashMap<string, int>>("hash");
+  bench_sorted_dump();
+}
+
+// EFFECTS: Times keeping a version of the training-set word counts after
+//          each of the first 200 test-set posts is counted in, as a
+//          model would when handing snapshots to readers, and then
+//          looking up the test set in the final version.
+template <typename Storage>
+static void bench_version_history(const string &label) {
+  using Counts = Map<string, int, less<string>, Storage>;
+  const vector<vector<string>> &posts = test_words();
+  vector<Counts> versions;
+  versions.reserve(201);
+  versions.push_back(count_words<Storage>(training_words()));
+  size_t allocations_before = heap_allocations;
+  double ms = time_ms([&]() {
+    for (size_t i = 0; i < 200; ++i) {
+      versions.push_back(versions.back());
+      for (const string &word : posts[i]) {
+        ++versions.back()[word];
+      }
+    }
+  });
+  size_t allocations = heap_allocations - allocations_before;
+  report(label + " copy and update", 200, ms);
+  cout << "    " << allocations / 200 << " heap allocations per version"
+       << endl;
+  bench_lookup_stream(label + " test-set lookups", versions.back());
+  double iterate_ms = time_ms([&]() {
+    size_t total = 0;
+    for (const auto &p : versions.back()) {
+      total += p.second;
+    }
+    sink = total;
+  });
+  report(label + " iterate", versions.back().size(), iterate_ms);
+}
+
+// Compares deep-copying Maps with sharing nodes between versions.
+static void bench_persistent() {
+  cout << "persistent: 200 versions of the word counts" << endl;
+  training_words();
+  test_words();
+  bench_version_history<AVL_tree>("avl");
+  bench_version_history<Persistent_tree>("persistent");
+}
+
+// EFFECTS: Reports the heap memory per element of the training-set word
+//          counts in a Map with the given storage, and times building
+//          the Map and looking up the test set in it.
+template <typename Storage>
+static void bench_footprint(const string &label) {
+  using Counts = Map<string, int, less<string>, Storage>;
+  size_t bytes_before = heap_bytes_in_use();
+  Counts *counts = nullptr;
+  double build_ms = time_ms([&]() {
+    counts = new Counts(count_words<Storage>(training_words()));
+  });
+  size_t built_bytes = heap_bytes_in_use() - bytes_before;
+  // A copy holds the same elements without any room to grow
+  bytes_before = heap_bytes_in_use();
+  Counts copy(*counts);
+  size_t copy_bytes = heap_bytes_in_use() - bytes_before;
+  double n = static_cast<double>(counts->size());
+  cout << "  " << left << setw(36) << label << fixed << setprecision(1)
+       << built_bytes / n << " bytes/element as built, "
+       << copy_bytes / n << " as copied; " << build_ms << " ms to build"
+       << endl;
+  bench_lookup_stream(label + " test-set lookups", *counts);
+  delete counts;
+}
+
+// Compares the memory footprint of pointer-linked and index-linked trees.
+static void bench_compact() {
+  cout << "compact: heap bytes per word count (sizeof(pair<string, int>) = "
+       << sizeof(pair<string, int>) << ")" << endl;
+  training_words();
+  test_words();
+  bench_footprint<AVL_tree>("avl");
+  bench_footprint<BTree_layout<>>("btree");
+  bench_footprint<Compact_tree>("compact");
+}
+
+// A training post: its label and its distinct words
+struct Labeled_post {
+  string label;
+  vector<string> words;
+};
+
+// EFFECTS: Returns the labeled posts of the large training set.
+static vector<Labeled_post> labeled_training_posts() {
+  vector<Labeled_post> posts;
+  for (const Post &post : read_posts("w14-f15_instructor_student.csv")) {
+    set<string> unique = unique_words(post.content);
+    posts.push_back({ post.label, { unique.begin(), unique.end() } });
+  }
+  return posts;
+}
+
+// EFFECTS: Times training a classifier's counts on the training set and
+//          looking up every (label, word) of the test set, with Maps
+//          keyed by strings.
+static void bench_string_keys(const vector<Labeled_post> &train) {
+  size_t bytes_before = heap_bytes_in_use();
+  Map<string, int> label_counts;
+  Map<string, int> word_counts;
+  Map<pair<string, string>, int> label_word_counts;
+  double train_ms = time_ms([&]() {
+    for (const Labeled_post &post : train) {
+      ++label_counts[post.label];
+      for (const string &word : post.words) {
+        ++word_counts[word];
+        ++label_word_counts[{ post.label, word }];
+      }
+    }
+  });
+  size_t bytes = heap_bytes_in_use() - bytes_before;
+  size_t lookups = 0;
+  double score_ms = time_ms([&]() {
+    size_t found = 0;
+    for (const vector<string> &post : test_words()) {
+      for (const auto &label : label_counts) {
+        for (const string &word : post) {
+          found += word_counts.find(word) != word_counts.end();
+          found += label_word_counts.find({ label.first, word }) !=
+                   label_word_counts.end();
+          ++lookups;
+        }
+      }
+    }
+    sink = found;
+  });
+  report("string keys train", train.size(), train_ms);
+  report("string keys score", lookups, score_ms);
+  cout << "    " << bytes / 1024 << " KiB of Maps" << endl;
+}
+
+// EFFECTS: Same as above, with the words and labels interned and Maps
+//          keyed by their IDs. Interning is part of the timed work.
+static void bench_interned_keys(const vector<Labeled_post> &train) {
+  using Id = StringPool::Id;
+  size_t bytes_before = heap_bytes_in_use();
+  StringPool pool;
+  Map<Id, int> label_counts;
+  Map<Id, int> word_counts;
+  Map<pair<Id, Id>, int> label_word_counts;
+  double train_ms = time_ms([&]() {
+    for (const Labeled_post &post : train) {
+      Id label = pool.intern(post.label);
+      ++label_counts[label];
+      for (const string &word : post.words) {
+        Id id = pool.intern(word);
+        ++word_counts[id];
+        ++label_word_counts[{ label, id }];
+      }
+    }
+  });
+  size_t bytes = heap_bytes_in_use() - bytes_before;
+  size_t lookups = 0;
+  double score_ms = time_ms([&]() {
+    size_t found = 0;
+    vector<Id> ids;
+    for (const vector<string> &post : test_words()) {
+      ids.clear();
+      for (const string &word : post) {
+        ids.push_back(pool.find(word)); // none matches no Map entry
+      }
+      for (const auto &label : label_counts) {
+        for (Id id : ids) {
+          found += word_counts.find(id) != word_counts.end();
+          found += label_word_counts.find({ label.first, id }) !=
+                   label_word_counts.end();
+          ++lookups;
+        }
+      }
+    }
+    sink = found;
+  });
+  report("interned keys train", train.size(), train_ms);
+  report("interned keys score", lookups, score_ms);
+  cout << "    " << bytes / 1024 << " KiB of Maps and pool" << endl;
+}
+
+// Compares a classifier's Maps keyed by strings and by interned IDs.
+static void bench_intern() {
+  cout << "intern: classifier counts keyed by strings vs interned IDs"
+       << endl;
+  vector<Labeled_post> train = labeled_training_posts();
+  test_words();
+  bench_string_keys(train);
+  bench_interned_keys(train);
+}
+
+// EFFECTS: Times summing a tree of keys.size() random keys through its
+//          iterators and through for_each_inorder.
+static void bench_visit_sum(const vector<int> &keys) {
+  BinarySearchTree<int, less<int>, AVL_tree> tree;
+  for (int k : keys) {
+    tree.insert(k);
+  }
+  double iterate_ms = time_ms([&]() {
+    size_t total = 0;
+    for (int elt : tree) {
+      total += static_cast<size_t>(elt);
+    }
+    sink = total;
+  });
+  double visit_ms = time_ms([&]() {
+    size_t total = 0;
+    tree.for_each_inorder([&total](int elt) {
+      total += static_cast<size_t>(elt);
+    });
+    sink = total;
+  });
+  report("avl random sum by iterator", keys.size(), iterate_ms);
+  report("avl random sum by for_each_inorder", keys.size(), visit_ms);
+}
+
+// EFFECTS: Times recomputing the log-likelihood of every (label, word)
+//          count of the training set, by iterating and by
+//          parallel_for_each with pools of several sizes.
+static void bench_log_likelihoods() {
+  Map<string, int> label_counts;
+  Map<pair<string, string>, pair<int, double>> likelihoods;
+  for (const Labeled_post &post : labeled_training_posts()) {
+    ++label_counts[post.label];
+    for (const string &word : post.words) {
+      ++likelihoods[{ post.label, word }].first;
+    }
+  }
+  // The number of posts with each label, looked up without locking
+  auto posts_with = [&](const string &label) {
+    return static_cast<double>(label_counts.find(label)->second);
+  };
+  double iterate_ms = time_ms([&]() {
+    for (auto &entry : likelihoods) {
+      entry.second.second = log(entry.second.first /
+                                posts_with(entry.first.first));
+    }
+  });
+  report("log-likelihoods by iterator", likelihoods.size(), iterate_ms);
+  for (size_t threads : { 1, 2, 4 }) {
+    ThreadPool pool(threads);
+    double ms = time_ms([&]() {
+      likelihoods.parallel_for_each([&](auto &entry) {
+        entry.second.second = log(entry.second.first /
+                                  posts_with(entry.first.first));
+      }, pool);
+    });
+    report("log-likelihoods on " + to_string(threads) + " threads",
+           likelihoods.size(), ms);
+  }
+  cout << "    " << thread::hardware_concurrency() << " cores" << endl;
+}
+
+// Measures visiting every element through a callable rather than an
+// iterator, and spreading the visits over a thread pool.
+static void bench_foreach() {
+  cout << "foreach: visitor traversal and parallel_for_each" << endl;
+  bench_visit_sum(shuffled_keys(1000000));
+  bench_log_likelihoods();
+}
+
+// EFFECTS: Times looking up every word occurrence of the test set, in
+//          the order they appear and with repeats, in table.
+template <typename Table>
+static void bench_token_stream(const string &label, const Table &table) {
+  static vector<string> tokens;
+  if (tokens.empty()) {
+    for (const Post &post : read_posts("w16_instructor_student.csv")) {
+      istringstream source(post.content);
+      string word;
+      while (source >> word) {
+        tokens.push_back(word);
+      }
+    }
+  }
+  double ms = time_ms([&]() {
+    size_t found = 0;
+    for (const string &word : tokens) {
+      found += table.find(word) != table.end();
+    }
+    sink = found;
+  });
+  report(label, tokens.size(), ms);
+}
+
+// EFFECTS: Counts the training words into a Map with the given storage,
+//          then times the test set's lookup streams against it.
+template <typename Storage>
+static void bench_skewed_lookups(const string &label) {
+  Map<string, int, less<string>, Storage> counts;
+  for (const vector<string> &post : training_words()) {
+    for (const string &word : post) {
+      ++counts[word];
+    }
+  }
+  bench_lookup_stream(label + " distinct words per post", counts);
+  bench_token_stream(label + " every word occurrence", counts);
+}
+
+// Compares a splay tree, which moves frequent words to the root, with
+// the balanced AVL tree on the skewed lookups of a classifier.
+static void bench_splay() {
+  cout << "splay: test-set word lookups, avl vs splay" << endl;
+  test_words();
+  bench_skewed_lookups<AVL_tree>("avl");
+  bench_skewed_lookups<Splay_tree>("splay");
+}
+
+// EFFECTS: Times inserting the (label, word) pairs of the training set,
+//          grouped by label and sorted as in a dump of the counts, into
+//          a Map with and without hints.
+static void bench_hinted_pairs() {
+  Map<pair<string, string>, int> dump;
+  for (const Labeled_post &post : labeled_training_posts()) {
+    for (const string &word : post.words) {
+      ++dump[{ post.label, word }];
+    }
+  }
+  vector<pair<pair<string, string>, int>> rows(dump.begin(), dump.end());
+  Map<pair<string, string>, int> plain;
+  double plain_ms = time_ms([&]() {
+    for (const auto &row : rows) {
+      plain.insert(row);
+    }
+  });
+  Map<pair<string, string>, int> hinted;
+  double hinted_ms = time_ms([&]() {
+    auto hint = hinted.end();
+    for (const auto &row : rows) {
+      hint = hinted.insert(hint, row);
+    }
+  });
+  report("(label, word) insert", rows.size(), plain_ms);
+  report("(label, word) hinted insert", rows.size(), hinted_ms);
+}
+
+// Compares inserting sorted keys from the root and from a hint.
+static void bench_hint() {
+  cout << "hint: sorted inserts from the root vs from the last insert"
+       << endl;
+  vector<int> keys = sorted_keys(1000000);
+  BinarySearchTree<int, less<int>, AVL_tree> plain;
+  double plain_ms = time_ms([&]() {
+    for (int k : keys) {
+      plain.insert(k);
+    }
+  });
+  BinarySearchTree<int, less<int>, AVL_tree> hinted;
+  double hinted_ms = time_ms([&]() {
+    auto hint = hinted.end();
+    for (int k : keys) {
+      hint = hinted.insert(hint, k);
+    }
+  });
+  BinarySearchTree<int, less<int>, AVL_tree> appended;
+  double append_ms = time_ms([&]() {
+    for (int k : keys) {
+      appended.insert(appended.end(), k);
+    }
+  });
+  double find_ms = time_ms([&]() {
+    size_t found = 0;
+    for (int k : keys) {
+      found += plain.find(k) != plain.end();
+    }
+    sink = found;
+  });
+  double hinted_find_ms = time_ms([&]() {
+    size_t found = 0;
+    auto it = hinted.begin();
+    for (int k : keys) {
+      it = hinted.find(it, k);
+      found += it != hinted.end();
+    }
+    sink = found;
+  });
+  report("avl sorted insert", keys.size(), plain_ms);
+  report("avl sorted insert, hint last", keys.size(), hinted_ms);
+  report("avl sorted insert, hint end", keys.size(), append_ms);
+  report("avl ascending find", keys.size(), find_ms);
+  report("avl ascending hinted find", keys.size(), hinted_find_ms);
+  bench_hinted_pairs();
+}
+
+// EFFECTS: Times copying, checking and freeing tree, on this thread
+//          and then in parallel on a pool of each given size.
+template <typename Tree>
+static void bench_bulk_ops(const string &label, const Tree &tree) {
+  size_t n = tree.size();
+  {
+    Tree copy;
+    report(label + " serial copy", n, time_ms([&]() {
+      Tree other(tree);
+      copy.swap(other);
+    }));
+    report(label + " serial check", n, time_ms([&]() {
+      sink = copy.check_sorting_invariant() && copy.check_balance_invariant();
+    }));
+    report(label + " serial destroy", n, time_ms([&]() { copy = Tree(); }));
+  }
+  size_t cores = max<size_t>(thread::hardware_concurrency(), 1);
+  for (size_t threads = 1; threads <= max<size_t>(cores, 4); threads *= 2) {
+    ThreadPool pool(threads);
+    string on = " on " + to_string(threads) + " threads";
+    Tree copy;
+    report(label + " copy" + on, n, time_ms([&]() {
+      Tree other(tree, pool);
+      copy.swap(other);
+    }));
+    report(label + " check" + on, n, time_ms([&]() {
+      sink = copy.check_sorting_invariant(pool) &&
+             copy.check_balance_invariant(pool);
+    }));
+    // The state of the heap sways freeing times more than the threads
+    // do, so free two serial copies made alike, one each way
+    copy = Tree(tree);
+    report(label + " serial destroy, again", n,
+           time_ms([&]() { copy = Tree(); }));
+    copy = Tree(tree);
+    report(label + " destroy" + on, n, time_ms([&]() { copy.clear(pool); }));
+  }
+  cout << "    " << cores << " cores" << endl;
+}
+
+// Measures copying, checking and destroying a very large tree in
+// parallel, as pool size grows.
+static void bench_parallel() {
+  cout << "parallel: bulk tree operations on 1..N threads" << endl;
+  BinarySearchTree<int, less<int>, AVL_tree> tree;
+  for (int k : shuffled_keys(2000000)) {
+    tree.insert(k);
+  }
+  bench_bulk_ops("avl 2M ints", tree);
+}
+
+// EFFECTS: Counts the training words into a Map with the given storage,
+//          in the order they occur, and prints the shape of its tree and
+//          the time stats() takes.
+template <typename Storage>
+static void bench_word_stats(const string &label) {
+  Map<string, int, less<string>, Storage> counts;
+  for (const vector<string> &post : training_words()) {
+    for (const string &word : post) {
+      ++counts[word];
+    }
+  }
+  Tree_stats stats;
+  double ms = time_ms([&]() { stats = counts.stats(); });
+  report(label + " stats()", stats.nodes, ms);
+  cout << "    height " << stats.max_depth
+       << " (minimum " << stats.min_height << "), average depth "
+       << setprecision(2) << stats.average_depth
+       << ", " << stats.expected_comparisons << " comparisons per find, "
+       << stats.bytes / 1024 << " KiB" << endl;
+}
+
+// Reports the shape each balancing policy gives the training vocabulary.
+static void bench_stats() {
+  cout << "stats: tree shape of the training vocabulary" << endl;
+  training_words();
+  bench_word_stats<AVL_tree>("avl");
+  bench_word_stats<Unbalanced_tree>("unbalanced");
+  bench_word_stats<Splay_tree>("splay");
+}
+
+// Reports the operation counters of a classifier: training counts
+// words with operator[], and scoring a post looks up each of its words
+// under each label. Needs the counters compiled in (bench_instrumented.exe).
+static void bench_instrument() {
+  cout << "instrument: operation counters of a classifier" << endl;
+#ifndef MAP_INSTRUMENT
+  cout << "  counters are compiled out; run bench_instrumented.exe" << endl;
+#else
+  vector<Labeled_post> train = labeled_training_posts();
+  const vector<vector<string>> &test = test_words();
+  reset_op_counters();
+  Map<string, int> label_counts;
+  Map<string, int> word_counts;
+  Map<pair<string, string>, int> label_word_counts;
+  for (const Labeled_post &post : train) {
+    ++label_counts[post.label];
+    for (const string &word : post.words) {
+      ++word_counts[word];
+      ++label_word_counts[{ post.label, word }];
+    }
+  }
+  cout << "  training, " << train.size() << " posts" << endl
+       << op_counters();
+
+  reset_op_counters();
+  double score = 0;
+  for (const vector<string> &post : test) {
+    for (const auto &label : label_counts) {
+      for (const string &word : post) {
+        auto found = label_word_counts.find({ label.first, word });
+        if (found != label_word_counts.end()) {
+          score += found->second;
+        } else if (word_counts.find(word) != word_counts.end()) {
+          score += 0.5;
+        }
+      }
+    }
+  }
+  sink = static_cast<size_t>(score);
+  const Op_stats &find = op_counters().find;
+  cout << "  scoring, " << test.size() << " posts" << endl
+       << op_counters()
+       << "  " << double(find.comparisons) / test.size()
+       << " comparisons in find per post" << endl;
+#endif
+}
+
+struct Benchmark {
+  const char *name;
+  void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+  { "balance", bench_balance },
+  { "iterate", bench_iterate },
+  { "allocator", bench_allocator },
+  { "bulk", bench_bulk },
+  { "freeze", bench_freeze },
+  { "btree", bench_btree },
+  { "erase", bench_erase },
+  { "merge", bench_merge },
+  { "concurrent", bench_concurrent },
+  { "hash", bench_hash },
+  { "persistent", bench_persistent },
+  { "compact", bench_compact },
+  { "intern", bench_intern },
+  { "foreach", bench_foreach },
+  { "splay", bench_splay },
+  { "hint", bench_hint },
+  { "parallel", bench_parallel },
+  { "stats", bench_stats },
+  { "instrument", bench_instrument },
+};
+
+int main(int argc, char *argv[]) {
+  for (const Benchmark &b : benchmarks) {
+    bool selected = argc == 1;
+    for (int i = 1; i < argc; ++i) {
+      selected = selected || strcmp(argv[i], b.name) == 0;
+    }
+    if (selected) {
+      b.run();
+      cout << endl;
+    }
+  }
+}